@@ -0,0 +1,426 @@
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "lexer/input.h"
+#include "lexer/lexer.h"
+#include "ast/FunctionAST.h"
+#include "ast/ProgramAST.h"
+#include "ast/PrototypeAST.h"
+#include "parser/parser.h"
+#include "codegen/codegen.h"
+#include "codegen/optimizer.h"
+#include "codegen/parallel_codegen.h"
+#include "interp/interpreter.h"
+#include "jit/jit_manager.h"
+#include "passes/pass_manager.h"
+#include "utils/diagnostics.h"
+#include "utils/thread_pool.h"
+
+#include "corpus.h"
+
+// Only errors are reported, so that prompts and results are not measured.
+[[maybe_unused]] static const bool quiet =
+    (Diagnostics::SetEnabled(DiagBit(DiagCategory::Error)), true);
+
+// Compile and run a parsed corpus with ParallelCodeGen on 1..N threads,
+// including creating the JIT.
+static void BM_ParallelCodeGen(benchmark::State &state)
+{
+    std::string source = GenerateCorpus(CorpusShape::Mixed, state.range(0));
+    auto tokens = std::make_shared<TokenBuffer>(
+        Lexer(std::make_unique<MemoryInput>(source)).Tokenize());
+    auto program = Parser(tokens).ParseProgram().value();
+
+    ThreadPool pool(state.range(1));
+    for (auto _ : state)
+    {
+        JITOptions opts;
+        opts.NumCompileThreads = pool.size();
+        ParallelCodeGen codegen(pool, std::make_shared<JITManager>(opts));
+        codegen.Compile(program.get());
+    }
+
+    state.counters["items"] = benchmark::Counter(
+        state.iterations() * program->Nodes.size(), benchmark::Counter::kIsRate);
+    state.counters["threads"] = state.range(1);
+}
+
+BENCHMARK(BM_ParallelCodeGen)
+    ->ArgsProduct({{10000}, benchmark::CreateRange(1, std::thread::hardware_concurrency(), 2)})
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+// Load a corpus item by item like the interactive driver does, and run its
+// top-level expressions, with functions compiled eagerly or on first call.
+template <bool Lazy>
+static void BM_Startup(benchmark::State &state)
+{
+    std::string source = GenerateCorpus(CorpusShape::Mixed, state.range(0));
+    auto tokens = std::make_shared<TokenBuffer>(
+        Lexer(std::make_unique<MemoryInput>(source)).Tokenize());
+    auto program = Parser(tokens).ParseProgram().value();
+
+    size_t compiled = 0;
+    size_t defined = 0;
+    for (auto _ : state)
+    {
+        JITOptions opts;
+        opts.Lazy = Lazy;
+        auto jm = std::make_shared<JITManager>(opts);
+        CodeGen codegen(jm);
+        program->accept(&codegen);
+        compiled = jm->NumMaterialized();
+        defined = jm->NumLazy();
+    }
+
+    if (Lazy)
+        state.counters["compiled_fraction"] = defined ? double(compiled) / defined : 0;
+}
+
+BENCHMARK_TEMPLATE(BM_Startup, false)->Arg(1000)->Arg(10000)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_Startup, true)->Arg(1000)->Arg(10000)->Unit(benchmark::kMillisecond);
+
+// Compile a corpus one module per function, as the interactive driver does,
+// or as a single batch module. Every iteration compiles in a child process,
+// so that its peak RSS can be reported on its own.
+template <bool Batch>
+static void BM_CompileMode(benchmark::State &state)
+{
+    std::string source = GenerateCorpus(CorpusShape::Mixed, state.range(0));
+    auto tokens = std::make_shared<TokenBuffer>(
+        Lexer(std::make_unique<MemoryInput>(source)).Tokenize());
+
+    long maxRSS = 0;
+    for (auto _ : state)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            auto program = Parser(tokens).ParseProgram().value();
+            auto jm = std::make_shared<JITManager>();
+            if (Batch)
+            {
+                ThreadPool pool(1);
+                ParallelCodeGen codegen(pool, jm, 1);
+                codegen.Compile(program.get());
+            }
+            else
+            {
+                CodeGen codegen(jm);
+                program->accept(&codegen);
+            }
+            _exit(0);
+        }
+
+        int status;
+        struct rusage usage;
+        wait4(pid, &status, 0, &usage);
+        maxRSS = std::max(maxRSS, usage.ru_maxrss);
+    }
+
+    state.counters["peak_rss_mb"] = maxRSS / 1024.0;
+}
+
+BENCHMARK_TEMPLATE(BM_CompileMode, false)->Arg(5000)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_CompileMode, true)->Arg(5000)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+// Compile a corpus as a single batch module at each optimization level,
+// -O0, -O1, -O2, -O3 and -Os, to weigh compile time against code quality.
+static void BM_OptLevel(benchmark::State &state)
+{
+    std::string source = GenerateCorpus(CorpusShape::Mixed, state.range(0));
+    auto tokens = std::make_shared<TokenBuffer>(
+        Lexer(std::make_unique<MemoryInput>(source)).Tokenize());
+    auto program = Parser(tokens).ParseProgram().value();
+
+    OptimizerOptions optOpts;
+    optOpts.Level = static_cast<OptLevel>(state.range(1));
+    ThreadPool pool(1);
+    for (auto _ : state)
+    {
+        ParallelCodeGen codegen(pool, std::make_shared<JITManager>(JITOptions(), optOpts), 1);
+        codegen.Compile(program.get());
+    }
+}
+
+BENCHMARK(BM_OptLevel)
+    ->ArgsProduct({{1000}, {0, 1, 2, 3, 4}})
+    ->Unit(benchmark::kMillisecond);
+
+// Run the recursive function of a call-heavy corpus compiled one module
+// per function, with or without the bodies of earlier definitions
+// available to the optimizer.
+template <bool CrossModule>
+static void BM_CallHeavy(benchmark::State &state)
+{
+    std::string source = GenerateCorpus(CorpusShape::CallHeavy, state.range(0));
+    auto tokens = std::make_shared<TokenBuffer>(
+        Lexer(std::make_unique<MemoryInput>(source)).Tokenize());
+    auto program = Parser(tokens).ParseProgram().value();
+
+    OptimizerOptions optOpts;
+    optOpts.CrossModule = CrossModule;
+    auto jm = std::make_shared<JITManager>(JITOptions(), optOpts);
+    CodeGen codegen(jm);
+    program->accept(&codegen);
+
+    auto run = jm->ExitOnErr(jm->JIT().lookup("run")).getAddress().toPtr<double (*)(double)>();
+    for (auto _ : state)
+        benchmark::DoNotOptimize(run(1000));
+}
+
+BENCHMARK_TEMPLATE(BM_CallHeavy, false)->Arg(100);
+BENCHMARK_TEMPLATE(BM_CallHeavy, true)->Arg(100);
+
+// Compile a call-heavy corpus one module per function, with every function
+// optimized up front or tiered, and run its recursive function. compile_ms
+// is the time to define all functions, the iterations measure the code
+// that is eventually reached.
+template <bool Tiered>
+static void BM_TieredJIT(benchmark::State &state)
+{
+    std::string source = GenerateCorpus(CorpusShape::CallHeavy, state.range(0));
+    auto tokens = std::make_shared<TokenBuffer>(
+        Lexer(std::make_unique<MemoryInput>(source)).Tokenize());
+    auto program = Parser(tokens).ParseProgram().value();
+
+    auto start = std::chrono::steady_clock::now();
+    JITOptions opts;
+    opts.Tiered = Tiered;
+    auto jm = std::make_shared<JITManager>(opts);
+    CodeGen codegen(jm);
+    program->accept(&codegen);
+    std::chrono::duration<double, std::milli> compile = std::chrono::steady_clock::now() - start;
+
+    auto run = jm->ExitOnErr(jm->JIT().lookup("run")).getAddress().toPtr<double (*)(double)>();
+    for (auto _ : state)
+        benchmark::DoNotOptimize(run(1000));
+
+    state.counters["compile_ms"] = compile.count();
+}
+
+BENCHMARK_TEMPLATE(BM_TieredJIT, false)->Arg(1000);
+BENCHMARK_TEMPLATE(BM_TieredJIT, true)->Arg(1000);
+
+// Evaluate the top-level expressions of a corpus, after defining its
+// functions, with the JIT or with the interpreter. Each iteration runs one
+// expression, so the time per iteration is the latency of the path.
+template <bool Interp>
+static void BM_TopLevelExpr(benchmark::State &state)
+{
+    std::string source = GenerateCorpus(CorpusShape::Mixed, state.range(0));
+    auto tokens = std::make_shared<TokenBuffer>(
+        Lexer(std::make_unique<MemoryInput>(source)).Tokenize());
+    auto program = Parser(tokens).ParseProgram().value();
+
+    auto jm = std::make_shared<JITManager>();
+    CodeGen codegen(jm);
+    Interpreter interpreter([&jm](Symbol name)
+                            { return jm->JITLookup(std::string(name.str())); });
+    if (Interp)
+        codegen.Interp = &interpreter;
+
+    std::vector<FunctionAST *> mains;
+    for (AST *node : program->Nodes)
+    {
+        auto fn = dynamic_cast<FunctionAST *>(node);
+        if (fn && fn->Proto->isMain())
+            mains.push_back(fn);
+        else
+            node->accept(&codegen);
+    }
+
+    size_t i = 0;
+    for (auto _ : state)
+        mains[i++ % mains.size()]->accept(&codegen);
+
+    if (Interp)
+        state.counters["native_calls"] = interpreter.NumNativeCalls;
+}
+
+BENCHMARK_TEMPLATE(BM_TopLevelExpr, false)->Arg(1000)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(BM_TopLevelExpr, true)->Arg(1000)->Unit(benchmark::kMicrosecond);
+
+// Parse and compile a corpus item by item, as the interactive driver does,
+// with or without the AST passes ahead of CodeGen.
+template <bool Passes>
+static void BM_ASTPasses(benchmark::State &state)
+{
+    std::string source = GenerateCorpus(CorpusShape::Mixed, state.range(0));
+    auto tokens = std::make_shared<TokenBuffer>(
+        Lexer(std::make_unique<MemoryInput>(source)).Tokenize());
+
+    size_t rewrites = 0;
+    for (auto _ : state)
+    {
+        // The passes rewrite the program, so it is parsed every time.
+        ASTPassManager passes;
+        CodeGen codegen(std::make_shared<JITManager>());
+        std::vector<Visitor *> visitors;
+        if (Passes)
+            visitors.push_back(&passes);
+        visitors.push_back(&codegen);
+        Parser(tokens).ParseProgram(visitors);
+
+        rewrites = 0;
+        for (const Rewriter *pass : passes.passes())
+            rewrites += pass->NumRewrites;
+    }
+
+    state.counters["rewrites"] = rewrites;
+}
+
+BENCHMARK_TEMPLATE(BM_ASTPasses, false)->Arg(1000)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_ASTPasses, true)->Arg(1000)->Unit(benchmark::kMillisecond);
+
+// Start a JIT with an object cache and compile a corpus item by item, as
+// after a restart: with an empty cache, or with one filled by an earlier
+// run of the same corpus.
+template <bool Warm>
+static void BM_ObjectCache(benchmark::State &state)
+{
+    std::string source = GenerateCorpus(CorpusShape::Mixed, state.range(0));
+    auto tokens = std::make_shared<TokenBuffer>(
+        Lexer(std::make_unique<MemoryInput>(source)).Tokenize());
+
+    char dir[] = "/tmp/kaleido-cache-XXXXXX";
+    mkdtemp(dir);
+    JITOptions jitOpts;
+    jitOpts.CacheDir = dir;
+
+    auto compile = [&]()
+    {
+        CodeGen codegen(std::make_shared<JITManager>(jitOpts));
+        Parser(tokens).ParseProgram({&codegen});
+    };
+    if (Warm)
+        compile();
+
+    for (auto _ : state)
+    {
+        if (!Warm)
+        {
+            state.PauseTiming();
+            std::filesystem::remove_all(dir);
+            state.ResumeTiming();
+        }
+        compile();
+    }
+
+    std::filesystem::remove_all(dir);
+}
+
+BENCHMARK_TEMPLATE(BM_ObjectCache, false)->Arg(1000)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_ObjectCache, true)->Arg(1000)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+// Compile the functions of a corpus of every shape, one module per
+// function, and have the JIT compile them all to native code.
+static void BM_CompileShape(benchmark::State &state)
+{
+    CorpusShape shape = AllCorpusShapes[state.range(0)];
+    std::string source = GenerateCorpus(shape, state.range(1));
+    auto tokens = std::make_shared<TokenBuffer>(
+        Lexer(std::make_unique<MemoryInput>(source)).Tokenize());
+    auto program = Parser(tokens).ParseProgram().value();
+
+    // Top-level expressions would be run, only the functions are compiled.
+    std::vector<FunctionAST *> fns;
+    std::vector<std::string> names;
+    for (AST *node : program->Nodes)
+    {
+        auto fn = dynamic_cast<FunctionAST *>(node);
+        if (fn && !fn->Proto->isMain())
+        {
+            fns.push_back(fn);
+            names.push_back(std::string(fn->Proto->Name.str()));
+        }
+    }
+
+    for (auto _ : state)
+    {
+        auto jm = std::make_shared<JITManager>();
+        CodeGen codegen(jm);
+        for (FunctionAST *fn : fns)
+            fn->accept(&codegen);
+        jm->JITMaterialize(names);
+    }
+
+    state.SetLabel(CorpusShapeName(shape));
+    state.counters["functions"] = benchmark::Counter(
+        state.iterations() * fns.size(), benchmark::Counter::kIsRate);
+}
+
+// The number of items of each shape, so that each corpus takes a similar
+// time to compile.
+BENCHMARK(BM_CompileShape)
+    ->Args({0, 100})
+    ->Args({1, 100})
+    ->Args({2, 200})
+    ->Args({3, 20})
+    ->Args({4, 200})
+    ->Args({5, 1000})
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+// Define one small function after another and look each up, so the time
+// per iteration is the latency from AST to callable native code.
+static void BM_JITLatency(benchmark::State &state)
+{
+    std::string source = GenerateCorpus(CorpusShape::SmallFunctions, 10000);
+    auto tokens = std::make_shared<TokenBuffer>(
+        Lexer(std::make_unique<MemoryInput>(source)).Tokenize());
+    auto program = Parser(tokens).ParseProgram().value();
+
+    std::shared_ptr<JITManager> jm;
+    std::unique_ptr<CodeGen> codegen;
+    size_t next = program->Nodes.size();
+    for (auto _ : state)
+    {
+        // Every function can be defined once per JIT.
+        if (next == program->Nodes.size())
+        {
+            state.PauseTiming();
+            codegen.reset();
+            jm = std::make_shared<JITManager>();
+            codegen = std::make_unique<CodeGen>(jm);
+            next = 0;
+            state.ResumeTiming();
+        }
+        auto fn = static_cast<FunctionAST *>(program->Nodes[next++]);
+        fn->accept(codegen.get());
+        benchmark::DoNotOptimize(jm->JITLookup(std::string(fn->Proto->Name.str())));
+    }
+}
+
+BENCHMARK(BM_JITLatency)->UseRealTime()->Unit(benchmark::kMicrosecond);
+
+// Call a doubly recursive function compiled by the JIT, fib-like, for the
+// speed of the generated code.
+static void BM_Execute(benchmark::State &state)
+{
+    std::string source = GenerateCorpus(CorpusShape::Recursive, 1);
+    auto tokens = std::make_shared<TokenBuffer>(
+        Lexer(std::make_unique<MemoryInput>(source)).Tokenize());
+    auto program = Parser(tokens).ParseProgram().value();
+
+    auto jm = std::make_shared<JITManager>();
+    CodeGen codegen(jm);
+    program->Nodes[0]->accept(&codegen);
+    auto run = reinterpret_cast<double (*)(double)>(jm->JITLookup("r0"));
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(run(state.range(0)));
+}
+
+BENCHMARK(BM_Execute)->Arg(15)->Arg(25)->Unit(benchmark::kMicrosecond);
@@ -0,0 +1,62 @@
+#!/usr/bin/env python3
+"""Compares two JSON outputs of the benchmarks, e.g. of two commits.
+
+    compare.py base.json new.json
+
+For every benchmark in both, prints the real time of each run and their
+ratio, and the same for every rate counter, e.g. tokens/s. A ratio above 1
+means new takes longer, or processes more per second.
+"""
+
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        runs = json.load(f)["benchmarks"]
+    # Repetitions report aggregates, compare the means only.
+    return {
+        r["name"]: r
+        for r in runs
+        if r.get("run_type") != "aggregate" or r.get("aggregate_name") == "mean"
+    }
+
+
+# Keys of a run that are not counters.
+FIELDS = {
+    "name", "family_index", "per_family_instance_index", "run_name",
+    "run_type", "repetitions", "repetition_index", "threads", "iterations",
+    "real_time", "cpu_time", "time_unit", "label", "aggregate_name",
+    "aggregate_unit", "error_occurred", "error_message",
+}
+
+
+def main(argv):
+    if len(argv) != 3:
+        print(__doc__.strip(), file=sys.stderr)
+        return 2
+    base, new = load(argv[1]), load(argv[2])
+
+    print("%-60s %14s %14s %8s" % ("benchmark", "base", "new", "ratio"))
+    for name, b in base.items():
+        n = new.get(name)
+        if n is None:
+            continue
+        rows = [("", b["real_time"], n["real_time"], b["time_unit"])]
+        for key in sorted(b.keys() - FIELDS):
+            if key in n and isinstance(b[key], (int, float)):
+                rows.append((key, b[key], n[key], ""))
+        for key, old, cur, unit in rows:
+            ratio = cur / old if old else float("nan")
+            label = name if not key else "  " + key
+            print("%-60s %14.4g %14.4g %7.3fx %s" % (label, old, cur, ratio, unit))
+
+    missing = sorted(base.keys() ^ new.keys())
+    if missing:
+        print("\nonly in one of the files: " + ", ".join(missing))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,289 @@
+#include "corpus.h"
+
+#include <random>
+#include <vector>
+
+namespace
+{
+    class Generator
+    {
+        // mt19937 produces the same sequence on every platform,
+        // the standard distributions do not, so they are not used here.
+        std::mt19937 rng;
+        std::string out;
+        std::vector<size_t> arities;
+
+        uint32_t pick(uint32_t n) { return rng() % n; }
+
+        void number()
+        {
+            out += std::to_string(pick(1000));
+            if (pick(2))
+            {
+                out += '.';
+                out += std::to_string(pick(100));
+            }
+        }
+
+        void leaf(size_t numArgs)
+        {
+            if (numArgs > 0 && pick(3))
+                out += "a" + std::to_string(pick(numArgs));
+            else
+                number();
+        }
+
+        void call(size_t numArgs, int depth)
+        {
+            size_t callee = pick(arities.size());
+            out += "f" + std::to_string(callee) + "(";
+            for (size_t i = 0; i < arities[callee]; i++)
+            {
+                if (i > 0)
+                    out += ", ";
+                expr(numArgs, depth - 1);
+            }
+            out += ")";
+        }
+
+        void expr(size_t numArgs, int depth)
+        {
+            if (depth <= 0)
+                return leaf(numArgs);
+
+            static const char *ops[] = {" + ", " - ", " * ", " < "};
+            switch (pick(8))
+            {
+            case 0:
+                return leaf(numArgs);
+            case 1:
+                out += "if ";
+                expr(numArgs, depth - 1);
+                out += " then ";
+                expr(numArgs, depth - 1);
+                out += " else ";
+                expr(numArgs, depth - 1);
+                return;
+            case 2:
+                if (!arities.empty())
+                    return call(numArgs, depth);
+                return leaf(numArgs);
+            case 3:
+                out += "(";
+                expr(numArgs, depth - 1);
+                out += ops[pick(4)];
+                expr(numArgs, depth - 1);
+                out += ")";
+                return;
+            default:
+                expr(numArgs, depth - 1);
+                out += ops[pick(4)];
+                expr(numArgs, depth - 1);
+                return;
+            }
+        }
+
+        void definition()
+        {
+            size_t numArgs = pick(4);
+            out += "def f" + std::to_string(arities.size()) + "(";
+            for (size_t i = 0; i < numArgs; i++)
+            {
+                if (i > 0)
+                    out += ", ";
+                out += "a" + std::to_string(i);
+            }
+            out += ")\n    ";
+            expr(numArgs, 4);
+            out += "\n";
+            arities.push_back(numArgs);
+        }
+
+    public:
+        Generator(uint32_t seed) : rng(seed) {}
+
+        std::string mixed(size_t count)
+        {
+            out += "extern sin(x);\nextern cos(x);\n";
+            for (size_t i = 0; i < count; i++)
+            {
+                switch (pick(10))
+                {
+                case 0:
+                    out += "# f" + std::to_string(arities.size()) + " is generated\n";
+                    definition();
+                    break;
+                case 1:
+                    if (!arities.empty())
+                    {
+                        call(0, 2);
+                        out += ";\n";
+                        break;
+                    }
+                    definition();
+                    break;
+                default:
+                    definition();
+                    break;
+                }
+            }
+            return std::move(out);
+        }
+
+        std::string callHeavy(size_t count)
+        {
+            // The helpers are shallow and call each other at most once.
+            for (size_t i = 0; i < count; i++)
+            {
+                size_t numArgs = 1 + pick(2);
+                out += "def f" + std::to_string(i) + "(";
+                for (size_t a = 0; a < numArgs; a++)
+                {
+                    if (a > 0)
+                        out += ", ";
+                    out += "a" + std::to_string(a);
+                }
+                out += ")\n    ";
+                expr(numArgs, 2);
+                out += "\n";
+                arities.push_back(numArgs);
+            }
+
+            out += "def run(n)\n    if n < 1 then 0 else ";
+            for (size_t i = 0; i < 8 && !arities.empty(); i++)
+            {
+                size_t callee = pick(arities.size());
+                out += "f" + std::to_string(callee) + "(n";
+                for (size_t a = 1; a < arities[callee]; a++)
+                    out += ", " + std::to_string(pick(10));
+                out += ") + ";
+            }
+            out += "run(n - 1)\n";
+            out += "run(100);\n";
+            return std::move(out);
+        }
+
+        std::string smallFunctions(size_t count)
+        {
+            static const char *ops[] = {" + ", " - ", " * ", " < "};
+            for (size_t i = 0; i < count; i++)
+            {
+                if (pick(2))
+                {
+                    out += "def f" + std::to_string(i) + "(a0) a0" + ops[pick(4)];
+                    number();
+                }
+                else
+                {
+                    out += "def f" + std::to_string(i) + "(a0, a1) a0" + ops[pick(4)] + "a1";
+                }
+                out += "\n";
+            }
+            return std::move(out);
+        }
+
+        std::string deepExpressions(size_t count)
+        {
+            static const char *ops[] = {" + ", " - ", " * ", " < "};
+            for (size_t i = 0; i < count; i++)
+            {
+                // A chain nested on the right, so the depth grows linearly
+                // with the size of the source.
+                size_t depth = 200 + pick(200);
+                out += "def f" + std::to_string(i) + "(a0, a1, a2)\n    ";
+                for (size_t d = 0; d < depth; d++)
+                {
+                    if (pick(8) == 0)
+                    {
+                        out += "if ";
+                        leaf(3);
+                        out += " then ";
+                        leaf(3);
+                        out += " else (";
+                    }
+                    else
+                    {
+                        leaf(3);
+                        out += ops[pick(4)];
+                        out += "(";
+                    }
+                }
+                leaf(3);
+                out += std::string(depth, ')');
+                out += "\n";
+            }
+            return std::move(out);
+        }
+
+        std::string recursive(size_t count)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                std::string name = "r" + std::to_string(i);
+                out += "def " + name + "(n)\n    if n < " + std::to_string(2 + pick(2)) +
+                       " then n else " + name + "(n - 1) + " + name + "(n - 2)";
+                if (pick(2))
+                {
+                    out += " * ";
+                    number();
+                }
+                out += "\n";
+                out += name + "(" + std::to_string(18 + pick(4)) + ");\n";
+            }
+            return std::move(out);
+        }
+
+        std::string topLevel(size_t count)
+        {
+            for (size_t i = 0; i < 8; i++)
+                definition();
+            for (size_t i = 0; i < count; i++)
+            {
+                call(0, 3);
+                out += ";\n";
+            }
+            return std::move(out);
+        }
+    };
+}
+
+std::string GenerateCorpus(CorpusShape shape, size_t count, uint32_t seed)
+{
+    Generator gen(seed);
+    switch (shape)
+    {
+    case CorpusShape::Mixed:
+        return gen.mixed(count);
+    case CorpusShape::CallHeavy:
+        return gen.callHeavy(count);
+    case CorpusShape::SmallFunctions:
+        return gen.smallFunctions(count);
+    case CorpusShape::DeepExpressions:
+        return gen.deepExpressions(count);
+    case CorpusShape::Recursive:
+        return gen.recursive(count);
+    case CorpusShape::TopLevel:
+        return gen.topLevel(count);
+    }
+    return std::string();
+}
+
+const char *CorpusShapeName(CorpusShape shape)
+{
+    switch (shape)
+    {
+    case CorpusShape::Mixed:
+        return "mixed";
+    case CorpusShape::CallHeavy:
+        return "call_heavy";
+    case CorpusShape::SmallFunctions:
+        return "small_functions";
+    case CorpusShape::DeepExpressions:
+        return "deep_expressions";
+    case CorpusShape::Recursive:
+        return "recursive";
+    case CorpusShape::TopLevel:
+        return "top_level";
+    }
+    return "";
+}
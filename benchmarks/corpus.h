@@ -0,0 +1,51 @@
+#ifndef __CORPUS_H__
+#define __CORPUS_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// CorpusShape selects what kind of Kaleidoscope program GenerateCorpus writes.
+enum class CorpusShape
+{
+    // Definitions, externs, comments and top-level calls mixed together,
+    // roughly what a generated model file looks like.
+    Mixed,
+
+    // Small helpers called from a recursive function, run(n), which is
+    // only fast when the helpers are inlined into it.
+    CallHeavy,
+
+    // Many one-line functions of one or two arguments, without calls.
+    SmallFunctions,
+
+    // Few functions, each a single expression nested hundreds deep.
+    DeepExpressions,
+
+    // Doubly recursive functions, like fib, called from top-level
+    // expressions that run for a while.
+    Recursive,
+
+    // A few helpers, then mostly top-level expressions calling them.
+    TopLevel,
+};
+
+// All shapes, to run a benchmark on every one of them.
+constexpr CorpusShape AllCorpusShapes[] = {
+    CorpusShape::Mixed,
+    CorpusShape::CallHeavy,
+    CorpusShape::SmallFunctions,
+    CorpusShape::DeepExpressions,
+    CorpusShape::Recursive,
+    CorpusShape::TopLevel,
+};
+
+// CorpusShapeName names a shape, e.g. for benchmark labels.
+const char *CorpusShapeName(CorpusShape shape);
+
+// GenerateCorpus writes a syntactically valid Kaleidoscope program with
+// `count` top-level items. The output only depends on the arguments,
+// so benchmark results can be compared between commits.
+std::string GenerateCorpus(CorpusShape shape, size_t count, uint32_t seed = 42);
+
+#endif
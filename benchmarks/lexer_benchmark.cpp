@@ -0,0 +1,66 @@
+#include <benchmark/benchmark.h>
+
+#include <iterator>
+#include <memory>
+#include <string>
+
+#include "lexer/input.h"
+#include "lexer/lexer.h"
+#include "lexer/token.h"
+
+#include "corpus.h"
+
+// CharInput only implements GetChar, so the lexer is fed one character per
+// virtual call, the way it was before inputs handed out chunks.
+class CharInput : public IInput
+{
+    std::string_view buffer;
+    size_t pos = 0;
+
+public:
+    CharInput(std::string_view buffer) : buffer(buffer) {}
+
+    int GetChar() override
+    {
+        if (pos >= buffer.size())
+            return EOF;
+        return static_cast<unsigned char>(buffer[pos++]);
+    }
+};
+
+template <typename Input>
+static void BM_Lex(benchmark::State &state)
+{
+    std::string source = GenerateCorpus(CorpusShape::Mixed, state.range(0));
+    size_t tokens = 0;
+    for (auto _ : state)
+    {
+        Lexer lexer(std::make_unique<Input>(source));
+        while (lexer.GetNextToken() != tok_eof)
+            tokens++;
+    }
+    state.SetBytesProcessed(state.iterations() * source.size());
+    state.counters["tokens"] = benchmark::Counter(tokens, benchmark::Counter::kIsRate);
+}
+
+BENCHMARK_TEMPLATE(BM_Lex, MemoryInput)->Arg(1000)->Arg(100000);
+BENCHMARK_TEMPLATE(BM_Lex, CharInput)->Arg(1000)->Arg(100000);
+
+// Lex a corpus of every shape, which differ in their mix of tokens.
+static void BM_LexShape(benchmark::State &state)
+{
+    CorpusShape shape = AllCorpusShapes[state.range(0)];
+    std::string source = GenerateCorpus(shape, 1000);
+    size_t tokens = 0;
+    for (auto _ : state)
+    {
+        Lexer lexer(std::make_unique<MemoryInput>(source));
+        while (lexer.GetNextToken() != tok_eof)
+            tokens++;
+    }
+    state.SetLabel(CorpusShapeName(shape));
+    state.SetBytesProcessed(state.iterations() * source.size());
+    state.counters["tokens"] = benchmark::Counter(tokens, benchmark::Counter::kIsRate);
+}
+
+BENCHMARK(BM_LexShape)->DenseRange(0, std::size(AllCorpusShapes) - 1);
@@ -0,0 +1,190 @@
+#include <benchmark/benchmark.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+
+#include "ast/BinaryExprAST.h"
+#include "ast/CallExprAST.h"
+#include "ast/FunctionAST.h"
+#include "ast/IfExprAST.h"
+#include "ast/ProgramAST.h"
+#include "ast/PrototypeAST.h"
+#include "lexer/input.h"
+#include "lexer/lexer.h"
+#include "parser/parser.h"
+#include "utils/diagnostics.h"
+#include "utils/thread_pool.h"
+#include "visitor/visitor.h"
+
+#include "corpus.h"
+
+// Only errors are reported, so that prompts and results are not measured.
+[[maybe_unused]] static const bool quiet =
+    (Diagnostics::SetEnabled(DiagBit(DiagCategory::Error)), true);
+
+// Count every heap allocation made by the process.
+static size_t numAllocs = 0;
+static size_t allocBytes = 0;
+
+void *operator new(size_t size)
+{
+    numAllocs++;
+    allocBytes += size;
+    if (void *p = malloc(size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+// Parse the corpus either as it is lexed, or from a token buffer lexed up
+// front. The pre-lexed variant includes the time spent lexing.
+template <bool PreLexed>
+static void BM_ParseProgram(benchmark::State &state)
+{
+    std::string source = GenerateCorpus(CorpusShape::Mixed, state.range(0));
+    size_t items = 0;
+    size_t allocs = 0;
+    size_t bytes = 0;
+    for (auto _ : state)
+    {
+        size_t allocsBefore = numAllocs;
+        size_t bytesBefore = allocBytes;
+
+        auto lexer = std::make_unique<Lexer>(std::make_unique<MemoryInput>(source));
+        std::unique_ptr<Parser> parser;
+        if (PreLexed)
+            parser = std::make_unique<Parser>(std::make_shared<TokenBuffer>(lexer->Tokenize()));
+        else
+            parser = std::make_unique<Parser>(std::move(lexer));
+        auto r = parser->ParseProgram();
+        auto program = r.value();
+        items += program->Nodes.size();
+        // Include freeing the AST.
+        program.reset();
+
+        allocs += numAllocs - allocsBefore;
+        bytes += allocBytes - bytesBefore;
+    }
+
+    state.SetBytesProcessed(state.iterations() * source.size());
+    state.counters["items"] = benchmark::Counter(items, benchmark::Counter::kIsRate);
+    state.counters["allocs/item"] = double(allocs) / items;
+    state.counters["alloc_bytes/item"] = double(bytes) / items;
+}
+
+BENCHMARK_TEMPLATE(BM_ParseProgram, false)->Arg(1000)->Arg(100000)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_ParseProgram, true)->Arg(1000)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+// Parse a pre-lexed corpus with ParseProgramParallel on 1..N threads.
+static void BM_ParseProgramParallel(benchmark::State &state)
+{
+    std::string source = GenerateCorpus(CorpusShape::Mixed, state.range(0));
+    auto tokens = std::make_shared<TokenBuffer>(
+        Lexer(std::make_unique<MemoryInput>(source)).Tokenize());
+    ThreadPool pool(state.range(1));
+    size_t items = 0;
+    for (auto _ : state)
+    {
+        Parser parser(tokens);
+        auto program = parser.ParseProgramParallel(pool).value();
+        items += program->Nodes.size();
+    }
+
+    state.SetBytesProcessed(state.iterations() * source.size());
+    state.counters["items"] = benchmark::Counter(items, benchmark::Counter::kIsRate);
+    state.counters["threads"] = state.range(1);
+}
+
+BENCHMARK(BM_ParseProgramParallel)
+    ->ArgsProduct({{100000}, benchmark::CreateRange(1, std::thread::hardware_concurrency(), 2)})
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+namespace
+{
+    // NodeCounter counts the AST nodes of a program.
+    class NodeCounter : public Visitor
+    {
+    public:
+        size_t Nodes = 0;
+
+        std::optional<Error> visit(NumberExprAST *) override
+        {
+            Nodes++;
+            return std::nullopt;
+        }
+        std::optional<Error> visit(VariableExprAST *) override
+        {
+            Nodes++;
+            return std::nullopt;
+        }
+        std::optional<Error> visit(IfExprAST *ast) override
+        {
+            Nodes++;
+            ast->Cond->accept(this);
+            ast->Then->accept(this);
+            return ast->Else->accept(this);
+        }
+        std::optional<Error> visit(CallExprAST *ast) override
+        {
+            Nodes++;
+            for (ExprAST *arg : ast->Args)
+                arg->accept(this);
+            return std::nullopt;
+        }
+        std::optional<Error> visit(BinaryExprAST *ast) override
+        {
+            Nodes++;
+            ast->LHS->accept(this);
+            return ast->RHS->accept(this);
+        }
+        std::optional<Error> visit(PrototypeAST *) override
+        {
+            Nodes++;
+            return std::nullopt;
+        }
+        std::optional<Error> visit(FunctionAST *ast) override
+        {
+            Nodes++;
+            ast->Proto->accept(this);
+            return ast->Body->accept(this);
+        }
+        std::optional<Error> visit(ProgramAST *ast) override
+        {
+            for (AST *node : ast->Nodes)
+                node->accept(this);
+            return std::nullopt;
+        }
+    };
+}
+
+// Parse a pre-lexed corpus of every shape, counting the AST nodes built.
+static void BM_ParseShape(benchmark::State &state)
+{
+    CorpusShape shape = AllCorpusShapes[state.range(0)];
+    std::string source = GenerateCorpus(shape, 1000);
+    auto tokens = std::make_shared<TokenBuffer>(
+        Lexer(std::make_unique<MemoryInput>(source)).Tokenize());
+
+    NodeCounter counter;
+    Parser(tokens).ParseProgram().value()->accept(&counter);
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(Parser(tokens).ParseProgram().value());
+
+    state.SetLabel(CorpusShapeName(shape));
+    state.SetBytesProcessed(state.iterations() * source.size());
+    state.counters["nodes"] = benchmark::Counter(
+        state.iterations() * counter.Nodes, benchmark::Counter::kIsRate);
+}
+
+BENCHMARK(BM_ParseShape)
+    ->DenseRange(0, std::size(AllCorpusShapes) - 1)
+    ->Unit(benchmark::kMillisecond);
@@ -0,0 +1,96 @@
+#include <benchmark/benchmark.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "corpus.h"
+
+extern char **environ;
+
+// The driver binary, $KALEIDOSCOPE_BIN or the one in the runfiles of
+// `bazel run //benchmarks:startup_benchmark`.
+static std::string driverPath()
+{
+    const char *path = getenv("KALEIDOSCOPE_BIN");
+    return path ? path : "src/kaleidoscope";
+}
+
+// A small program, so that the time is spent starting up.
+static const std::string &inputPath()
+{
+    static const std::string path = []()
+    {
+        auto path = std::filesystem::temp_directory_path() /
+                    ("kaleido_startup_" + std::to_string(getpid()) + ".k");
+        std::ofstream(path) << GenerateCorpus(CorpusShape::Mixed, 20);
+        return path.string();
+    }();
+    return path;
+}
+
+// The modes the driver is launched in, from the cheapest.
+static const std::vector<std::vector<std::string>> modes = {
+    {"--parse-only"},
+    {"--check"},
+    {"--interp"},
+    {},
+    {"--lazy"},
+};
+
+// Launch the driver on a small file until it exits, in each mode, to catch
+// regressions in the work done before the first result.
+static void BM_Launch(benchmark::State &state)
+{
+    std::vector<std::string> args = {driverPath()};
+    for (const std::string &flag : modes[state.range(0)])
+        args.push_back(flag);
+    args.push_back(inputPath());
+
+    std::vector<char *> argv;
+    for (std::string &arg : args)
+        argv.push_back(arg.data());
+    argv.push_back(nullptr);
+
+    // The driver writes everything to stderr.
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+    for (auto _ : state)
+    {
+        pid_t pid;
+        int status;
+        if (posix_spawn(&pid, argv[0], &actions, nullptr, argv.data(), environ) != 0 ||
+            waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            state.SkipWithError(("cannot run " + args[0]).c_str());
+            break;
+        }
+    }
+
+    posix_spawn_file_actions_destroy(&actions);
+    state.SetLabel(args.size() > 2 ? args[1] : "jit");
+}
+
+BENCHMARK(BM_Launch)->DenseRange(0, 4)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+int main(int argc, char **argv)
+{
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    std::filesystem::remove(inputPath());
+    return 0;
+}
@@ -0,0 +1,199 @@
+#include "aot_compiler.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <spawn.h>
+#include <sys/wait.h>
+
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+#if LLVM_VERSION_MAJOR >= 17
+#include "llvm/TargetParser/Host.h"
+#else
+#include "llvm/Support/Host.h"
+#endif
+
+#include "ast/FunctionAST.h"
+#include "ast/ProgramAST.h"
+#include "ast/PrototypeAST.h"
+#include "codegen/codegen.h"
+#include "utils/diagnostics.h"
+
+extern char **environ;
+
+// runTool runs a program with args, without a shell, and waits for it.
+static std::optional<Error> runTool(const std::vector<std::string> &args)
+{
+    std::vector<char *> argv;
+    for (const std::string &arg : args)
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    argv.push_back(nullptr);
+
+    pid_t pid;
+    if (int err = posix_spawnp(&pid, argv[0], nullptr, nullptr, argv.data(), environ))
+        return Error("cannot run " + args[0] + ": " + strerror(err));
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return Error(args[0] + " failed");
+    return std::nullopt;
+}
+
+// addMain defines a C main function that calls the functions of the
+// top-level expressions in order and prints their values, like the JIT.
+static std::optional<Error> addMain(llvm::Module &module, const std::vector<std::string> &exprs)
+{
+    if (module.getFunction("main"))
+        return Error("an executable cannot define main");
+    if (module.getFunction("printf"))
+        return Error("an executable cannot declare printf");
+
+    llvm::LLVMContext &ctx = module.getContext();
+    llvm::IRBuilder<> builder(ctx);
+    llvm::Type *i32 = builder.getInt32Ty();
+    auto *mainFn = llvm::Function::Create(llvm::FunctionType::get(i32, false),
+                                          llvm::Function::ExternalLinkage, "main", module);
+    builder.SetInsertPoint(llvm::BasicBlock::Create(ctx, "entry", mainFn));
+
+    llvm::Value *format = builder.CreateGlobalStringPtr("*** Evaluated to %f\n");
+    llvm::FunctionCallee printfFn = module.getOrInsertFunction(
+        "printf", llvm::FunctionType::get(i32, {format->getType()}, true));
+    for (const std::string &name : exprs)
+    {
+        // Only main calls them, so they can be inlined into it.
+        llvm::Function *expr = module.getFunction(name);
+        expr->setLinkage(llvm::Function::InternalLinkage);
+        builder.CreateCall(printfFn, {format, builder.CreateCall(expr)});
+    }
+    builder.CreateRet(builder.getInt32(0));
+    return std::nullopt;
+}
+
+// emitObject writes module as an object file for the host to fd.
+static std::optional<Error> emitObject(llvm::Module &module, int fd)
+{
+    std::string triple = llvm::sys::getProcessTriple();
+    std::string message;
+    const llvm::Target *target = llvm::TargetRegistry::lookupTarget(triple, message);
+    if (!target)
+        return Error(message);
+
+    // The generic CPU, so that the code runs on any machine of the host's
+    // architecture. Executables are position independent on most systems.
+    std::unique_ptr<llvm::TargetMachine> tm(target->createTargetMachine(
+        triple, "generic", "", llvm::TargetOptions(), llvm::Reloc::PIC_));
+    module.setTargetTriple(triple);
+    module.setDataLayout(tm->createDataLayout());
+    std::string broken;
+    llvm::raw_string_ostream os(broken);
+    if (llvm::verifyModule(module, &os))
+        return Error("generated IR broken: " + os.str());
+
+    llvm::raw_fd_ostream out(fd, /*shouldClose*/ true);
+    llvm::legacy::PassManager pm;
+#if LLVM_VERSION_MAJOR >= 18
+    auto fileType = llvm::CodeGenFileType::ObjectFile;
+#else
+    auto fileType = llvm::CGFT_ObjectFile;
+#endif
+    if (tm->addPassesToEmitFile(pm, out, nullptr, fileType))
+        return Error("the target cannot emit object files");
+    pm.run(module);
+    out.flush();
+    if (out.has_error())
+        return Error("cannot write the object file: " + out.error().message());
+    return std::nullopt;
+}
+
+std::optional<Error> AOTCompiler::Compile(ProgramAST *program, const AOTOptions &opts)
+{
+    bool executable = opts.Kind == OutputKind::Executable;
+
+    // All functions go to one module, optimized as a whole by TakeModule.
+    CodeGen cg(jm);
+    cg.Batch = true;
+    cg.DebugLines = opts.DebugLines;
+
+    size_t numErrors = 0;
+    std::vector<std::string> exprs;
+    for (AST *node : program->Nodes)
+    {
+        auto fn = dynamic_cast<FunctionAST *>(node);
+        std::string exprName;
+        if (fn && fn->Proto->isMain())
+        {
+            // Only executables run the top-level expressions, each as a
+            // function of its own called from main.
+            if (!executable)
+                continue;
+            exprName = "__kaleido_expr" + std::to_string(exprs.size());
+            auto proto = program->NodeArena->make<PrototypeAST>(
+                Symbol::Intern(exprName), ArenaArray<Symbol>());
+            proto->Offset = fn->Proto->Offset;
+            auto expr = program->NodeArena->make<FunctionAST>(proto, fn->Body);
+            expr->Offset = fn->Offset;
+            node = expr;
+        }
+
+        if (auto err = node->accept(&cg))
+        {
+            Diagnostics::Printf(DiagCategory::Error, "error: %s\n", err->message.c_str());
+            numErrors++;
+        }
+        else if (!exprName.empty())
+        {
+            exprs.push_back(exprName);
+        }
+    }
+    if (numErrors > 0)
+        return Error(std::to_string(numErrors) + " items failed to compile");
+
+    if (executable)
+    {
+        if (auto err = addMain(*cg.Module, exprs))
+            return err;
+    }
+    llvm::orc::ThreadSafeModule tsm = cg.TakeModule();
+
+    // Executables and libraries are made from a temporary object file.
+    std::string objPath = opts.OutputPath;
+    int fd;
+    std::error_code ec;
+    if (opts.Kind == OutputKind::Object)
+    {
+        ec = llvm::sys::fs::openFileForWrite(objPath, fd);
+    }
+    else
+    {
+        llvm::SmallString<128> tmp;
+        ec = llvm::sys::fs::createTemporaryFile("kaleido", "o", fd, tmp);
+        objPath = std::string(tmp.str());
+    }
+    if (ec)
+        return Error("cannot open " + objPath + ": " + ec.message());
+
+    auto err = tsm.withModuleDo([fd](llvm::Module &module)
+                                { return emitObject(module, fd); });
+    if (!err && opts.Kind == OutputKind::Executable)
+    {
+        err = runTool({opts.Linker, objPath, "-o", opts.OutputPath, "-lm"});
+    }
+    else if (!err && opts.Kind == OutputKind::StaticLibrary)
+    {
+        // ar adds to an existing archive rather than replacing it.
+        llvm::sys::fs::remove(opts.OutputPath);
+        err = runTool({opts.Archiver, "rcs", opts.OutputPath, objPath});
+    }
+    if (opts.Kind != OutputKind::Object)
+        llvm::sys::fs::remove(objPath);
+    return err;
+}
@@ -0,0 +1,58 @@
+#ifndef __AOT_COMPILER_H__
+#define __AOT_COMPILER_H__
+
+#include <memory>
+#include <optional>
+#include <string>
+
+#include "jit/jit_manager.h"
+#include "lexer/source_lines.h"
+#include "utils/error.h"
+
+class ProgramAST;
+
+enum class OutputKind
+{
+    // A native object file defining the functions of the program.
+    Object,
+    // An executable that runs the top-level expressions of the program
+    // and prints their values.
+    Executable,
+    // A static library holding the object file.
+    StaticLibrary,
+};
+
+struct AOTOptions
+{
+    OutputKind Kind = OutputKind::Object;
+    std::string OutputPath;
+
+    // DebugLines, if set, locates the program in its source, to give the
+    // functions line tables.
+    const SourceLines *DebugLines = nullptr;
+
+    // The tools that link executables and archive libraries.
+    std::string Linker = "cc";
+    std::string Archiver = "ar";
+};
+
+// AOTCompiler compiles a whole program ahead of time, for the host, into a
+// single optimized module written out as native code. The functions of the
+// program are exported with the C ABI, taking and returning doubles, so
+// they can be called from C as e.g. `double sq(double x);`.
+class AOTCompiler
+{
+public:
+    // The code is generated and optimized like for jm, which is otherwise
+    // unused.
+    explicit AOTCompiler(std::shared_ptr<JITManager> jm) : jm(std::move(jm)) {}
+
+    // Compile reports errors of individual items on stderr and keeps going,
+    // but writes nothing if any item failed.
+    std::optional<Error> Compile(ProgramAST *program, const AOTOptions &opts);
+
+private:
+    std::shared_ptr<JITManager> jm;
+};
+
+#endif
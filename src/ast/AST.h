@@ -1,13 +1,23 @@
 #ifndef __AST_H__
 #define __AST_H__
 
+#include <cstdint>
+
 #include "visitor/visitor.h"
 
+// AST nodes are allocated from an Arena (see utils/arena.h), which never
+// runs their destructors. Nodes must not own memory outside of the arena:
+// children are plain pointers and lists are ArenaArrays.
 class AST
 {
 public:
     virtual ~AST() = default;
     virtual std::optional<Error> accept(Visitor *visitor) = 0;
+
+    // Offset is where the node is in the source, see SourceLines: the offset
+    // of the operator of a binary expression, of the name of a call or a
+    // prototype, and otherwise of the node's first token.
+    uint32_t Offset = 0;
 };
 
 #endif
\ No newline at end of file
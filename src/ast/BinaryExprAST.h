@@ -1,15 +1,14 @@
 #ifndef __BINARY_EXPR_AST_H__
 #define __BINARY_EXPR_AST_H__
 
-#include <memory>
 #include "ExprAST.h"
 
 /// BinaryExprAST - Expression class for a binary operator.
 class BinaryExprAST : public ExprAST
 {
 public:
-    BinaryExprAST(char op, std::unique_ptr<ExprAST> lhs, std::unique_ptr<ExprAST> rhs)
-        : Op(op), LHS(std::move(lhs)), RHS(std::move(rhs)) {}
+    BinaryExprAST(char op, ExprAST *lhs, ExprAST *rhs)
+        : Op(op), LHS(lhs), RHS(rhs) {}
 
     std::optional<Error> accept(Visitor *visitor) override
     {
@@ -17,7 +16,7 @@ public:
     }
 
     char Op;
-    std::unique_ptr<ExprAST> LHS, RHS;
+    ExprAST *LHS, *RHS;
 };
 
 #endif
\ No newline at end of file
@@ -1,25 +1,24 @@
 #ifndef __CALL_EXPR_AST_H__
 #define __CALL_EXPR_AST_H__
 
-#include <string>
-#include <memory>
-#include <utility>
 #include "ExprAST.h"
+#include "utils/arena.h"
+#include "utils/symbol.h"
 
 /// CallExprAST - Expression class for function calls.
 class CallExprAST : public ExprAST
 {
 public:
-    CallExprAST(const std::string &callee, std::vector<std::unique_ptr<ExprAST>> args)
-        : Callee(callee), Args(std::move(args)) {}
+    CallExprAST(Symbol callee, ArenaArray<ExprAST *> args)
+        : Callee(callee), Args(args) {}
 
     std::optional<Error> accept(Visitor *visitor) override
     {
         return visitor->visit(this);
     }
 
-    std::string Callee;
-    std::vector<std::unique_ptr<ExprAST>> Args;
+    Symbol Callee;
+    ArenaArray<ExprAST *> Args;
 };
 
 #endif
\ No newline at end of file
@@ -8,16 +8,16 @@
 class FunctionAST : public AST
 {
 public:
-    FunctionAST(std::unique_ptr<PrototypeAST> proto, std::unique_ptr<ExprAST> body)
-        : Proto(std::move(proto)), Body(std::move(body)) {}
+    FunctionAST(PrototypeAST *proto, ExprAST *body)
+        : Proto(proto), Body(body) {}
 
     std::optional<Error> accept(Visitor *visitor) override
     {
         return visitor->visit(this);
     }
 
-    std::unique_ptr<PrototypeAST> Proto;
-    std::unique_ptr<ExprAST> Body;
+    PrototypeAST *Proto;
+    ExprAST *Body;
 };
 
 #endif
\ No newline at end of file
@@ -1,20 +1,28 @@
 #ifndef __PROGRAM_AST_H__
 #define __PROGRAM_AST_H__
 
+#include <memory>
+#include <vector>
+
 #include "AST.h"
+#include "utils/arena.h"
 
 class ProgramAST : public AST
 {
 public:
-    ProgramAST(std::vector<std::unique_ptr<AST>> nodes)
-        : Nodes(std::move(nodes)) {}
+    ProgramAST(std::vector<AST *> nodes, std::unique_ptr<Arena> arena)
+        : Nodes(std::move(nodes)), NodeArena(std::move(arena)) {}
 
     std::optional<Error> accept(Visitor *visitor) override
     {
         return visitor->visit(this);
     }
 
-    std::vector<std::unique_ptr<AST>> Nodes;
+    std::vector<AST *> Nodes;
+
+    // NodeArena owns all nodes of the program, which are released together
+    // with the ProgramAST without visiting them.
+    std::unique_ptr<Arena> NodeArena;
 };
 
 #endif
\ No newline at end of file
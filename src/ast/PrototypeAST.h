@@ -1,26 +1,34 @@
 #ifndef __PROTOTYPE_AST_H__
 #define __PROTOTYPE_AST_H__
 
-#include <string>
-#include <vector>
-
 #include "AST.h"
+#include "utils/arena.h"
+#include "utils/symbol.h"
+
+// MainSymbol is the name of the anonymous function that wraps a top-level expression.
+inline Symbol MainSymbol()
+{
+  static const Symbol sym = Symbol::Intern("__main__");
+  return sym;
+}
 
 class PrototypeAST : public AST
 {
 public:
-  PrototypeAST(const std::string &name, std::vector<std::string> args)
-      : Name(name), Args(std::move(args)) {}
+  PrototypeAST(Symbol name, ArenaArray<Symbol> args)
+      : Name(name), Args(args) {}
+
+  Symbol getName() const { return Name; }
 
-  const std::string &getName() const { return Name; }
+  bool isMain() const { return Name == MainSymbol(); }
 
   std::optional<Error> accept(Visitor *visitor) override
   {
     return visitor->visit(this);
   }
 
-  std::string Name;
-  std::vector<std::string> Args;
+  Symbol Name;
+  ArenaArray<Symbol> Args;
 };
 
 #endif
\ No newline at end of file
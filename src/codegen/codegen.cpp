@@ -1,5 +1,3 @@
-#include <iostream>
-
 #include "codegen.h"
 
 #include "ast/BinaryExprAST.h"
@@ -15,28 +13,110 @@
 #include "llvm/IR/Type.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/Support/FileSystem.h"
+
+#include "utils/diagnostics.h"
+#include "utils/phase_timer.h"
+#include "utils/startup_profile.h"
 
 CodeGen::CodeGen()
+    : CodeGen(std::make_shared<JITManager>())
+{
+}
+
+CodeGen::CodeGen(std::shared_ptr<JITManager> jm, const ProtoTable *protos)
+    : jm(std::move(jm)), sharedProtos(protos)
 {
-    // We only use a single JIT to manage multiple modules.
-    jm = std::make_unique<JITManager>();
     init();
 }
 
+CodeGen::~CodeGen()
+{
+    // The module and builder refer to the context, so it has to go last.
+    Builder.reset();
+    DIB.reset();
+    Module.reset();
+    Context.reset();
+}
+
+llvm::orc::ThreadSafeModule CodeGen::TakeModule(bool optimized)
+{
+    finishDebugInfo();
+
+    // In lazy and tiered mode the JIT optimizes functions itself.
+    if (optimized && !jm->OptimizesInJIT())
+        optimize();
+    else
+        Module->setDataLayout(jm->DataLayout());
+    llvm::orc::ThreadSafeModule tsm(std::move(Module), std::move(Context));
+    init();
+    return tsm;
+}
+
 void CodeGen::init()
 {
+    // The debug info of the next module is created with its first function.
+    DIB.reset();
+    debugUnit = nullptr;
+    debugFn = nullptr;
+
     // Open a new context and module.
     Context = std::make_unique<llvm::LLVMContext>();
     Module = std::make_unique<llvm::Module>("kaleidoscope", *Context);
-    // When a module is created, set JIT's data layout to it
-    // so that the generated code in this module is consistent with JIT.
-    Module->setDataLayout(jm->JIT->getDataLayout());
+
+    // The functions declared in the previous module are gone.
+    moduleFns.clear();
 
     // Create a new builder for the module.
     Builder = std::make_unique<llvm::IRBuilder<>>(*Context);
+}
 
-    // Create a new optimizer
-    optimizer = std::make_unique<Optimizer>(*Context);
+void CodeGen::optimize()
+{
+    // The data layout is only needed to optimize and compile, so that
+    // checking code does not initialize the target.
+    Module->setDataLayout(jm->DataLayout());
+    if (!optimizer)
+        optimizer = jm->NewOptimizer();
+    optimizer->optimizeModule(*Module);
+}
+
+void CodeGen::beginDebugInfo(FunctionAST *ast, llvm::Function *fn)
+{
+    if (!DIB)
+    {
+        DIB = std::make_unique<llvm::DIBuilder>(*Module);
+        llvm::SmallString<128> dir;
+        llvm::sys::fs::current_path(dir);
+        bool optimized = jm->OptOptions.Level != OptLevel::O0;
+        debugUnit = DIB->createCompileUnit(
+            llvm::dwarf::DW_LANG_C, DIB->createFile(DebugLines->Path(), dir),
+            "kaleidoscope", optimized, "", 0, "", llvm::DICompileUnit::LineTablesOnly);
+        Module->addModuleFlag(llvm::Module::Warning, "Debug Info Version",
+                              llvm::DEBUG_METADATA_VERSION);
+    }
+
+    unsigned line = DebugLines->Locate(ast->Proto->Offset).Line;
+    debugFn = DIB->createFunction(
+        debugUnit->getFile(), fn->getName(), llvm::StringRef(), debugUnit->getFile(), line,
+        DIB->createSubroutineType(DIB->getOrCreateTypeArray({})), line,
+        llvm::DINode::FlagPrototyped, llvm::DISubprogram::SPFlagDefinition);
+    fn->setSubprogram(debugFn);
+    setLocation(ast->Proto);
+}
+
+void CodeGen::setLocation(const AST *ast)
+{
+    if (!debugFn)
+        return;
+    SourceLocation loc = DebugLines->Locate(ast->Offset);
+    Builder->SetCurrentDebugLocation(llvm::DILocation::get(*Context, loc.Line, loc.Column, debugFn));
+}
+
+void CodeGen::finishDebugInfo()
+{
+    if (DIB)
+        DIB->finalize();
 }
 
 std::optional<Error> CodeGen::visit(NumberExprAST *ast)
@@ -48,7 +128,7 @@ std::optional<Error> CodeGen::visit(NumberExprAST *ast)
 
 std::optional<Error> CodeGen::visit(VariableExprAST *ast)
 {
-    auto v = NamedValues[ast->Name];
+    auto v = NamedValues.get(ast->Name);
     if (!v)
     {
         return Error("unknown variable name");
@@ -85,6 +165,7 @@ std::optional<Error> CodeGen::visit(CallExprAST *ast)
         argsV.push_back(exprVal.release());
     }
 
+    setLocation(ast);
     llvm::Value *result = Builder->CreateCall(calleeFn, argsV, "calltmp");
     exprVal.reset(result);
     return std::nullopt;
@@ -96,6 +177,7 @@ std::optional<Error> CodeGen::visit(IfExprAST *ast)
         return err;
     llvm::Value *condVal = exprVal.release();
 
+    setLocation(ast);
     // Convert condition to a 1-bit bool by comparing non-equal to 0.0.
     condVal = Builder->CreateFCmpONE(
         condVal,
@@ -134,6 +216,7 @@ std::optional<Error> CodeGen::visit(IfExprAST *ast)
     // Emit merge block.
     fn->insert(fn->end(), mergeBB);
     Builder->SetInsertPoint(mergeBB);
+    setLocation(ast);
     llvm::PHINode *phiNode = Builder->CreatePHI(llvm::Type::getDoubleTy(*Context), 2, "iftmp");
     phiNode->addIncoming(thenV, thenBB);
     phiNode->addIncoming(elseV, elseBB);
@@ -151,6 +234,7 @@ std::optional<Error> CodeGen::visit(BinaryExprAST *ast)
         return err;
     llvm::Value *rval = exprVal.release();
 
+    setLocation(ast);
     llvm::Value *result = nullptr;
     switch (ast->Op)
     {
@@ -178,70 +262,97 @@ std::optional<Error> CodeGen::visit(BinaryExprAST *ast)
     return std::nullopt;
 }
 
-Result<llvm::Function *, Error> CodeGen::getFunction(std::string fnName)
+const CodeGen::FunctionProto *CodeGen::findProto(Symbol fnName) const
 {
-    if (auto *fn = Module->getFunction(fnName))
+    if (const auto &proto = fnProtos.get(fnName))
+        return proto.get();
+    if (sharedProtos)
+        return sharedProtos->get(fnName).get();
+    return nullptr;
+}
+
+Result<llvm::Function *, Error> CodeGen::getFunction(Symbol fnName)
+{
+    if (auto *fn = moduleFns.get(fnName))
     {
         return Result<llvm::Function *, Error>(fn);
     }
-    if (fnProtos.count(fnName) > 0)
+    if (const FunctionProto *proto = findProto(fnName))
     {
-        // Visit the function's PrototypeAST to add its declaration
-        // to the current module in its first encounter.
-        if (auto err = fnProtos[fnName]->accept(this))
-        {
-            return Result<llvm::Function *, Error>(err.value());
-        }
+        // Add the function's declaration to the current module
+        // in its first encounter.
+        return declareFunction(fnName, proto->Args);
     }
-    return Result<llvm::Function *, Error>(Module->getFunction(fnName));
+    return Result<llvm::Function *, Error>(nullptr);
 }
 
-std::optional<Error> CodeGen::visit(PrototypeAST *ast)
+Result<llvm::Function *, Error> CodeGen::declareFunction(Symbol fnName, llvm::ArrayRef<Symbol> args)
 {
     // First, check for an existing function from a previous 'extern' declaration.
-    llvm::Function *fn = Module->getFunction(ast->Name);
+    llvm::Function *fn = moduleFns.get(fnName);
+    const FunctionProto *proto = findProto(fnName);
     if (fn)
     {
         if (!fn->empty())
         {
-            return Error("redeclare a defined function");
+            return Result<llvm::Function *, Error>(Error("redeclare a defined function"));
         }
-        if (fn->arg_size() != ast->Args.size())
+        if (fn->arg_size() != args.size())
         {
-            return Error("# params mismatched");
+            return Result<llvm::Function *, Error>(Error("# params mismatched"));
         }
     }
-    else if (fnProtos.count(ast->Name) > 0)
+    else if (proto)
     {
         // This prototype has been defined in other module before,
         // check if the prototype is consistent with the previous definition.
-        // JIT will return an error if two duplicate definitions are added.
-        if (ast->Args.size() != fnProtos[ast->Name]->Args.size())
-            return Error("# params mismatched");
+        // JIT will return an error if two duplicate definitions are added,
+        // unless it lets functions be redefined, whose callers keep the
+        // arguments they were compiled with.
+        if (args.size() != proto->Args.size())
+            return Result<llvm::Function *, Error>(Error("# params mismatched"));
     }
 
     if (!fn)
     {
         // Make the function type: e.g double(double,double) etc.
-        std::vector<llvm::Type *> Doubles(ast->Args.size(), llvm::Type::getDoubleTy(*Context));
+        std::vector<llvm::Type *> Doubles(args.size(), llvm::Type::getDoubleTy(*Context));
         llvm::FunctionType *fnType =
             llvm::FunctionType::get(llvm::Type::getDoubleTy(*Context), Doubles, false);
 
         // The created function would be added into Module.
-        fn = llvm::Function::Create(fnType, llvm::Function::ExternalLinkage, ast->Name, *Module);
+        fn = llvm::Function::Create(fnType, llvm::Function::ExternalLinkage, fnName.str(), *Module);
+        moduleFns[fnName] = fn;
     }
 
     // Set names for all arguments.
     unsigned idx = 0;
     for (auto &arg : fn->args())
-        arg.setName(ast->Args[idx++]);
+        arg.setName(args[idx++].str());
 
-    fnProtos[ast->Name] = ast;
+    // args may be the stored prototype's own Args when declaring it
+    // in a new module, in which case there is nothing to update.
+    if (!proto || args.data() != proto->Args.data())
+    {
+        auto &own = fnProtos[fnName];
+        if (!own)
+            own = std::make_unique<FunctionProto>(FunctionProto{fnName, args.vec()});
+        else
+            own->Args.assign(args.begin(), args.end());
+    }
 
+    return Result<llvm::Function *, Error>(fn);
+}
+
+std::optional<Error> CodeGen::visit(PrototypeAST *ast)
+{
+    auto r = declareFunction(ast->Name, llvm::ArrayRef<Symbol>(ast->Args.data(), ast->Args.size()));
+    if (r.isError())
+        return r.error();
     return std::nullopt;
 }
 
-void CodeGen::deleteFn(llvm::Function *fn, bool isDeclared)
+void CodeGen::deleteFn(llvm::Function *fn, Symbol fnName, bool isDeclared)
 {
     if (isDeclared)
     {
@@ -249,13 +360,25 @@ void CodeGen::deleteFn(llvm::Function *fn, bool isDeclared)
     }
     else
     {
-        fnProtos.erase(fn->getName().str());
+        fnProtos[fnName].reset();
+        moduleFns[fnName] = nullptr;
         fn->removeFromParent();
     }
 }
 
 std::optional<Error> CodeGen::visit(FunctionAST *ast)
 {
+    ScopedPhase timer(Phase::CodeGen, ast->Proto->getName().str());
+
+    // A constant top-level expression, e.g. one folded by the AST passes,
+    // needs no code.
+    if (auto num = dynamic_cast<NumberExprAST *>(ast->Body); num && ast->Proto->isMain() && !CheckOnly)
+    {
+        Diagnostics::Printf(DiagCategory::Result, "*** Evaluated to %f\n", num->Val);
+        StartupProfile::Record(StartupProfile::FirstResult);
+        return std::nullopt;
+    }
+
     bool isDeclared = false;
     auto r = getFunction(ast->Proto->Name);
     if (r.isError())
@@ -276,17 +399,24 @@ std::optional<Error> CodeGen::visit(FunctionAST *ast)
     // Create a new basic block to start insertion into.
     llvm::BasicBlock *bb = llvm::BasicBlock::Create(*Context, "entry", fn);
     Builder->SetInsertPoint(bb);
-
-    // Record the function arguments in the NamedValues map.
-    NamedValues.clear();
+    Builder->SetCurrentDebugLocation(llvm::DebugLoc());
+    debugFn = nullptr;
+    if (DebugLines)
+        beginDebugInfo(ast, fn);
+
+    // Record the function arguments in the NamedValues table.
+    for (Symbol sym : scope)
+        NamedValues[sym] = nullptr;
+    scope.assign(ast->Proto->Args.begin(), ast->Proto->Args.end());
+    unsigned idx = 0;
     for (auto &arg : fn->args())
-        NamedValues[std::string(arg.getName())] = &arg;
+        NamedValues[scope[idx++]] = &arg;
 
     // Created instructions from Body should be appended
     // to the end of the basic block bb.
     if (auto err = ast->Body->accept(this))
     {
-        deleteFn(fn, isDeclared);
+        deleteFn(fn, ast->Proto->Name, isDeclared);
         return err;
     }
     llvm::Value *retVal = exprVal.release();
@@ -294,42 +424,99 @@ std::optional<Error> CodeGen::visit(FunctionAST *ast)
     // Error reading body, remove function.
     if (!retVal)
     {
-        deleteFn(fn, isDeclared);
+        deleteFn(fn, ast->Proto->Name, isDeclared);
         return Error("failed to generate body's code");
     }
 
     // Finish off the function.
     Builder->CreateRet(retVal);
+    if (debugFn)
+        DIB->finalizeSubprogram(debugFn);
 
     // Validate the generated code, checking for consistency.
-    bool hasErrors = llvm::verifyFunction(*fn, &llvm::errs());
-    if (hasErrors)
+    std::string broken;
+    llvm::raw_string_ostream os(broken);
+    if (llvm::verifyFunction(*fn, &os))
     {
-        deleteFn(fn, isDeclared);
-        return Error("failed to verify function");
+        deleteFn(fn, ast->Proto->Name, isDeclared);
+        return Error("failed to verify function: " + os.str());
     }
 
-    // Print the newly created function
-    fprintf(stderr, "*** Generated function:\n");
-    fn->print(llvm::errs());
+    if (CheckOnly)
+    {
+        // Other functions stay in the module to be called, a top-level
+        // expression is never called.
+        if (ast->Proto->isMain())
+        {
+            moduleFns[ast->Proto->Name] = nullptr;
+            fn->eraseFromParent();
+        }
+        return std::nullopt;
+    }
+
+    if (Interp && ast->Proto->isMain())
+    {
+        // A top-level expression runs once, interpreting it is much
+        // cheaper than compiling it.
+        if (auto r = Interp->Run(ast))
+        {
+            moduleFns[ast->Proto->Name] = nullptr;
+            fn->eraseFromParent();
+            if (r->isError())
+                return r->error();
+            Diagnostics::Printf(DiagCategory::Result, "*** Evaluated to %f\n", r->value());
+            StartupProfile::Record(StartupProfile::FirstResult);
+            // The functions it called natively may have been compiled.
+            jm->EvictColdCode();
+            return std::nullopt;
+        }
+    }
+    else if (Interp)
+    {
+        // Functions the interpreter cannot handle only run natively.
+        Interp->Define(ast);
+    }
 
-    optimizer->optimizeFn(*fn);
+    // Print the newly created function
+    Diagnostics::Print(DiagCategory::IR, [fn](llvm::raw_ostream &os)
+                       {
+        os << "*** Generated function:\n";
+        fn->print(os); });
+
+    // In batch mode, keep adding functions to this module until
+    // TakeModule, which optimizes them together.
+    if (Batch && !ast->Proto->isMain())
+        return std::nullopt;
+    finishDebugInfo();
+
+    // In lazy and tiered mode the JIT optimizes functions itself.
+    bool optimized = !jm->OptimizesInJIT() || ast->Proto->isMain();
+    if (optimized)
+        optimize();
+    else
+        Module->setDataLayout(jm->DataLayout());
 
     // Print the optimized function
-    fprintf(stderr, "*** Optimized function:\n");
-    fn->print(llvm::errs());
+    if (optimized)
+    {
+        Diagnostics::Print(DiagCategory::IR, [fn](llvm::raw_ostream &os)
+                           {
+            os << "*** Optimized function:\n";
+            fn->print(os); });
+    }
 
-    if (ast->Proto->Name == "__main__")
+    if (ast->Proto->isMain())
     {
-        bool broken = llvm::verifyModule(*Module, &llvm::errs());
-        if (broken)
+        if (llvm::verifyModule(*Module, &os))
         {
-            fprintf(stderr, "Generated IR broken\n");
+            Diagnostics::Printf(DiagCategory::Error, "%sGenerated IR broken\n", os.str().c_str());
             return std::nullopt;
         }
 
-        fprintf(stderr, "*** Main module:\n");
-        Module->print(llvm::errs(), nullptr);
+        Diagnostics::Print(DiagCategory::IR, [this](llvm::raw_ostream &os)
+                           {
+            os << "*** Main module:\n";
+            Module->print(os, nullptr); });
 
         // Move the current module and context containing __main__
         // into JIT to execute.
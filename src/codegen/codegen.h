@@ -1,30 +1,53 @@
 #ifndef __CODEGEN_H__
 #define __CODEGEN_H__
 
-#include <map>
 #include <stack>
 #include <memory>
+#include <vector>
 
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/IR/DIBuilder.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Value.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Function.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
 
 #include "visitor/visitor.h"
 #include "optimizer.h"
 #include "jit/jit_manager.h"
+#include "interp/interpreter.h"
+#include "lexer/source_lines.h"
 #include "utils/result.h"
 #include "utils/error.h"
+#include "utils/symbol.h"
+
+class AST;
 
 class CodeGen : public Visitor
 {
+public:
+    // FunctionProto is the signature of a declared function.
+    // CodeGen keeps its own copy, so that the PrototypeAST it was declared
+    // from can be discarded.
+    struct FunctionProto
+    {
+        Symbol Name;
+        std::vector<Symbol> Args;
+    };
+
+    using ProtoTable = SymbolMap<std::unique_ptr<FunctionProto>>;
+
+private:
     // This is a helper object that makes easy to generate LLVM instructions
     std::unique_ptr<llvm::IRBuilder<>> Builder;
 
-    // This map keeps track of which values are defined in the current scope
-    std::map<std::string, llvm::Value *> NamedValues;
+    // This table keeps track of which values are defined in the current scope.
+    // scope lists the symbols bound in it, so it can be reset cheaply.
+    SymbolMap<llvm::Value *> NamedValues;
+    std::vector<Symbol> scope;
 
     // exprVal holds the intermediate value when visiting an expression.
     // The destructor of llvm::Value is protected, so that it cannot be called
@@ -32,25 +55,80 @@ class CodeGen : public Visitor
     // which does nothing.
     std::unique_ptr<llvm::Value, std::function<void *(llvm::Value *)>> exprVal;
 
+    // optimizer is created on first use, and reused for every module.
     std::unique_ptr<Optimizer> optimizer;
 
-    std::unique_ptr<JITManager> jm;
+    std::shared_ptr<JITManager> jm;
+
+    // fnProtos holds the latest prototype of every function declared so far.
+    ProtoTable fnProtos;
+
+    // sharedProtos, if set, holds the prototypes of functions declared
+    // elsewhere, which are looked up when fnProtos has none.
+    const ProtoTable *sharedProtos = nullptr;
+
+    // moduleFns holds the functions declared in the current Module.
+    SymbolMap<llvm::Function *> moduleFns;
 
-    std::map<std::string, PrototypeAST *> fnProtos;
+    // With DebugLines, the debug info of the current Module, created with
+    // its first function, and the subprogram of the function being
+    // generated.
+    std::unique_ptr<llvm::DIBuilder> DIB;
+    llvm::DICompileUnit *debugUnit = nullptr;
+    llvm::DISubprogram *debugFn = nullptr;
 
     void init();
 
-    Result<llvm::Function *, Error> getFunction(std::string fnName);
+    // beginDebugInfo gives fn a subprogram at the prototype of ast.
+    void beginDebugInfo(FunctionAST *ast, llvm::Function *fn);
+
+    // setLocation attributes the instructions generated next to ast.
+    void setLocation(const AST *ast);
+
+    // finishDebugInfo completes the debug info of Module before it is
+    // optimized or handed over.
+    void finishDebugInfo();
+
+    // optimize gives Module the JIT's data layout and optimizes it.
+    void optimize();
+
+    const FunctionProto *findProto(Symbol fnName) const;
 
-    void deleteFn(llvm::Function *fn, bool isDeclared);
+    Result<llvm::Function *, Error> getFunction(Symbol fnName);
+
+    Result<llvm::Function *, Error> declareFunction(Symbol fnName, llvm::ArrayRef<Symbol> args);
+
+    void deleteFn(llvm::Function *fn, Symbol fnName, bool isDeclared);
 
 public:
     CodeGen();
 
-    // ~CodeGen()
-    // {
-    //     jm->JIT->getMainJITDylib().clear();
-    // }
+    // A CodeGen adding code to the given JIT, which also knows the functions
+    // in protos, e.g. one of several that compile a program in parallel.
+    CodeGen(std::shared_ptr<JITManager> jm, const ProtoTable *protos = nullptr);
+
+    // In batch mode, functions other than __main__ are kept in the current
+    // module until TakeModule instead of being added to the JIT one by one.
+    bool Batch = false;
+
+    // In check mode, functions are only generated and verified, like in
+    // batch mode but without running the top-level expressions or
+    // creating the JIT.
+    bool CheckOnly = false;
+
+    // DebugLines, if set, locates the nodes in the source, and every
+    // function gets a DWARF line table.
+    const SourceLines *DebugLines = nullptr;
+
+    // Interp, if set, runs the top-level expressions instead of the JIT,
+    // and is given every function defined, see Interpreter.
+    Interpreter *Interp = nullptr;
+
+    // TakeModule optimizes the current module, returns it and starts a new one.
+    // With optimized false, it is left for the caller to optimize.
+    llvm::orc::ThreadSafeModule TakeModule(bool optimized = true);
+
+    ~CodeGen();
 
     // This is an LLVM construct that contains functions and global variables
     std::unique_ptr<llvm::Module> Module;
@@ -0,0 +1,82 @@
+#include <algorithm>
+#include <vector>
+
+#include "ir_library.h"
+
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "utils/memory_usage.h"
+
+void IRLibrary::Add(const llvm::Module &module)
+{
+    std::vector<llvm::StringRef> defined;
+    for (const llvm::Function &fn : module)
+    {
+        // Top-level expressions are never called again.
+        if (fn.isDeclaration() || fn.hasAvailableExternallyLinkage() ||
+            fn.getName() == "__main__")
+            continue;
+        defined.push_back(fn.getName());
+    }
+    if (defined.empty())
+        return;
+
+    auto buf = std::make_shared<std::string>();
+    llvm::raw_string_ostream os(*buf);
+    llvm::WriteBitcodeToFile(module, os);
+    os.flush();
+
+    bool added = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (llvm::StringRef name : defined)
+            added |= bitcode.try_emplace(name, buf).second;
+    }
+    if (added)
+        MemoryAccounting::Add(std::string_view(defined[0].data(), defined[0].size()), MemoryKind::IR,
+                              buf->size());
+}
+
+void IRLibrary::LinkInto(llvm::Module &module)
+{
+    // A module may define several of the callees, link it once.
+    std::vector<std::shared_ptr<const std::string>> needed;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const llvm::Function &fn : module)
+        {
+            if (!fn.isDeclaration() || fn.isIntrinsic())
+                continue;
+            auto it = bitcode.find(fn.getName());
+            if (it == bitcode.end())
+                continue;
+            if (std::find(needed.begin(), needed.end(), it->second) == needed.end())
+                needed.push_back(it->second);
+        }
+    }
+
+    for (const auto &buf : needed)
+    {
+        auto lib = llvm::parseBitcodeFile(
+            llvm::MemoryBufferRef(*buf, "ir-library"), module.getContext());
+        if (!lib)
+        {
+            // The bodies are only an optimization hint, do without them.
+            llvm::consumeError(lib.takeError());
+            continue;
+        }
+
+        for (llvm::Function &fn : **lib)
+        {
+            if (!fn.isDeclaration())
+                fn.setLinkage(llvm::GlobalValue::AvailableExternallyLinkage);
+        }
+
+        // Only the functions the module refers to are linked.
+        llvm::Linker::linkModules(module, std::move(*lib), llvm::Linker::LinkOnlyNeeded);
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef __IR_LIBRARY_H__
+#define __IR_LIBRARY_H__
+
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/Module.h"
+
+// IRLibrary keeps the optimized IR of the functions handed to the JIT, so
+// that later modules can see the bodies of the functions they call. The
+// bodies are linked in as available_externally definitions: the inliner
+// and the interprocedural passes may use them, but they are never emitted
+// again. It is safe to use from several threads.
+class IRLibrary
+{
+    std::mutex mutex;
+
+    // The bitcode of every added module, by the functions it defines.
+    llvm::StringMap<std::shared_ptr<const std::string>> bitcode;
+
+public:
+    // Add records the functions defined by module. A function that is
+    // already known keeps its first body, so that modules optimized
+    // concurrently all see the same bodies, see ParallelCodeGen.
+    void Add(const llvm::Module &module);
+
+    // LinkInto links into module the known bodies of the functions it
+    // declares.
+    void LinkInto(llvm::Module &module);
+};
+
+#endif
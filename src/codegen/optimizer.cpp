@@ -1,15 +1,47 @@
 #include "optimizer.h"
 
-#include "llvm/Transforms/InstCombine/InstCombine.h"
-#include "llvm/Transforms/Scalar/GVN.h"
-#include "llvm/Transforms/Scalar/Reassociate.h"
-#include "llvm/Transforms/Scalar/SimplifyCFG.h"
+#include <string>
 
-#include "llvm/Passes/PassBuilder.h"
+#include "utils/phase_timer.h"
 
-Optimizer::Optimizer(llvm::LLVMContext &context)
+std::optional<OptLevel> ParseOptLevel(std::string_view s)
 {
-    // Create new nalysis managers.
+    if (s == "0")
+        return OptLevel::O0;
+    if (s == "1")
+        return OptLevel::O1;
+    if (s == "2")
+        return OptLevel::O2;
+    if (s == "3")
+        return OptLevel::O3;
+    if (s == "s")
+        return OptLevel::Os;
+    return std::nullopt;
+}
+
+static llvm::OptimizationLevel toLLVM(OptLevel level)
+{
+    switch (level)
+    {
+    case OptLevel::O0:
+        return llvm::OptimizationLevel::O0;
+    case OptLevel::O1:
+        return llvm::OptimizationLevel::O1;
+    case OptLevel::O2:
+        return llvm::OptimizationLevel::O2;
+    case OptLevel::O3:
+        return llvm::OptimizationLevel::O3;
+    case OptLevel::Os:
+        return llvm::OptimizationLevel::Os;
+    }
+    return llvm::OptimizationLevel::O2;
+}
+
+Optimizer::Optimizer(const OptimizerOptions &opts, IRLibrary *library,
+                     std::unique_ptr<llvm::TargetMachine> tm)
+    : opts(opts), library(opts.CrossModule ? library : nullptr), tm(std::move(tm))
+{
+    // Create new analysis managers.
     // Module -> (CGSCC ->) Function -> Loop
     mam = std::make_unique<llvm::ModuleAnalysisManager>();
     cgam = std::make_unique<llvm::CGSCCAnalysisManager>();
@@ -17,30 +49,58 @@ Optimizer::Optimizer(llvm::LLVMContext &context)
     lam = std::make_unique<llvm::LoopAnalysisManager>();
 
     pic = std::make_unique<llvm::PassInstrumentationCallbacks>();
-    si = std::make_unique<llvm::StandardInstrumentations>(context,
-                                                          /*DebugLogging*/ true);
-    si->registerCallbacks(*pic, mam.get());
-
-    // Create new function pass manager and add function-level passes to it.
-    fpm = std::make_unique<llvm::FunctionPassManager>();
-    // Add transform passes.
-    // Do simple "peephole" optimizations and bit-twiddling optzns.
-    fpm->addPass(llvm::InstCombinePass());
-    // Reassociate expressions.
-    fpm->addPass(llvm::ReassociatePass());
-    // Eliminate Common SubExpressions.
-    fpm->addPass(llvm::GVNPass());
-    // Simplify the control flow graph (deleting unreachable blocks, etc).
-    fpm->addPass(llvm::SimplifyCFGPass());
-
-    // Register analysis passes used in these transform passes.
-    llvm::PassBuilder pb;
-    pb.registerModuleAnalyses(*mam);
-    pb.registerFunctionAnalyses(*fam);
-    pb.crossRegisterProxies(*lam, *fam, *cgam, *mam);
+    if (opts.DebugPasses)
+    {
+        instrContext = std::make_unique<llvm::LLVMContext>();
+        si = std::make_unique<llvm::StandardInstrumentations>(*instrContext,
+                                                              /*DebugLogging*/ true);
+        si->registerCallbacks(*pic, mam.get());
+    }
+
+    // Register the analyses used by the pipeline.
+    pb = std::make_unique<llvm::PassBuilder>(this->tm.get(), llvm::PipelineTuningOptions(),
+                                             std::nullopt, pic.get());
+    pb->registerModuleAnalyses(*mam);
+    pb->registerCGSCCAnalyses(*cgam);
+    pb->registerFunctionAnalyses(*fam);
+    pb->registerLoopAnalyses(*lam);
+    pb->crossRegisterProxies(*lam, *fam, *cgam, *mam);
+
+    // The default pipelines include module passes such as the inliner,
+    // global DCE and IPSCCP, which work across the functions of a module.
+    llvm::OptimizationLevel level = toLLVM(opts.Level);
+    mpm = std::make_unique<llvm::ModulePassManager>(
+        opts.Level == OptLevel::O0 ? pb->buildO0DefaultPipeline(level)
+                                   : pb->buildPerModuleDefaultPipeline(level));
 }
 
-void Optimizer::optimizeFn(llvm::Function &fn)
+void Optimizer::optimizeModule(llvm::Module &module)
 {
-    fpm->run(fn, *fam);
+    // The time is attributed to the first function the module defines,
+    // named before the library is linked in.
+    std::string name;
+    for (llvm::Function &fn : module)
+    {
+        if (!fn.isDeclaration())
+        {
+            name = fn.getName().str();
+            break;
+        }
+    }
+    ScopedPhase timer(Phase::Optimize, name);
+
+    if (library)
+        library->LinkInto(module);
+
+    mpm->run(module, *mam);
+
+    // The cached analyses refer to this module, which is about to be
+    // handed to the JIT, so drop them before the next one.
+    lam->clear();
+    fam->clear();
+    cgam->clear();
+    mam->clear();
+
+    if (library)
+        library->Add(module);
 }
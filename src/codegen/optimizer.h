@@ -2,29 +2,84 @@
 #define __OPTIMIZER_H__
 
 #include <memory>
+#include <optional>
+#include <string_view>
 
 #include "llvm/IR/PassManager.h"
 #include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/StandardInstrumentations.h"
 #include "llvm/Analysis/CGSCCPassManager.h"
 #include "llvm/Analysis/LoopAnalysisManager.h"
+#include "llvm/Target/TargetMachine.h"
 
+#include "ir_library.h"
+
+// OptLevel selects one of the default LLVM pipelines, as in clang -O<level>.
+enum class OptLevel
+{
+    O0,
+    O1,
+    O2,
+    O3,
+    Os,
+};
+
+// ParseOptLevel parses "0", "1", "2", "3" or "s".
+std::optional<OptLevel> ParseOptLevel(std::string_view s);
+
+struct OptimizerOptions
+{
+    OptLevel Level = OptLevel::O2;
+
+    // DebugPasses logs every pass and analysis run to stderr.
+    bool DebugPasses = false;
+
+    // CrossModule lets the passes see the bodies of functions defined in
+    // earlier modules, see IRLibrary, so that they can be inlined.
+    bool CrossModule = false;
+};
+
+// Optimizer runs the pipeline of an optimization level over whole modules.
+// The pass managers are built once and reused for every module, so an
+// Optimizer must only be used by one thread at a time.
 class Optimizer
 {
+    OptimizerOptions opts;
+    IRLibrary *library;
+
+    // The target the code is compiled for, whose cost models guide e.g.
+    // the vectorizers and unrolling. Without it they use generic ones.
+    std::unique_ptr<llvm::TargetMachine> tm;
+
     // Passes and analysis managers.
-    std::unique_ptr<llvm::FunctionPassManager> fpm;
+    std::unique_ptr<llvm::ModulePassManager> mpm;
     std::unique_ptr<llvm::LoopAnalysisManager> lam;
     std::unique_ptr<llvm::FunctionAnalysisManager> fam;
     std::unique_ptr<llvm::CGSCCAnalysisManager> cgam;
     std::unique_ptr<llvm::ModuleAnalysisManager> mam;
 
     std::unique_ptr<llvm::PassInstrumentationCallbacks> pic;
+    std::unique_ptr<llvm::PassBuilder> pb;
+
+    // The instrumentation is only created for DebugPasses. It only reads
+    // the pass gate of its context (-opt-bisect-limit), so it gets a
+    // context of its own, since the modules come from many contexts.
+    std::unique_ptr<llvm::LLVMContext> instrContext;
     std::unique_ptr<llvm::StandardInstrumentations> si;
 
 public:
-    Optimizer(llvm::LLVMContext &context);
+    // With opts.CrossModule, every module is linked against library before
+    // it is optimized and added to it after. tm, if given, is the target
+    // machine the modules are compiled with.
+    explicit Optimizer(const OptimizerOptions &opts = OptimizerOptions(),
+                       IRLibrary *library = nullptr,
+                       std::unique_ptr<llvm::TargetMachine> tm = nullptr);
+
+    const OptimizerOptions &options() const { return opts; }
 
-    void optimizeFn(llvm::Function &fn);
+    void optimizeModule(llvm::Module &module);
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,348 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <future>
+#include <string>
+
+#include "parallel_codegen.h"
+
+#include "ast/BinaryExprAST.h"
+#include "ast/CallExprAST.h"
+#include "ast/FunctionAST.h"
+#include "ast/IfExprAST.h"
+#include "ast/NumberExprAST.h"
+#include "ast/ProgramAST.h"
+#include "ast/PrototypeAST.h"
+#include "ast/VariableExprAST.h"
+#include "utils/diagnostics.h"
+
+namespace
+{
+    // CalleeCollector lists the functions called by a function body.
+    class CalleeCollector : public Visitor
+    {
+    public:
+        std::vector<Symbol> Callees;
+
+        std::optional<Error> visit(NumberExprAST *ast) override { return std::nullopt; }
+        std::optional<Error> visit(VariableExprAST *ast) override { return std::nullopt; }
+
+        std::optional<Error> visit(IfExprAST *ast) override
+        {
+            ast->Cond->accept(this);
+            ast->Then->accept(this);
+            return ast->Else->accept(this);
+        }
+
+        std::optional<Error> visit(CallExprAST *ast) override
+        {
+            Callees.push_back(ast->Callee);
+            for (ExprAST *arg : ast->Args)
+                arg->accept(this);
+            return std::nullopt;
+        }
+
+        std::optional<Error> visit(BinaryExprAST *ast) override
+        {
+            ast->LHS->accept(this);
+            return ast->RHS->accept(this);
+        }
+
+        std::optional<Error> visit(PrototypeAST *ast) override { return std::nullopt; }
+
+        std::optional<Error> visit(FunctionAST *ast) override
+        {
+            return ast->Body->accept(this);
+        }
+
+        std::optional<Error> visit(ProgramAST *ast) override { return std::nullopt; }
+    };
+}
+
+std::optional<Error> ParallelCodeGen::Compile(ProgramAST *program)
+{
+    // Errors are reported in source order, keyed by the index of their node.
+    std::vector<std::pair<size_t, Error>> errors;
+    std::vector<FunctionAST *> mains;
+
+    // Collect the prototypes and definitions first, so that the workers
+    // only ever read them.
+    SymbolMap<size_t> defIndex; // 1 + the index in defs
+    std::vector<size_t> defNode;
+    for (size_t i = 0; i < program->Nodes.size(); i++)
+    {
+        AST *node = program->Nodes[i];
+        FunctionAST *fn = dynamic_cast<FunctionAST *>(node);
+        PrototypeAST *proto = fn ? fn->Proto : dynamic_cast<PrototypeAST *>(node);
+        if (!proto)
+            continue;
+        if (proto->isMain())
+        {
+            mains.push_back(fn);
+            continue;
+        }
+
+        Symbol name = proto->getName();
+        auto &known = protos[name];
+        if (fn && defIndex.get(name))
+        {
+            errors.emplace_back(i, Error("redeclare a defined function"));
+            continue;
+        }
+        if (known && known->Args.size() != proto->Args.size())
+        {
+            errors.emplace_back(i, Error("# params mismatched"));
+            continue;
+        }
+        if (!known)
+            known = std::make_unique<CodeGen::FunctionProto>();
+        known->Name = name;
+        known->Args.assign(proto->Args.begin(), proto->Args.end());
+
+        if (fn)
+        {
+            defIndex[name] = defs.size() + 1;
+            defs.push_back(fn);
+            defNode.push_back(i);
+        }
+    }
+
+    callees.assign(defs.size(), std::vector<size_t>());
+    std::vector<std::vector<size_t>> callers(defs.size());
+    for (size_t d = 0; d < defs.size(); d++)
+    {
+        CalleeCollector collector;
+        defs[d]->accept(&collector);
+        for (Symbol callee : collector.Callees)
+        {
+            if (size_t idx = defIndex.get(callee))
+            {
+                callees[d].push_back(idx - 1);
+                callers[idx - 1].push_back(d);
+            }
+        }
+    }
+
+    std::vector<Shard> shards = makeShards(findSCCs());
+    std::vector<size_t> shardOf(defs.size());
+    for (size_t s = 0; s < shards.size(); s++)
+        for (size_t d : shards[s])
+            shardOf[d] = s;
+
+    // Lower all shards in parallel. A definition that fails is dropped, like
+    // the interactive CodeGen does, which may in turn break its callers, so
+    // the shards of the failed definitions and of their callers are lowered
+    // again until nothing else fails.
+    std::vector<Lowered> lowered(shards.size());
+    std::vector<bool> failed(defs.size(), false);
+    std::vector<bool> pending(shards.size(), true);
+    while (true)
+    {
+        std::vector<std::pair<size_t, std::future<Lowered>>> tasks;
+        for (size_t s = 0; s < shards.size(); s++)
+        {
+            if (!pending[s])
+                continue;
+            const Shard &shard = shards[s];
+            tasks.emplace_back(s, pool.submit([this, &shard, &failed]()
+                                              { return lowerShard(shard, failed); }));
+        }
+
+        std::vector<std::pair<size_t, Error>> newlyFailed;
+        for (auto &[s, task] : tasks)
+        {
+            lowered[s] = task.get();
+            for (auto &f : lowered[s].Failed)
+                newlyFailed.push_back(f);
+        }
+        if (newlyFailed.empty())
+            break;
+
+        pending.assign(shards.size(), false);
+        for (auto &[d, err] : newlyFailed)
+        {
+            failed[d] = true;
+            errors.emplace_back(defNode[d], err);
+            protos[defs[d]->Proto->getName()].reset();
+            pending[shardOf[d]] = true;
+            for (size_t caller : callers[d])
+                pending[shardOf[caller]] = true;
+        }
+    }
+
+    // Optimize the shards on the pool, unless the JIT does it. With --ipo,
+    // the library first gets the unoptimized IR of every shard, so that each
+    // shard inlines the same bodies however the threads are scheduled.
+    if (jm->OptOptions.CrossModule)
+    {
+        for (Lowered &l : lowered)
+            l.Module.withModuleDo([this](llvm::Module &module)
+                                  { jm->Library.Add(module); });
+    }
+    if (!jm->OptimizesInJIT())
+    {
+        std::vector<std::future<void>> tasks;
+        for (Lowered &l : lowered)
+        {
+            tasks.push_back(pool.submit([this, &l]()
+                                        {
+                std::unique_ptr<Optimizer> optimizer = jm->NewOptimizer();
+                l.Module.withModuleDo([&optimizer](llvm::Module &module)
+                                      { optimizer->optimizeModule(module); }); }));
+        }
+        for (auto &task : tasks)
+            task.get();
+    }
+
+    // Hand the modules to the JIT, callees first, and compile them all at once.
+    for (Lowered &l : lowered)
+        jm->JITAddModule(std::move(l.Module));
+    std::vector<std::string> names;
+    for (size_t d = 0; d < defs.size(); d++)
+    {
+        if (!failed[d])
+            names.push_back(std::string(defs[d]->Proto->getName().str()));
+    }
+    // In lazy mode they are compiled on their first call instead. Code that
+    // fails to link is reported after the items, the top-level expressions
+    // that do not reach it still run.
+    if (!names.empty() && !jm->IsLazy())
+    {
+        if (auto err = jm->JITMaterialize(names))
+            errors.emplace_back(SIZE_MAX, *err);
+    }
+
+    std::sort(errors.begin(), errors.end(),
+              [](const auto &a, const auto &b)
+              { return a.first < b.first; });
+    for (const auto &[node, err] : errors)
+        Diagnostics::Printf(DiagCategory::Error, "error: %s\n", err.message.c_str());
+
+    // The top-level expressions are small, run them one by one.
+    CodeGen cg(jm, &protos);
+    cg.DebugLines = DebugLines;
+    size_t numErrors = errors.size();
+    for (FunctionAST *fn : mains)
+    {
+        if (auto err = fn->accept(&cg))
+        {
+            Diagnostics::Printf(DiagCategory::Error, "error: %s\n", err->message.c_str());
+            numErrors++;
+        }
+    }
+
+    if (numErrors > 0)
+        return Error(std::to_string(numErrors) + " items failed to compile");
+    return std::nullopt;
+}
+
+std::vector<std::vector<size_t>> ParallelCodeGen::findSCCs() const
+{
+    // Tarjan's algorithm with an explicit stack, since generated programs
+    // may have call chains too deep to recurse on. Components are found
+    // callees first.
+    constexpr size_t none = SIZE_MAX;
+    size_t n = defs.size();
+    std::vector<size_t> index(n, none);
+    std::vector<size_t> low(n, 0);
+    std::vector<bool> onStack(n, false);
+    std::vector<size_t> stack;
+    // The definitions being visited and the next callee of each to look at.
+    std::vector<std::pair<size_t, size_t>> work;
+    std::vector<std::vector<size_t>> sccs;
+    size_t next = 0;
+
+    auto enter = [&](size_t v)
+    {
+        index[v] = low[v] = next++;
+        stack.push_back(v);
+        onStack[v] = true;
+        work.emplace_back(v, 0);
+    };
+
+    for (size_t root = 0; root < n; root++)
+    {
+        if (index[root] != none)
+            continue;
+        enter(root);
+        while (!work.empty())
+        {
+            size_t v = work.back().first;
+            size_t i = work.back().second;
+            if (i < callees[v].size())
+            {
+                work.back().second++;
+                size_t w = callees[v][i];
+                if (index[w] == none)
+                    enter(w);
+                else if (onStack[w])
+                    low[v] = std::min(low[v], index[w]);
+                continue;
+            }
+
+            work.pop_back();
+            if (!work.empty())
+            {
+                size_t parent = work.back().first;
+                low[parent] = std::min(low[parent], low[v]);
+            }
+            if (low[v] == index[v])
+            {
+                std::vector<size_t> scc;
+                size_t w;
+                do
+                {
+                    w = stack.back();
+                    stack.pop_back();
+                    onStack[w] = false;
+                    scc.push_back(w);
+                } while (w != v);
+                sccs.push_back(std::move(scc));
+            }
+        }
+    }
+    return sccs;
+}
+
+std::vector<ParallelCodeGen::Shard> ParallelCodeGen::makeShards(
+    const std::vector<std::vector<size_t>> &sccs) const
+{
+    // Pack consecutive SCCs into shards of about the same size, never
+    // splitting one, so mutually recursive functions share a module.
+    size_t n = numShards ? numShards : std::max<size_t>(1, pool.size() * ShardsPerThread);
+    size_t target = (defs.size() + n - 1) / n;
+    std::vector<Shard> shards;
+    Shard shard;
+    for (const auto &scc : sccs)
+    {
+        shard.insert(shard.end(), scc.begin(), scc.end());
+        if (shard.size() >= target)
+        {
+            shards.push_back(std::move(shard));
+            shard.clear();
+        }
+    }
+    if (!shard.empty())
+        shards.push_back(std::move(shard));
+    return shards;
+}
+
+ParallelCodeGen::Lowered ParallelCodeGen::lowerShard(
+    const Shard &shard, const std::vector<bool> &failed) const
+{
+    CodeGen cg(jm, &protos);
+    cg.Batch = true;
+    cg.DebugLines = DebugLines;
+
+    Lowered result;
+    for (size_t d : shard)
+    {
+        if (failed[d])
+            continue;
+        if (auto err = defs[d]->accept(&cg))
+            result.Failed.emplace_back(d, *err);
+    }
+    // The shards are optimized once none fails any more, see Compile.
+    result.Module = cg.TakeModule(false);
+    return result;
+}
@@ -0,0 +1,75 @@
+#ifndef __PARALLEL_CODEGEN_H__
+#define __PARALLEL_CODEGEN_H__
+
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "codegen.h"
+#include "jit/jit_manager.h"
+#include "utils/error.h"
+#include "utils/symbol.h"
+#include "utils/thread_pool.h"
+
+class FunctionAST;
+class ProgramAST;
+
+// ParallelCodeGen compiles a whole program at once. The function definitions
+// are grouped by the strongly connected components of the call graph into a
+// few modules per thread, lowered by a CodeGen per module on the pool, and
+// compiled concurrently by the JIT. The top-level expressions then run in
+// source order.
+//
+// With a single module it is a batch compiler: the functions of the whole
+// program are optimized together and added to the JIT at once, instead of
+// in a module, context and optimizer of their own each.
+//
+// Unlike the interactive CodeGen, a top-level expression may call a function
+// defined after it, and IR is not printed.
+class ParallelCodeGen
+{
+public:
+    // numShards is the number of modules to split the program into,
+    // 0 for a few per thread. To compile modules in parallel, jm should
+    // compile on several threads too, see JITOptions.
+    ParallelCodeGen(ThreadPool &pool, std::shared_ptr<JITManager> jm, size_t numShards = 0)
+        : pool(pool), jm(std::move(jm)), numShards(numShards) {}
+
+    // Compile reports errors of individual items on stderr and keeps going,
+    // like ParseProgram does with visitor errors.
+    std::optional<Error> Compile(ProgramAST *program);
+
+    // DebugLines, if set, gives the functions line tables, see CodeGen.
+    const SourceLines *DebugLines = nullptr;
+
+private:
+    ThreadPool &pool;
+    std::shared_ptr<JITManager> jm;
+    size_t numShards;
+
+    // Modules per thread, so that the work is balanced when SCCs vary in size.
+    static constexpr size_t ShardsPerThread = 4;
+
+    // The prototypes of all functions declared or defined by the program.
+    CodeGen::ProtoTable protos;
+
+    // The function definitions and, for each, the definitions it calls.
+    std::vector<FunctionAST *> defs;
+    std::vector<std::vector<size_t>> callees;
+
+    // A shard is a list of definitions lowered into one module.
+    using Shard = std::vector<size_t>;
+
+    struct Lowered
+    {
+        llvm::orc::ThreadSafeModule Module;
+        // The definitions that failed to lower, and why.
+        std::vector<std::pair<size_t, Error>> Failed;
+    };
+
+    std::vector<std::vector<size_t>> findSCCs() const;
+    std::vector<Shard> makeShards(const std::vector<std::vector<size_t>> &sccs) const;
+    Lowered lowerShard(const Shard &shard, const std::vector<bool> &failed) const;
+};
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef __BYTECODE_H__
+#define __BYTECODE_H__
+
+#include <cstdint>
+#include <vector>
+
+#include "utils/symbol.h"
+
+// Op is a bytecode instruction of the Interpreter. Its operands a, b and c
+// are registers, unless noted otherwise.
+enum class Op : uint8_t
+{
+    Const,      // a = Consts[b]
+    Move,       // a = b
+    Add,        // a = b + c
+    Sub,        // a = b - c
+    Mul,        // a = b * c
+    Less,       // a = b < c, 1.0 or 0.0
+    Jump,       // go to instruction b
+    JumpIfZero, // go to instruction b if a is 0.0
+    Call,       // a = Callees[b](c, c + 1, ...)
+    Ret,        // return a
+};
+
+struct Instr
+{
+    Op op;
+    uint16_t a, b, c;
+};
+
+// BytecodeFunction is a function compiled for the Interpreter.
+// Its arguments are passed in the first registers.
+struct BytecodeFunction
+{
+    Symbol Name;
+    uint16_t NumArgs = 0;
+    uint16_t NumRegs = 0;
+    std::vector<Instr> Code;
+    std::vector<double> Consts;
+    // The functions it calls, as indices in the Interpreter's function table.
+    std::vector<uint32_t> Callees;
+};
+
+#endif
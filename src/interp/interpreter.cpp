@@ -0,0 +1,382 @@
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+#include "interpreter.h"
+
+#include "ast/BinaryExprAST.h"
+#include "ast/CallExprAST.h"
+#include "ast/FunctionAST.h"
+#include "ast/IfExprAST.h"
+#include "ast/NumberExprAST.h"
+#include "ast/ProgramAST.h"
+#include "ast/PrototypeAST.h"
+#include "ast/VariableExprAST.h"
+#include "utils/phase_timer.h"
+#include "visitor/visitor.h"
+
+namespace
+{
+    // Compiler translates a function to bytecode. Registers are allocated
+    // like a stack: an expression leaves its value in `result` and frees
+    // the temporaries it used.
+    class Compiler : public Visitor
+    {
+        BytecodeFunction &fn;
+        std::function<Result<uint32_t, Error>(Symbol, size_t)> findFunction;
+        ArenaArray<Symbol> args;
+        uint32_t next = 0;
+        uint16_t result = 0;
+
+        std::optional<Error> alloc(uint16_t &reg)
+        {
+            if (next >= std::numeric_limits<uint16_t>::max())
+                return Error("function too large for the interpreter");
+            reg = static_cast<uint16_t>(next++);
+            fn.NumRegs = std::max<uint16_t>(fn.NumRegs, static_cast<uint16_t>(next));
+            return std::nullopt;
+        }
+
+        uint16_t here() const { return static_cast<uint16_t>(fn.Code.size()); }
+
+        void emit(Op op, uint16_t a, uint16_t b = 0, uint16_t c = 0)
+        {
+            fn.Code.push_back(Instr{op, a, b, c});
+        }
+
+    public:
+        Compiler(BytecodeFunction &fn,
+                 std::function<Result<uint32_t, Error>(Symbol, size_t)> findFunction)
+            : fn(fn), findFunction(std::move(findFunction)) {}
+
+        std::optional<Error> visit(NumberExprAST *ast) override
+        {
+            if (fn.Consts.size() > std::numeric_limits<uint16_t>::max())
+                return Error("function too large for the interpreter");
+            if (auto err = alloc(result))
+                return err;
+            emit(Op::Const, result, static_cast<uint16_t>(fn.Consts.size()));
+            fn.Consts.push_back(ast->Val);
+            return std::nullopt;
+        }
+
+        std::optional<Error> visit(VariableExprAST *ast) override
+        {
+            // Arguments stay in their registers.
+            for (size_t i = 0; i < args.size(); i++)
+            {
+                if (args[i] == ast->Name)
+                {
+                    result = static_cast<uint16_t>(i);
+                    return std::nullopt;
+                }
+            }
+            return Error("unknown variable name");
+        }
+
+        std::optional<Error> visit(IfExprAST *ast) override
+        {
+            uint32_t mark = next;
+            if (auto err = ast->Cond->accept(this))
+                return err;
+            uint16_t cond = result;
+            next = mark;
+            uint16_t dest = 0;
+            if (auto err = alloc(dest))
+                return err;
+
+            size_t jumpToElse = fn.Code.size();
+            emit(Op::JumpIfZero, cond);
+            if (auto err = ast->Then->accept(this))
+                return err;
+            emit(Op::Move, dest, result);
+            next = mark + 1;
+
+            size_t jumpToEnd = fn.Code.size();
+            emit(Op::Jump, 0);
+            fn.Code[jumpToElse].b = here();
+            if (auto err = ast->Else->accept(this))
+                return err;
+            emit(Op::Move, dest, result);
+            next = mark + 1;
+            fn.Code[jumpToEnd].b = here();
+
+            if (fn.Code.size() > std::numeric_limits<uint16_t>::max())
+                return Error("function too large for the interpreter");
+            result = dest;
+            return std::nullopt;
+        }
+
+        std::optional<Error> visit(CallExprAST *ast) override
+        {
+            auto r = findFunction(ast->Callee, ast->Args.size());
+            if (r.isError())
+                return r.error();
+            uint32_t callee = r.value();
+            // Any callee may end up running natively, see callNative.
+            if (ast->Args.size() > Interpreter::MaxNativeArgs)
+                return Error("too many arguments for a native call");
+
+            // The arguments go to consecutive registers.
+            uint32_t base = next;
+            if (base + ast->Args.size() >= std::numeric_limits<uint16_t>::max())
+                return Error("function too large for the interpreter");
+            next = base + static_cast<uint32_t>(ast->Args.size());
+            fn.NumRegs = std::max<uint16_t>(fn.NumRegs, static_cast<uint16_t>(next));
+            for (size_t i = 0; i < ast->Args.size(); i++)
+            {
+                if (auto err = ast->Args[i]->accept(this))
+                    return err;
+                if (result != base + i)
+                    emit(Op::Move, static_cast<uint16_t>(base + i), result);
+                next = base + static_cast<uint32_t>(ast->Args.size());
+            }
+
+            next = base;
+            uint16_t dest = 0;
+            if (auto err = alloc(dest))
+                return err;
+            if (fn.Callees.size() > std::numeric_limits<uint16_t>::max())
+                return Error("function too large for the interpreter");
+            emit(Op::Call, dest, static_cast<uint16_t>(fn.Callees.size()), static_cast<uint16_t>(base));
+            fn.Callees.push_back(callee);
+            result = dest;
+            return std::nullopt;
+        }
+
+        std::optional<Error> visit(BinaryExprAST *ast) override
+        {
+            uint32_t mark = next;
+            if (auto err = ast->LHS->accept(this))
+                return err;
+            uint16_t lhs = result;
+            if (auto err = ast->RHS->accept(this))
+                return err;
+            uint16_t rhs = result;
+            next = mark;
+
+            Op op;
+            switch (ast->Op)
+            {
+            case '+':
+                op = Op::Add;
+                break;
+            case '-':
+                op = Op::Sub;
+                break;
+            case '*':
+                op = Op::Mul;
+                break;
+            case '<':
+                op = Op::Less;
+                break;
+            default:
+                return Error("invalid binary operator");
+            }
+            if (auto err = alloc(result))
+                return err;
+            emit(op, result, lhs, rhs);
+            return std::nullopt;
+        }
+
+        std::optional<Error> visit(PrototypeAST *ast) override
+        {
+            if (ast->Args.size() >= std::numeric_limits<uint16_t>::max())
+                return Error("function too large for the interpreter");
+            fn.Name = ast->Name;
+            fn.NumArgs = static_cast<uint16_t>(ast->Args.size());
+            fn.NumRegs = fn.NumArgs;
+            args = ast->Args;
+            next = fn.NumArgs;
+            return std::nullopt;
+        }
+
+        std::optional<Error> visit(FunctionAST *ast) override
+        {
+            if (auto err = ast->Proto->accept(this))
+                return err;
+            if (auto err = ast->Body->accept(this))
+                return err;
+            emit(Op::Ret, result);
+            return std::nullopt;
+        }
+
+        std::optional<Error> visit(ProgramAST *ast) override
+        {
+            return Error("cannot compile a program to bytecode");
+        }
+    };
+}
+
+Result<uint32_t, Error> Interpreter::findFunction(Symbol name, size_t numArgs)
+{
+    if (size_t idx = functionIndex.get(name))
+    {
+        if (functions[idx - 1].NumArgs != numArgs)
+            return Error("incorrect # arguments passed");
+        return static_cast<uint32_t>(idx - 1);
+    }
+
+    // Not defined here, it will be looked up natively on its first call.
+    functions.push_back(Function{name, numArgs});
+    functionIndex[name] = functions.size();
+    return static_cast<uint32_t>(functions.size() - 1);
+}
+
+Result<std::unique_ptr<BytecodeFunction>, Error> Interpreter::compile(FunctionAST *fn)
+{
+    auto code = std::make_unique<BytecodeFunction>();
+    Compiler compiler(*code, [this](Symbol name, size_t numArgs)
+                      { return findFunction(name, numArgs); });
+    if (auto err = fn->accept(&compiler))
+        return *err;
+    return Result<std::unique_ptr<BytecodeFunction>, Error>(std::move(code));
+}
+
+std::optional<Error> Interpreter::Define(FunctionAST *fn)
+{
+    // Register the function first, so that it may call itself.
+    Symbol name = fn->Proto->getName();
+    auto r = findFunction(name, fn->Proto->Args.size());
+    if (r.isError())
+        return r.error();
+    uint32_t idx = r.value();
+
+    // A redefinition replaces the old body even if it fails to compile
+    // here, the function is then called natively.
+    functions[idx].Code.reset();
+    functions[idx].Calls = 0;
+    auto code = compile(fn);
+    if (code.isError())
+        return code.error();
+    functions[idx].Code = code.value();
+    return std::nullopt;
+}
+
+std::optional<Result<double, Error>> Interpreter::Run(FunctionAST *fn)
+{
+    ScopedPhase timer(Phase::Interpret, fn->Proto->getName().str());
+    auto code = compile(fn);
+    if (code.isError())
+        return std::nullopt;
+
+    trap.reset();
+    double v = execute(*code.value(), 0);
+    if (trap)
+        return Result<double, Error>(*trap);
+    return Result<double, Error>(v);
+}
+
+double Interpreter::execute(const BytecodeFunction &fn, size_t base)
+{
+    size_t top = base + fn.NumRegs;
+    if (stack.size() < top)
+        stack.resize(std::max(top, 2 * stack.size()));
+    double *regs = stack.data() + base;
+
+    const Instr *code = fn.Code.data();
+    size_t pc = 0;
+    while (true)
+    {
+        const Instr &in = code[pc++];
+        switch (in.op)
+        {
+        case Op::Const:
+            regs[in.a] = fn.Consts[in.b];
+            break;
+        case Op::Move:
+            regs[in.a] = regs[in.b];
+            break;
+        case Op::Add:
+            regs[in.a] = regs[in.b] + regs[in.c];
+            break;
+        case Op::Sub:
+            regs[in.a] = regs[in.b] - regs[in.c];
+            break;
+        case Op::Mul:
+            regs[in.a] = regs[in.b] * regs[in.c];
+            break;
+        case Op::Less:
+            // Unordered or less than, like the JIT's fcmp ult.
+            regs[in.a] = !(regs[in.b] >= regs[in.c]) ? 1.0 : 0.0;
+            break;
+        case Op::Jump:
+            pc = in.b;
+            break;
+        case Op::JumpIfZero:
+            // Ordered and not equal is true, like the JIT's fcmp one.
+            if (!(regs[in.a] < 0.0 || regs[in.a] > 0.0))
+                pc = in.b;
+            break;
+        case Op::Call:
+        {
+            double v = call(fn.Callees[in.b], base + in.c, top);
+            if (trap)
+                return 0.0;
+            // The call may have grown the stack.
+            regs = stack.data() + base;
+            regs[in.a] = v;
+            break;
+        }
+        case Op::Ret:
+            return regs[in.a];
+        }
+    }
+}
+
+double Interpreter::call(uint32_t idx, size_t args, size_t top)
+{
+    Function &f = functions[idx];
+    if (f.Code && !f.Native && f.Calls < HotThreshold)
+    {
+        f.Calls++;
+        NumInterpretedCalls++;
+        const BytecodeFunction &code = *f.Code;
+        if (stack.size() < top + code.NumRegs)
+            stack.resize(std::max(top + code.NumRegs, 2 * stack.size()));
+        std::copy_n(stack.begin() + args, code.NumArgs, stack.begin() + top);
+        return execute(code, top);
+    }
+
+    // Hot functions and functions without bytecode run natively.
+    NumNativeCalls++;
+    return callNative(f, stack.data() + args);
+}
+
+double Interpreter::callNative(Function &f, const double *a)
+{
+    if (!f.Native)
+        f.Native = resolve(f.Name);
+    if (!f.Native)
+    {
+        trap = Error("unknown function referenced");
+        return 0.0;
+    }
+
+    using D = double;
+    void *p = f.Native;
+    switch (f.NumArgs)
+    {
+    case 0:
+        return reinterpret_cast<D (*)()>(p)();
+    case 1:
+        return reinterpret_cast<D (*)(D)>(p)(a[0]);
+    case 2:
+        return reinterpret_cast<D (*)(D, D)>(p)(a[0], a[1]);
+    case 3:
+        return reinterpret_cast<D (*)(D, D, D)>(p)(a[0], a[1], a[2]);
+    case 4:
+        return reinterpret_cast<D (*)(D, D, D, D)>(p)(a[0], a[1], a[2], a[3]);
+    case 5:
+        return reinterpret_cast<D (*)(D, D, D, D, D)>(p)(a[0], a[1], a[2], a[3], a[4]);
+    case 6:
+        return reinterpret_cast<D (*)(D, D, D, D, D, D)>(p)(a[0], a[1], a[2], a[3], a[4], a[5]);
+    case 7:
+        return reinterpret_cast<D (*)(D, D, D, D, D, D, D)>(p)(a[0], a[1], a[2], a[3], a[4], a[5], a[6]);
+    case 8:
+        return reinterpret_cast<D (*)(D, D, D, D, D, D, D, D)>(p)(a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7]);
+    default:
+        trap = Error("too many arguments for a native call");
+        return 0.0;
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef __INTERPRETER_H__
+#define __INTERPRETER_H__
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "bytecode.h"
+#include "utils/error.h"
+#include "utils/result.h"
+#include "utils/symbol.h"
+
+class FunctionAST;
+
+// Interpreter runs functions compiled to a register-based bytecode. It is
+// meant for code that runs once, like top-level expressions, for which the
+// JIT would spend far more time compiling than running. A function called
+// often is handed to its native code instead, see HotThreshold.
+class Interpreter
+{
+public:
+    // NativeResolver returns the native code of a function, which takes
+    // doubles and returns a double, or nullptr if there is none.
+    using NativeResolver = std::function<void *(Symbol name)>;
+
+    explicit Interpreter(NativeResolver resolve) : resolve(std::move(resolve)) {}
+
+    // A function with bytecode is interpreted for its first HotThreshold
+    // calls, and runs natively after that.
+    size_t HotThreshold = 100;
+
+    // Native code is only called with up to MaxNativeArgs arguments, code
+    // with calls that take more is left to the JIT.
+    static constexpr size_t MaxNativeArgs = 8;
+
+    // Define compiles a function definition, so that calls to it can be
+    // interpreted. Functions without bytecode always run natively.
+    std::optional<Error> Define(FunctionAST *fn);
+
+    // Run compiles and runs a top-level expression. It returns nothing if
+    // the expression cannot be compiled to bytecode, e.g. if it needs too
+    // many registers, in which case it should be run by the JIT.
+    std::optional<Result<double, Error>> Run(FunctionAST *fn);
+
+    // The number of calls that were interpreted and that ran natively.
+    size_t NumInterpretedCalls = 0;
+    size_t NumNativeCalls = 0;
+
+private:
+    struct Function
+    {
+        Symbol Name;
+        size_t NumArgs;
+        std::unique_ptr<BytecodeFunction> Code;
+        size_t Calls = 0;
+        void *Native = nullptr;
+    };
+
+    NativeResolver resolve;
+
+    std::vector<Function> functions;
+    SymbolMap<size_t> functionIndex; // 1 + the index in functions
+
+    // The registers of all active frames.
+    std::vector<double> stack;
+
+    // trap is set when a call fails, which ends the run.
+    std::optional<Error> trap;
+
+    Result<std::unique_ptr<BytecodeFunction>, Error> compile(FunctionAST *fn);
+    Result<uint32_t, Error> findFunction(Symbol name, size_t numArgs);
+
+    double execute(const BytecodeFunction &fn, size_t base);
+    double call(uint32_t idx, size_t args, size_t top);
+    double callNative(Function &f, const double *args);
+};
+
+#endif
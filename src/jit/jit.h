@@ -13,24 +13,142 @@
 #ifndef LLVM_EXECUTIONENGINE_ORC_KALEIDOSCOPEJIT_H
 #define LLVM_EXECUTIONENGINE_ORC_KALEIDOSCOPEJIT_H
 
+#include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/StringRef.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/ExecutionEngine/JITEventListener.h"
 #include "llvm/ExecutionEngine/JITSymbol.h"
+#include "llvm/ExecutionEngine/Orc/CompileOnDemandLayer.h"
 #include "llvm/ExecutionEngine/Orc/CompileUtils.h"
 #include "llvm/ExecutionEngine/Orc/Core.h"
 #include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
 #include "llvm/ExecutionEngine/Orc/ExecutorProcessControl.h"
 #include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
+#include "llvm/ExecutionEngine/Orc/IRTransformLayer.h"
+#include "llvm/ExecutionEngine/Orc/IndirectionUtils.h"
+#include "llvm/ExecutionEngine/Orc/LazyReexports.h"
+#include "llvm/ExecutionEngine/Orc/Mangling.h"
 #include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/ExecutionEngine/Orc/ObjectLinkingLayer.h"
 #include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
 #include "llvm/ExecutionEngine/Orc/Shared/ExecutorSymbolDef.h"
+#include "llvm/ExecutionEngine/Orc/TaskDispatch.h"
 #include "llvm/ExecutionEngine/SectionMemoryManager.h"
 #include "llvm/IR/DataLayout.h"
+#include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/LLVMContext.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/raw_ostream.h"
+#include <atomic>
+#include <cstdlib>
+#include <functional>
+#include <list>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "object_cache.h"
+#include "perf_map.h"
+#include "slab_memory_manager.h"
+#include "utils/memory_usage.h"
+#include "utils/phase_timer.h"
 
 namespace llvm {
 namespace orc {
 
+struct KaleidoscopeJITOptions {
+  // Materialize modules on this many threads instead of on the thread that
+  // looks them up, 0 for the latter.
+  unsigned NumCompileThreads = 0;
+
+  // Compile every function on its first call, see KaleidoscopeJIT::addModule.
+  bool Lazy = false;
+
+  // Compile functions without optimization first, and recompile them with
+  // the optimizer in the background once they have been called
+  // TierUpThreshold times, see KaleidoscopeJIT::addTieredModule.
+  // Ignored in lazy mode.
+  bool Tiered = false;
+  uint64_t TierUpThreshold = 1000;
+
+  // Let functions be defined again, replacing their code for every caller,
+  // see KaleidoscopeJIT::addRedefinableModule. Ignored in lazy and tiered
+  // mode.
+  bool Redefinable = false;
+
+  // Keep the objects of recently called functions within CodeBudget bytes,
+  // if not 0, evicting the code of the others, which is compiled again from
+  // its IR on the next call, see KaleidoscopeJIT::evictColdCode. Ignored in
+  // lazy and tiered mode.
+  size_t CodeBudget = 0;
+
+  // Keep compiled objects in CacheDir, if set, and load them from there
+  // instead of compiling the same IR again, see DiskObjectCache.
+  std::string CacheDir;
+  uint64_t CacheMaxBytes = DiskObjectCache::DefaultMaxBytes;
+
+  // Name the code of every function, top-level expressions included, for
+  // profilers and debuggers: in a perf map at PerfMapPath, if set, see
+  // PerfMapListener; in a jitdump file for `perf inject`, which LLVM must
+  // be built with perf support for; and to GDB's JIT interface.
+  std::string PerfMapPath;
+  bool JITDump = false;
+  bool GDBRegistration = false;
+
+  // Link objects with JITLink instead of RuntimeDyld, into slabs of
+  // SlabSize bytes that many functions share, see SlabMemoryManager.
+  // HugePages asks for the slabs to be backed by transparent huge pages.
+  // JITDump and GDBRegistration need RuntimeDyld.
+  bool JITLink = false;
+  size_t SlabSize = SlabMemoryManager::DefaultSlabSize;
+  bool HugePages = false;
+
+  // Whether a JIT created with these options is tiered.
+  bool isTiered() const { return Tiered && !Lazy && TierUpThreshold > 0; }
+
+  // Whether a JIT created with these options lets functions be redefined.
+  bool isRedefinable() const { return Redefinable && !Lazy && !isTiered(); }
+
+  // Whether a JIT created with these options keeps its code within a budget.
+  bool hasCodeBudget() const { return CodeBudget > 0 && !Lazy && !isTiered(); }
+};
+
+// TimedIRCompiler attributes the time of the code generator to the Compile
+// phase, and to the first function defined by the module, and tells
+// OnCompiled the size of the object made for that function.
+class TimedIRCompiler : public IRCompileLayer::IRCompiler {
+public:
+  using CompiledFunction = std::function<void(StringRef Name, size_t Bytes)>;
+
+  TimedIRCompiler(JITTargetMachineBuilder JTMB, ObjectCache *Cache,
+                  CompiledFunction OnCompiled = nullptr)
+      : IRCompiler(irManglingOptionsFromTargetOptions(JTMB.getOptions())),
+        Compile(std::move(JTMB), Cache), OnCompiled(std::move(OnCompiled)) {}
+
+  Expected<std::unique_ptr<MemoryBuffer>> operator()(Module &M) override {
+    StringRef Name;
+    for (Function &F : M)
+      if (!F.isDeclaration() && !F.hasAvailableExternallyLinkage()) {
+        Name = F.getName();
+        break;
+      }
+    auto Obj = [&]() {
+      ScopedPhase Timer(Phase::Compile,
+                        std::string_view(Name.data(), Name.size()));
+      return Compile(M);
+    }();
+    if (Obj && OnCompiled)
+      OnCompiled(Name, (*Obj)->getBufferSize());
+    return Obj;
+  }
+
+private:
+  ConcurrentIRCompiler Compile;
+  CompiledFunction OnCompiled;
+};
+
 class KaleidoscopeJIT {
 private:
   std::unique_ptr<ExecutionSession> ES;
@@ -38,26 +156,414 @@ private:
   DataLayout DL;
   MangleAndInterner Mangle;
 
-  RTDyldObjectLinkingLayer ObjectLayer;
+  std::unique_ptr<DiskObjectCache> Cache;
+  std::unique_ptr<PerfMapListener> PerfMap;
+
+  // A RTDyldObjectLinkingLayer, or an ObjectLinkingLayer owning Slabs.
+  std::unique_ptr<ObjectLayer> ObjLayer;
+  SlabMemoryManager *Slabs = nullptr;
   IRCompileLayer CompileLayer;
 
+  // Lazy mode: CODLayer -> OptimizeLayer -> CompileLayer.
+  IRTransformLayer OptimizeLayer;
+  std::unique_ptr<LazyCallThroughManager> LCTMgr;
+  std::unique_ptr<CompileOnDemandLayer> CODLayer;
+
+  std::function<void(Module &)> Optimize;
+  std::atomic<size_t> NumLazyFunctions{0};
+  std::atomic<size_t> NumMaterializedFunctions{0};
+
+  // Tiered mode: every function is called through a stub, which points at
+  // its baseline code first and at its optimized code once it is hot.
+  enum class Tier { Baseline, Optimizing, Optimized };
+  struct TierState {
+    KaleidoscopeJIT *JIT;
+    std::string Name;
+    // The unoptimized IR of the module defining the function.
+    std::shared_ptr<const std::string> Bitcode;
+    // The calls counted by the baseline code.
+    std::atomic<uint64_t> Calls{0};
+    // Guarded by TierMutex. A function that fails to tier up stays
+    // Optimizing.
+    Tier Current = Tier::Baseline;
+  };
+
+  // Optimized code calls the optimized code of its callees directly. A
+  // callee called at least half as often as needed to tier up is optimized
+  // before its caller for that, down to this depth of calls.
+  static constexpr unsigned MaxTierUpDepth = 4;
+
+  uint64_t TierUpThreshold = 0;
+  std::unique_ptr<IndirectStubsManager> TierStubs;
+  std::mutex TierMutex;
+  StringMap<std::unique_ptr<TierState>> TierStates;
+  std::atomic<size_t> NumTieredFunctions{0};
+  std::atomic<size_t> NumTieredUpFunctions{0};
+
+  // Redefinable mode, and with a code budget: every function is called
+  // through a stub, which points at its latest definition. Each module has a
+  // tracker of its own, and is removed once none of the functions it
+  // defines is current.
+  struct DefiningModule {
+    ResourceTrackerSP RT;
+    size_t NumCurrent = 0;
+    std::vector<std::string> Names;
+    std::vector<std::string> Bodies;
+    // The trampolines that compile the bodies, which the stubs point at
+    // until then, and again once the module is evicted.
+    std::vector<ExecutorAddr> Trampolines;
+    // The bytes of its object while it is loaded, and its place in Loaded.
+    size_t CodeBytes = 0;
+    std::list<std::shared_ptr<DefiningModule>>::iterator Slot;
+    // With a code budget: its IR and the symbols it defines, to compile it
+    // again once evicted, and whether its code ran since evictColdCode
+    // last looked at it.
+    std::string Bitcode;
+    SymbolFlagsMap Symbols;
+    bool Evicted = false;
+    std::atomic<uint8_t> Used{0};
+  };
+
+  // Compiles an evicted module again from its IR, once one of its functions
+  // is called.
+  class ReloadMaterializationUnit : public MaterializationUnit {
+  public:
+    ReloadMaterializationUnit(KaleidoscopeJIT &J,
+                              std::shared_ptr<DefiningModule> D)
+        : MaterializationUnit(Interface(D->Symbols, nullptr)), J(J),
+          D(std::move(D)) {}
+
+    StringRef getName() const override { return "ReloadMaterializationUnit"; }
+
+    void materialize(std::unique_ptr<MaterializationResponsibility> R) override {
+      auto Ctx = std::make_unique<LLVMContext>();
+      auto M = parseBitcodeFile(MemoryBufferRef(D->Bitcode, D->Bodies[0]), *Ctx);
+      if (!M) {
+        J.ES->reportError(M.takeError());
+        R->failMaterialization();
+        return;
+      }
+      J.pointStubsAtBodies(D);
+      J.CompileLayer.emit(std::move(R),
+                          ThreadSafeModule(std::move(*M), std::move(Ctx)));
+    }
+
+  private:
+    KaleidoscopeJIT &J;
+    std::shared_ptr<DefiningModule> D;
+
+    void discard(const JITDylib &JD, const SymbolStringPtr &Name) override {}
+  };
+
+  bool Redefinable = false;
+  std::unique_ptr<IndirectStubsManager> RedefStubs;
+  std::mutex RedefMutex;
+  StringMap<std::shared_ptr<DefiningModule>> Definitions;
+  StringMap<unsigned> Versions;
+  std::atomic<size_t> NumRedefinitions{0};
+
+  // The modules behind stubs by their first body, and those whose code is
+  // loaded in the order evictColdCode looks at them, with the bytes of
+  // their objects.
+  size_t CodeBudget = 0;
+  StringMap<std::shared_ptr<DefiningModule>> ModulesByBody;
+  std::list<std::shared_ptr<DefiningModule>> Loaded;
+  size_t LoadedBytes = 0;
+  std::atomic<size_t> NumEvictions{0};
+  std::atomic<size_t> NumReloads{0};
+
   JITDylib &MainJD;
 
+  static void handleLazyCallThroughError() {
+    errs() << "LazyCallThrough error: Could not find function body";
+    exit(1);
+  }
+
+  // Called by baseline code when its function turns hot.
+  static void handleTierUp(uint64_t State) {
+    auto *S = reinterpret_cast<TierState *>(State);
+    S->JIT->ES->dispatchTask(makeGenericNamedTask(
+        [S]() { S->JIT->tierUp(*S); }, "tier-up"));
+  }
+
+  // Renames the body of Name to Body, and makes the calls to Name,
+  // including recursive ones, go through a declaration that the stub of
+  // Name will define, so that they reach whatever code the stub points at.
+  static void moveBehindStub(Module &M, const std::string &Name,
+                             const std::string &Body) {
+    Function *F = M.getFunction(Name);
+    F->setName(Body);
+    Function *Decl = Function::Create(F->getFunctionType(),
+                                      Function::ExternalLinkage, Name, M);
+    F->replaceAllUsesWith(Decl);
+  }
+
+  // Counts the calls to F in S and calls handleTierUp(S) on the
+  // TierUpThreshold-th one.
+  void addCallCounter(Function &F, TierState *S) {
+    Module &M = *F.getParent();
+    LLVMContext &Ctx = M.getContext();
+    Type *I64 = Type::getInt64Ty(Ctx);
+    Constant *Calls = ConstantExpr::getIntToPtr(
+        ConstantInt::get(I64, reinterpret_cast<uint64_t>(&S->Calls)),
+        PointerType::getUnqual(I64));
+
+    BasicBlock *Body = &F.getEntryBlock();
+    BasicBlock *Entry = BasicBlock::Create(Ctx, "tier.entry", &F, Body);
+    BasicBlock *Up = BasicBlock::Create(Ctx, "tier.up", &F, Body);
+
+    IRBuilder<> B(Entry);
+    Value *Old = B.CreateAtomicRMW(AtomicRMWInst::Add, Calls,
+                                   ConstantInt::get(I64, 1), MaybeAlign(8),
+                                   AtomicOrdering::Monotonic);
+    B.CreateCondBr(
+        B.CreateICmpEQ(Old, ConstantInt::get(I64, TierUpThreshold - 1)), Up,
+        Body);
+
+    B.SetInsertPoint(Up);
+    FunctionCallee Hook = M.getOrInsertFunction(
+        "__kaleido_tier_up", Type::getVoidTy(Ctx), I64);
+    B.CreateCall(Hook, ConstantInt::get(I64, reinterpret_cast<uint64_t>(S)));
+    B.CreateBr(Body);
+  }
+
+  // Recompiles the function of S with the optimizer and points its stub at
+  // the new code. Runs on the session's dispatcher.
+  void tierUp(TierState &S, unsigned Depth = 0) {
+    {
+      std::lock_guard<std::mutex> Lock(TierMutex);
+      if (S.Current != Tier::Baseline)
+        return;
+      S.Current = Tier::Optimizing;
+    }
+
+    auto Ctx = std::make_unique<LLVMContext>();
+    auto M = parseBitcodeFile(MemoryBufferRef(*S.Bitcode, S.Name), *Ctx);
+    if (!M) {
+      ES->reportError(M.takeError());
+      return;
+    }
+
+    // The other functions of the module keep their own stubs. Recursive
+    // calls go straight to the new code.
+    for (Function &F : **M)
+      if (!F.isDeclaration() && F.getName() != S.Name)
+        F.deleteBody();
+
+    // Callees that are almost hot too are optimized first, rather than
+    // after this function, which would then reach them through their stubs.
+    std::vector<TierState *> Callees;
+    {
+      std::lock_guard<std::mutex> Lock(TierMutex);
+      for (Function &F : **M) {
+        auto It = TierStates.find(F.getName());
+        if (F.isDeclaration() && It != TierStates.end())
+          Callees.push_back(It->second.get());
+      }
+    }
+    if (Depth < MaxTierUpDepth)
+      for (TierState *C : Callees)
+        if (C->Calls >= TierUpThreshold / 2)
+          tierUp(*C, Depth + 1);
+
+    if (Optimize)
+      Optimize(**M);
+    (*M)->getFunction(S.Name)->setName(S.Name + "$tier1");
+
+    // Calls to callees that are optimized go straight to their code, the
+    // others through their stubs.
+    {
+      std::lock_guard<std::mutex> Lock(TierMutex);
+      for (TierState *C : Callees)
+        if (C->Current == Tier::Optimized)
+          if (Function *F = (*M)->getFunction(C->Name))
+            F->setName(C->Name + "$tier1");
+    }
+
+    if (auto Err = CompileLayer.add(
+            MainJD, ThreadSafeModule(std::move(*M), std::move(Ctx)))) {
+      ES->reportError(std::move(Err));
+      return;
+    }
+    auto Sym = lookup(S.Name + "$tier1");
+    if (!Sym) {
+      ES->reportError(Sym.takeError());
+      return;
+    }
+    if (auto Err = TierStubs->updatePointer(S.Name, Sym->getAddress())) {
+      ES->reportError(std::move(Err));
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> Lock(TierMutex);
+      S.Current = Tier::Optimized;
+    }
+    ++NumTieredUpFunctions;
+  }
+
+  Expected<ThreadSafeModule> optimizeModule(ThreadSafeModule TSM,
+                                            MaterializationResponsibility &R) {
+    TSM.withModuleDo([this](Module &M) {
+      for (Function &F : M)
+        if (!F.isDeclaration())
+          ++NumMaterializedFunctions;
+      if (Optimize)
+        Optimize(M);
+    });
+    return std::move(TSM);
+  }
+
+  // Accounts for the object compiled for the module whose first function
+  // is Name, and counts it as loaded if the module is behind stubs.
+  void notifyCompiled(StringRef Name, size_t Bytes) {
+    // Top-level expressions are removed as soon as they ran.
+    if (Name == "__main__")
+      return;
+    StringRef Function = Name.split('$').first;
+    MemoryAccounting::Add(std::string_view(Function.data(), Function.size()),
+                          MemoryKind::Code, Bytes);
+    if (!RedefStubs)
+      return;
+
+    std::lock_guard<std::mutex> Lock(RedefMutex);
+    auto It = ModulesByBody.find(Name);
+    if (It == ModulesByBody.end())
+      return;
+    DefiningModule &D = *It->second;
+    D.CodeBytes = Bytes;
+    D.Slot = Loaded.insert(Loaded.end(), It->second);
+    LoadedBytes += Bytes;
+    if (D.Evicted) {
+      D.Evicted = false;
+      ++NumReloads;
+    }
+  }
+
+  // Prepares the module of D to be evicted and compiled again: every call
+  // to one of its functions marks D as used, and its IR and the symbols it
+  // defines are kept.
+  void keepForReload(Module &M, DefiningModule &D) {
+    for (const std::string &Body : D.Bodies) {
+      Function &F = *M.getFunction(Body);
+      IRBuilder<> B(&*F.getEntryBlock().getFirstInsertionPt());
+      Value *Used = B.CreateIntToPtr(
+          B.getInt64(reinterpret_cast<uint64_t>(&D.Used)), B.getPtrTy());
+      B.CreateAlignedStore(B.getInt8(1), Used, MaybeAlign(1))
+          ->setAtomic(AtomicOrdering::Monotonic);
+    }
+    // The marks embed addresses of this process.
+    M.getOrInsertNamedMetadata(DiskObjectCache::NoCacheMetadata);
+
+    for (GlobalValue &G : M.global_values())
+      if (!G.isDeclaration() && !G.hasLocalLinkage() &&
+          !G.hasAvailableExternallyLinkage())
+        D.Symbols[Mangle(G.getName())] = JITSymbolFlags::fromGlobalValue(G);
+    raw_string_ostream OS(D.Bitcode);
+    WriteBitcodeToFile(M, OS);
+    OS.flush();
+    MemoryAccounting::Add(D.Names[0], MemoryKind::IR, D.Bitcode.size());
+  }
+
+  // Takes the object of D off the loaded code. RedefMutex must be held.
+  void unloadCode(DefiningModule &D) {
+    if (D.CodeBytes == 0)
+      return;
+    Loaded.erase(D.Slot);
+    LoadedBytes -= D.CodeBytes;
+    MemoryAccounting::Add(D.Names[0], MemoryKind::Code,
+                          -static_cast<ptrdiff_t>(D.CodeBytes));
+    D.CodeBytes = 0;
+  }
+
+  // Forgets D once none of its functions is current. RedefMutex must be
+  // held.
+  void retire(DefiningModule &D) {
+    unloadCode(D);
+    ModulesByBody.erase(D.Bodies[0]);
+    MemoryAccounting::Add(D.Names[0], MemoryKind::IR,
+                          -static_cast<ptrdiff_t>(D.Bitcode.size()));
+    std::string().swap(D.Bitcode);
+  }
+
+  // Returns a trampoline that looks up Body, which compiles it, and then
+  // points the stub of Name at it.
+  Expected<ExecutorAddr> createTrampoline(JITDylib &JD,
+                                          const std::string &Name,
+                                          const std::string &Body) {
+    return LCTMgr->getCallThroughTrampoline(
+        JD, Mangle(Body), [this, Name](ExecutorAddr Addr) {
+          return RedefStubs->updatePointer(Name, Addr);
+        });
+  }
+
+  // Points the stubs of the current functions of D at its bodies once they
+  // are compiled again. A trampoline only does so on its first call, so
+  // those of an evicted module leave that to this.
+  void pointStubsAtBodies(std::shared_ptr<DefiningModule> D) {
+    SymbolLookupSet Bodies;
+    for (const std::string &Body : D->Bodies)
+      Bodies.add(Mangle(Body));
+    ES->lookup(
+        LookupKind::Static, makeJITDylibSearchOrder(&D->RT->getJITDylib()),
+        std::move(Bodies), SymbolState::Ready,
+        [this, D](Expected<SymbolMap> Result) {
+          if (!Result) {
+            ES->reportError(Result.takeError());
+            return;
+          }
+          std::lock_guard<std::mutex> Lock(RedefMutex);
+          for (size_t I = 0; I < D->Names.size(); ++I) {
+            if (Definitions.lookup(D->Names[I]) != D)
+              continue;
+            auto Addr = (*Result)[Mangle(D->Bodies[I])].getAddress();
+            if (auto Err = RedefStubs->updatePointer(D->Names[I], Addr))
+              ES->reportError(std::move(Err));
+          }
+        },
+        NoDependenciesToRegister);
+  }
+
 public:
   KaleidoscopeJIT(std::unique_ptr<ExecutionSession> ES,
-                  JITTargetMachineBuilder JTMB, DataLayout DL)
+                  JITTargetMachineBuilder JTMB, DataLayout DL,
+                  std::unique_ptr<ObjectLayer> ObjLayer,
+                  std::unique_ptr<LazyCallThroughManager> LCTMgr = nullptr,
+                  uint64_t TierUpThreshold = 0,
+                  std::unique_ptr<DiskObjectCache> Cache = nullptr,
+                  bool Redefinable = false, size_t CodeBudget = 0)
       : ES(std::move(ES)), DL(std::move(DL)), Mangle(*this->ES, this->DL),
-        ObjectLayer(*this->ES,
-                    []() { return std::make_unique<SectionMemoryManager>(); }),
-        CompileLayer(*this->ES, ObjectLayer,
-                     std::make_unique<ConcurrentIRCompiler>(std::move(JTMB))),
+        Cache(std::move(Cache)), ObjLayer(std::move(ObjLayer)),
+        CompileLayer(*this->ES, *this->ObjLayer,
+                     std::make_unique<TimedIRCompiler>(
+                         std::move(JTMB), this->Cache.get(),
+                         [this](StringRef Name, size_t Bytes) {
+                           notifyCompiled(Name, Bytes);
+                         })),
+        OptimizeLayer(*this->ES, CompileLayer,
+                      [this](ThreadSafeModule TSM,
+                             MaterializationResponsibility &R) {
+                        return optimizeModule(std::move(TSM), R);
+                      }),
+        LCTMgr(std::move(LCTMgr)), TierUpThreshold(TierUpThreshold),
+        Redefinable(Redefinable), CodeBudget(CodeBudget),
         MainJD(this->ES->createBareJITDylib("<main>")) {
+    const Triple &TT = this->ES->getExecutorProcessControl().getTargetTriple();
     MainJD.addGenerator(
         cantFail(DynamicLibrarySearchGenerator::GetForCurrentProcess(
-            DL.getGlobalPrefix())));
-    if (JTMB.getTargetTriple().isOSBinFormatCOFF()) {
-      ObjectLayer.setOverrideObjectFlagsWithResponsibilityFlags(true);
-      ObjectLayer.setAutoClaimResponsibilityForObjectSymbols(true);
+            this->DL.getGlobalPrefix())));
+    if (Redefinable || CodeBudget > 0)
+      RedefStubs = createLocalIndirectStubsManagerBuilder(TT)();
+    else if (this->LCTMgr && TierUpThreshold == 0)
+      CODLayer = std::make_unique<CompileOnDemandLayer>(
+          *this->ES, OptimizeLayer, *this->LCTMgr,
+          createLocalIndirectStubsManagerBuilder(TT));
+    if (TierUpThreshold > 0) {
+      TierStubs = createLocalIndirectStubsManagerBuilder(TT)();
+      cantFail(MainJD.define(absoluteSymbols(
+          {{Mangle("__kaleido_tier_up"),
+            ExecutorSymbolDef(ExecutorAddr::fromPtr(&handleTierUp),
+                              JITSymbolFlags::Exported |
+                                  JITSymbolFlags::Callable)}})));
     }
   }
 
@@ -66,8 +572,28 @@ public:
       ES->reportError(std::move(Err));
   }
 
-  static Expected<std::unique_ptr<KaleidoscopeJIT>> Create() {
-    auto EPC = SelfExecutorProcessControl::Create();
+  static Expected<std::unique_ptr<KaleidoscopeJIT>>
+  Create(const KaleidoscopeJITOptions &Opts = KaleidoscopeJITOptions()) {
+    bool Tiered = Opts.isTiered();
+    bool Redefinable = Opts.isRedefinable();
+    size_t CodeBudget = Opts.hasCodeBudget() ? Opts.CodeBudget : 0;
+
+    // Tiered mode recompiles hot functions on the dispatcher's threads.
+    unsigned NumThreads = Opts.NumCompileThreads;
+    if (Tiered && NumThreads == 0)
+      NumThreads = 1;
+
+    std::unique_ptr<TaskDispatcher> D;
+    if (NumThreads > 0)
+#if LLVM_VERSION_MAJOR >= 20
+      D = std::make_unique<DynamicThreadPoolTaskDispatcher>(NumThreads);
+#else
+      D = std::make_unique<DynamicThreadPoolTaskDispatcher>();
+#endif
+    else
+      D = std::make_unique<InPlaceTaskDispatcher>();
+
+    auto EPC = SelfExecutorProcessControl::Create(nullptr, std::move(D));
     if (!EPC)
       return EPC.takeError();
 
@@ -80,26 +606,412 @@ public:
     if (!DL)
       return DL.takeError();
 
-    return std::make_unique<KaleidoscopeJIT>(std::move(ES), std::move(JTMB),
-                                             std::move(*DL));
+    // The bitcode of a module is hashed together with everything else that
+    // the code generated from it depends on. The code generator itself
+    // always runs with its default options.
+    std::unique_ptr<DiskObjectCache> Cache;
+    if (!Opts.CacheDir.empty()) {
+      std::string Salt = std::string(LLVM_VERSION_STRING) + " " +
+                         JTMB.getTargetTriple().str() + " " + JTMB.getCPU() +
+                         " " + JTMB.getFeatures().getString();
+      auto C = DiskObjectCache::Open(Opts.CacheDir, Opts.CacheMaxBytes, Salt);
+      if (C.isError())
+        return createStringError(inconvertibleErrorCode(),
+                                 C.error().message);
+      Cache = C.value();
+    }
+
+    // RuntimeDyld maps the sections of every object on pages of their own,
+    // JITLink packs them into the slabs of a SlabMemoryManager.
+    std::unique_ptr<ObjectLayer> ObjLayer;
+    RTDyldObjectLinkingLayer *RTDyldLayer = nullptr;
+    ObjectLinkingLayer *LinkingLayer = nullptr;
+    SlabMemoryManager *Slabs = nullptr;
+    if (Opts.JITLink) {
+      if (Opts.JITDump || Opts.GDBRegistration)
+        return createStringError(
+            inconvertibleErrorCode(),
+            "jitdump files and GDB registration need RuntimeDyld");
+      auto M = SlabMemoryManager::Create(Opts.SlabSize, Opts.HugePages);
+      if (M.isError())
+        return createStringError(inconvertibleErrorCode(),
+                                 M.error().message);
+      std::unique_ptr<SlabMemoryManager> MemMgr = M.value();
+      Slabs = MemMgr.get();
+      auto L = std::make_unique<ObjectLinkingLayer>(*ES, std::move(MemMgr));
+      LinkingLayer = L.get();
+      ObjLayer = std::move(L);
+    } else {
+      auto L = std::make_unique<RTDyldObjectLinkingLayer>(
+          *ES, []() { return std::make_unique<SectionMemoryManager>(); });
+      if (JTMB.getTargetTriple().isOSBinFormatCOFF()) {
+        L->setOverrideObjectFlagsWithResponsibilityFlags(true);
+        L->setAutoClaimResponsibilityForObjectSymbols(true);
+      }
+      RTDyldLayer = L.get();
+      ObjLayer = std::move(L);
+    }
+
+    // Calls to functions that are not compiled yet go through stubs that
+    // jump back into the JIT via this manager.
+    std::unique_ptr<LazyCallThroughManager> LCTMgr;
+    if (Opts.Lazy || Tiered || Redefinable || CodeBudget > 0) {
+      auto M = createLocalLazyCallThroughManager(
+          JTMB.getTargetTriple(), *ES,
+          ExecutorAddr::fromPtr(&handleLazyCallThroughError));
+      if (!M)
+        return M.takeError();
+      LCTMgr = std::move(*M);
+    }
+
+    auto J = std::make_unique<KaleidoscopeJIT>(
+        std::move(ES), std::move(JTMB), std::move(*DL), std::move(ObjLayer),
+        std::move(LCTMgr), Tiered ? Opts.TierUpThreshold : 0, std::move(Cache),
+        Redefinable, CodeBudget);
+    J->Slabs = Slabs;
+
+    if (!Opts.PerfMapPath.empty()) {
+      auto P = PerfMapListener::Open(Opts.PerfMapPath);
+      if (P.isError())
+        return createStringError(inconvertibleErrorCode(),
+                                 P.error().message);
+      J->PerfMap = P.value();
+      if (RTDyldLayer)
+        RTDyldLayer->registerJITEventListener(*J->PerfMap);
+      else
+        LinkingLayer->addPlugin(J->PerfMap->Plugin());
+    }
+    if (Opts.JITDump) {
+      JITEventListener *L = JITEventListener::createPerfJITEventListener();
+      if (!L)
+        return createStringError(inconvertibleErrorCode(),
+                                 "LLVM was built without perf support");
+      RTDyldLayer->registerJITEventListener(*L);
+    }
+    if (Opts.GDBRegistration)
+      RTDyldLayer->registerJITEventListener(
+          *JITEventListener::createGDBRegistrationListener());
+    return std::move(J);
   }
 
   const DataLayout &getDataLayout() const { return DL; }
 
   JITDylib &getMainJITDylib() { return MainJD; }
 
+  bool isLazy() const { return CODLayer != nullptr; }
+
+  bool isTiered() const { return TierStubs != nullptr; }
+
+  bool isRedefinable() const { return Redefinable; }
+
+  bool hasCodeBudget() const { return CodeBudget > 0; }
+
+  // The object cache, if any.
+  const DiskObjectCache *getObjectCache() const { return Cache.get(); }
+
+  // The memory manager of JITLink, if the JIT links with it.
+  const SlabMemoryManager *getSlabMemoryManager() const { return Slabs; }
+
+  // setOptimizer sets how functions are optimized in lazy mode, right before
+  // they are compiled, and in tiered mode, once they are hot.
+  void setOptimizer(std::function<void(Module &)> F) { Optimize = std::move(F); }
+
+  // In lazy mode, the functions defined by a module are compiled one by one
+  // on their first call. In tiered mode, see addTieredModule, and in
+  // redefinable mode or with a code budget, see addRedefinableModule.
+  // Otherwise the whole module is compiled as soon as one of its symbols is
+  // looked up.
   Error addModule(ThreadSafeModule TSM, ResourceTrackerSP RT = nullptr) {
+    if (!RT)
+      RT = MainJD.getDefaultResourceTracker();
+    if (RedefStubs)
+      return addRedefinableModule(std::move(TSM), RT->getJITDylib());
+    if (TierStubs)
+      return addTieredModule(std::move(TSM), RT);
+    if (!CODLayer)
+      return CompileLayer.add(RT, std::move(TSM));
+    TSM.withModuleDo([this](Module &M) {
+      for (Function &F : M)
+        if (!F.isDeclaration())
+          ++NumLazyFunctions;
+    });
+    return CODLayer->add(RT, std::move(TSM));
+  }
+
+  // addTieredModule adds the module without optimization, with a call
+  // counter in every function. Callers reach each function through a stub,
+  // which compiles the module on the first call, and is pointed at
+  // optimized code by a background task once the function has been called
+  // TierUpThreshold times.
+  Error addTieredModule(ThreadSafeModule TSM, ResourceTrackerSP RT) {
+    std::vector<std::string> Names;
+    std::string Duplicate;
+    TSM.withModuleDo([&](Module &M) {
+      for (Function &F : M)
+        if (!F.isDeclaration() && !F.hasAvailableExternallyLinkage())
+          Names.push_back(F.getName().str());
+
+      // The state of a function defined before is still used by its code,
+      // and possibly by a tier-up task.
+      std::lock_guard<std::mutex> Lock(TierMutex);
+      for (const std::string &Name : Names) {
+        if (TierStates.count(Name)) {
+          Duplicate = Name;
+          return;
+        }
+      }
+
+      auto Bitcode = std::make_shared<std::string>();
+      raw_string_ostream OS(*Bitcode);
+      WriteBitcodeToFile(M, OS);
+      OS.flush();
+
+      // The call counters embed addresses of this process.
+      M.getOrInsertNamedMetadata(DiskObjectCache::NoCacheMetadata);
+
+      if (!Names.empty())
+        MemoryAccounting::Add(Names[0], MemoryKind::IR, Bitcode->size());
+
+      for (const std::string &Name : Names) {
+        auto &S = TierStates[Name];
+        S = std::make_unique<TierState>();
+        S->JIT = this;
+        S->Name = Name;
+        S->Bitcode = Bitcode;
+        addCallCounter(*M.getFunction(Name), S.get());
+        moveBehindStub(M, Name, Name + "$tier0");
+      }
+    });
+    if (!Duplicate.empty())
+      return make_error<DuplicateDefinition>((*Mangle(Duplicate)).str());
+    NumTieredFunctions += Names.size();
+    if (Names.empty())
+      return CompileLayer.add(RT, std::move(TSM));
+
+    JITDylib &JD = RT->getJITDylib();
+    if (auto Err = CompileLayer.add(RT, std::move(TSM)))
+      return Err;
+
+    // Each stub starts at a trampoline that looks up the baseline code,
+    // which compiles it, and then points the stub at it.
+    IndirectStubsManager::StubInitsMap Inits;
+    for (const std::string &Name : Names) {
+      auto Trampoline = LCTMgr->getCallThroughTrampoline(
+          JD, Mangle(Name + "$tier0"), [this, Name](ExecutorAddr Addr) {
+            return TierStubs->updatePointer(Name, Addr);
+          });
+      if (!Trampoline)
+        return Trampoline.takeError();
+      Inits[Name] = {*Trampoline,
+                     JITSymbolFlags::Exported | JITSymbolFlags::Callable};
+    }
+    if (auto Err = TierStubs->createStubs(Inits))
+      return Err;
+
+    SymbolMap Stubs;
+    for (const std::string &Name : Names)
+      Stubs[Mangle(Name)] = TierStubs->findStub(Name, true);
+    return JD.define(absoluteSymbols(std::move(Stubs)), RT);
+  }
+
+  // addRedefinableModule adds the module under a tracker of its own, with
+  // the body of every function it defines renamed to Name$v<n> for its
+  // n-th definition. Callers reach each function through a stub, which
+  // compiles the module on the first call. A later definition points the
+  // stub at the new body instead, so that code compiled earlier calls it
+  // too, and the module of the old body is removed once none of its
+  // functions is current. The caller must make sure that the old code is
+  // not running. With a code budget but without redefinable mode, a
+  // function defined again is an error like in the other modes.
+  Error addRedefinableModule(ThreadSafeModule TSM, JITDylib &JD) {
+    auto Defining = std::make_shared<DefiningModule>();
+    std::vector<std::string> &Names = Defining->Names;
+    std::vector<std::string> &Bodies = Defining->Bodies;
+    std::string Duplicate;
+    TSM.withModuleDo([&](Module &M) {
+      for (Function &F : M)
+        if (!F.isDeclaration() && !F.hasAvailableExternallyLinkage())
+          Names.push_back(F.getName().str());
+
+      {
+        std::lock_guard<std::mutex> Lock(RedefMutex);
+        for (const std::string &Name : Names) {
+          if (!Redefinable && Definitions.count(Name)) {
+            Duplicate = Name;
+            return;
+          }
+          Bodies.push_back(Name + "$v" + std::to_string(++Versions[Name]));
+          moveBehindStub(M, Name, Bodies.back());
+        }
+      }
+      if (CodeBudget > 0 && !Names.empty())
+        keepForReload(M, *Defining);
+    });
+    if (!Duplicate.empty())
+      return make_error<DuplicateDefinition>((*Mangle(Duplicate)).str());
+
+    ResourceTrackerSP RT = JD.createResourceTracker();
+    if (auto Err = CompileLayer.add(RT, std::move(TSM)))
+      return Err;
+
+    Defining->RT = RT;
+    Defining->NumCurrent = Names.size();
+    IndirectStubsManager::StubInitsMap Inits;
+    std::vector<ResourceTrackerSP> Unused;
+    {
+      std::lock_guard<std::mutex> Lock(RedefMutex);
+      if (!Names.empty())
+        ModulesByBody[Bodies[0]] = Defining;
+      for (size_t I = 0; I < Names.size(); ++I) {
+        const std::string &Name = Names[I];
+        auto Trampoline = createTrampoline(JD, Name, Bodies[I]);
+        if (!Trampoline)
+          return Trampoline.takeError();
+        Defining->Trampolines.push_back(*Trampoline);
+
+        std::shared_ptr<DefiningModule> &Current = Definitions[Name];
+        if (!Current) {
+          Inits[Name] = {*Trampoline,
+                         JITSymbolFlags::Exported | JITSymbolFlags::Callable};
+        } else {
+          if (auto Err = RedefStubs->updatePointer(Name, *Trampoline))
+            return Err;
+          ++NumRedefinitions;
+          if (--Current->NumCurrent == 0) {
+            retire(*Current);
+            Unused.push_back(Current->RT);
+          }
+        }
+        Current = Defining;
+      }
+    }
+
+    // The stubs outlive the modules, under the default tracker.
+    if (!Inits.empty()) {
+      if (auto Err = RedefStubs->createStubs(Inits))
+        return Err;
+      SymbolMap Stubs;
+      for (const auto &Init : Inits)
+        Stubs[Mangle(Init.getKey().str())] =
+            RedefStubs->findStub(Init.getKey(), true);
+      if (auto Err = JD.define(absoluteSymbols(std::move(Stubs))))
+        return Err;
+    }
+    for (ResourceTrackerSP &Old : Unused)
+      if (auto Err = Old->remove())
+        return Err;
+    return Error::success();
+  }
+
+  // evictColdCode evicts the code of modules added by addRedefinableModule
+  // until the objects of the others take no more than the code budget. It
+  // approximates least recently used eviction with a clock: modules are
+  // looked at in the order they were loaded, and one whose code ran since
+  // it was last looked at is passed over once. An evicted module is defined
+  // again by its IR, and the stubs of its current functions point at their
+  // trampolines again, which compile it on the next call. The caller must
+  // make sure that no code of the JIT is running.
+  Error evictColdCode() {
+    if (CodeBudget == 0)
+      return Error::success();
+
+    std::vector<std::shared_ptr<DefiningModule>> Cold;
+    {
+      std::lock_guard<std::mutex> Lock(RedefMutex);
+      for (size_t Left = 2 * Loaded.size();
+           LoadedBytes > CodeBudget && Left > 0; --Left) {
+        std::shared_ptr<DefiningModule> D = Loaded.front();
+        if (D->Used.exchange(0, std::memory_order_relaxed)) {
+          Loaded.splice(Loaded.end(), Loaded, Loaded.begin());
+          continue;
+        }
+        unloadCode(*D);
+        for (size_t I = 0; I < D->Names.size(); ++I) {
+          if (Definitions.lookup(D->Names[I]) != D)
+            continue;
+          if (auto Err =
+                  RedefStubs->updatePointer(D->Names[I], D->Trampolines[I]))
+            return Err;
+        }
+        Cold.push_back(std::move(D));
+      }
+    }
+
+    for (std::shared_ptr<DefiningModule> &D : Cold) {
+      JITDylib &JD = D->RT->getJITDylib();
+      if (auto Err = D->RT->remove())
+        return Err;
+      D->RT = JD.createResourceTracker();
+      D->Evicted = true;
+      ++NumEvictions;
+      if (auto Err = JD.define(
+              std::make_unique<ReloadMaterializationUnit>(*this, D), D->RT))
+        return Err;
+    }
+    return Error::success();
+  }
+
+  // addEagerModule compiles the whole module on lookup even in lazy mode,
+  // e.g. for code that runs right away.
+  Error addEagerModule(ThreadSafeModule TSM, ResourceTrackerSP RT = nullptr) {
     if (!RT)
       RT = MainJD.getDefaultResourceTracker();
     return CompileLayer.add(RT, std::move(TSM));
   }
 
+  // The number of functions added in lazy mode, and how many of them have
+  // been compiled so far.
+  size_t getNumLazyFunctions() const { return NumLazyFunctions; }
+  size_t getNumMaterializedFunctions() const {
+    return NumMaterializedFunctions;
+  }
+
+  // The number of functions added in tiered mode, and how many of them
+  // have been recompiled with the optimizer so far.
+  size_t getNumTieredFunctions() const { return NumTieredFunctions; }
+  size_t getNumTieredUpFunctions() const { return NumTieredUpFunctions; }
+
+  // The number of definitions that replaced an earlier one, in redefinable
+  // mode.
+  size_t getNumRedefinitions() const { return NumRedefinitions; }
+
+  // With a code budget, the bytes of the objects loaded, the number of
+  // modules evicted, and how many of them were compiled again.
+  size_t getLoadedCodeBytes() {
+    std::lock_guard<std::mutex> Lock(RedefMutex);
+    return LoadedBytes;
+  }
+  size_t getNumEvictions() const { return NumEvictions; }
+  size_t getNumReloads() const { return NumReloads; }
+
+  // The address the stub of Name points at, for a function behind a stub
+  // in tiered or redefinable mode or with a code budget, or a null address.
+  ExecutorAddr getStubTarget(StringRef Name) {
+    for (IndirectStubsManager *Stubs : {TierStubs.get(), RedefStubs.get()})
+      if (Stubs)
+        if (ExecutorAddr Ptr(Stubs->findPointer(Name).getAddress()); Ptr) {
+          // The code runs in this process, so the pointer can be read.
+          return ExecutorAddr(*Ptr.toPtr<const uint64_t *>());
+        }
+    return ExecutorAddr();
+  }
+
   Expected<ExecutorSymbolDef> lookup(StringRef Name) {
     return ES->lookup({&MainJD}, Mangle(Name.str()));
   }
+
+  // Look up all of Names in a single query, so that the modules defining
+  // them are materialized concurrently by the session's dispatcher.
+  Error lookupAll(ArrayRef<std::string> Names) {
+    SymbolLookupSet Symbols;
+    for (const auto &Name : Names)
+      Symbols.add(Mangle(Name));
+    return ES->lookup(makeJITDylibSearchOrder(&MainJD), std::move(Symbols))
+        .takeError();
+  }
 };
 
 } // end namespace orc
 } // end namespace llvm
 
-#endif // LLVM_EXECUTIONENGINE_ORC_KALEIDOSCOPEJIT_H
\ No newline at end of file
+#endif // LLVM_EXECUTIONENGINE_ORC_KALEIDOSCOPEJIT_H
@@ -1,38 +1,159 @@
 #include "jit_manager.h"
 
 #include <cstdio>
+#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
 #include "llvm/Support/TargetSelect.h"
+#if LLVM_VERSION_MAJOR >= 17
+#include "llvm/TargetParser/Host.h"
+#else
+#include "llvm/Support/Host.h"
+#endif
 
-JITManager::JITManager()
+#include "utils/diagnostics.h"
+#include "utils/phase_timer.h"
+#include "utils/startup_profile.h"
+
+// initializeNativeTarget registers the host target once per process.
+static void initializeNativeTarget()
 {
-    llvm::InitializeNativeTarget();
-    llvm::InitializeNativeTargetAsmPrinter();
-    llvm::InitializeNativeTargetAsmParser();
+    static std::once_flag once;
+    std::call_once(once, []()
+                   {
+        llvm::InitializeNativeTarget();
+        llvm::InitializeNativeTargetAsmPrinter();
+        llvm::InitializeNativeTargetAsmParser();
+        StartupProfile::Record(StartupProfile::TargetInitialized); });
+}
 
-    JIT = ExitOnErr(llvm::orc::KaleidoscopeJIT::Create());
+JITManager::JITManager(const JITOptions &opts, const OptimizerOptions &optOpts)
+    : opts(opts), OptOptions(optOpts)
+{
+}
+
+llvm::orc::KaleidoscopeJIT &JITManager::JIT()
+{
+    std::call_once(jitOnce, [this]()
+                   {
+        initializeNativeTarget();
+        jit = ExitOnErr(llvm::orc::KaleidoscopeJIT::Create(opts));
+
+        // Lazily compiled functions are optimized right before compilation,
+        // tiered ones when they are recompiled.
+        jit->setOptimizer([this](llvm::Module &module)
+                          { optimizeInJIT(module); });
+        StartupProfile::Record(StartupProfile::JITCreated); });
+    return *jit;
+}
+
+llvm::orc::JITTargetMachineBuilder &JITManager::TargetMachineBuilder()
+{
+    std::call_once(targetOnce, [this]()
+                   {
+        // The JIT compiles for the process it runs in, with the same
+        // builder as KaleidoscopeJIT::Create.
+        initializeNativeTarget();
+        jtmb.emplace(llvm::Triple(llvm::sys::getProcessTriple()));
+        dataLayout = ExitOnErr(jtmb->getDefaultDataLayoutForTarget()); });
+    return *jtmb;
+}
+
+const llvm::DataLayout &JITManager::DataLayout()
+{
+    TargetMachineBuilder();
+    return *dataLayout;
+}
+
+std::unique_ptr<Optimizer> JITManager::NewOptimizer()
+{
+    // Each optimizer gets a target machine of its own, since they are used
+    // on several threads.
+    return std::make_unique<Optimizer>(OptOptions, &Library,
+                                       ExitOnErr(TargetMachineBuilder().createTargetMachine()));
+}
+
+void JITManager::optimizeInJIT(llvm::Module &module)
+{
+    std::unique_ptr<Optimizer> optimizer;
+    {
+        std::lock_guard<std::mutex> lock(optimizersMutex);
+        if (!idleOptimizers.empty())
+        {
+            optimizer = std::move(idleOptimizers.back());
+            idleOptimizers.pop_back();
+        }
+    }
+    if (!optimizer)
+        optimizer = NewOptimizer();
+
+    optimizer->optimizeModule(module);
+
+    std::lock_guard<std::mutex> lock(optimizersMutex);
+    idleOptimizers.push_back(std::move(optimizer));
 }
 
 void JITManager::JITAddModule(std::unique_ptr<llvm::Module> module, std::unique_ptr<llvm::LLVMContext> context)
 {
-    ExitOnErr(JIT->addModule(
-        llvm::orc::ThreadSafeModule(std::move(module), std::move(context))));
+    JITAddModule(llvm::orc::ThreadSafeModule(std::move(module), std::move(context)));
+}
+
+void JITManager::JITAddModule(llvm::orc::ThreadSafeModule tsm)
+{
+    ExitOnErr(JIT().addModule(std::move(tsm)));
+}
+
+void JITManager::EvictColdCode()
+{
+    if (jit)
+        ExitOnErr(jit->evictColdCode());
+}
+
+void *JITManager::JITLookup(const std::string &name)
+{
+    ScopedPhase timer(Phase::Lookup, name);
+    auto sym = JIT().lookup(name);
+    if (!sym)
+    {
+        llvm::consumeError(sym.takeError());
+        return nullptr;
+    }
+    return sym->getAddress().toPtr<void *>();
+}
+
+std::optional<Error> JITManager::JITMaterialize(const std::vector<std::string> &names)
+{
+    ScopedPhase timer(Phase::Lookup);
+    if (auto err = JIT().lookupAll(names))
+        return Error(llvm::toString(std::move(err)));
+    return std::nullopt;
 }
 
 void JITManager::JITExec(std::unique_ptr<llvm::Module> module, std::unique_ptr<llvm::LLVMContext> context)
 {
-    auto rt = JIT->getMainJITDylib().createResourceTracker();
+    auto rt = JIT().getMainJITDylib().createResourceTracker();
 
+    // __main__ runs right away, there is no point in compiling it lazily.
     auto tsm = llvm::orc::ThreadSafeModule(std::move(module), std::move(context));
-    ExitOnErr(JIT->addModule(std::move(tsm), rt));
+    ExitOnErr(JIT().addEagerModule(std::move(tsm), rt));
 
     // Search the JIT for the __main__ symbol.
-    auto ExprSymbol = ExitOnErr(JIT->lookup("__main__"));
+    llvm::orc::ExecutorSymbolDef ExprSymbol;
+    {
+        ScopedPhase timer(Phase::Lookup, "__main__");
+        ExprSymbol = ExitOnErr(JIT().lookup("__main__"));
+    }
 
     // Get the symbol's address and cast it to the right type (takes no
     // arguments, returns a double) so we can call it as a native function.
     double (*fp)() = ExprSymbol.getAddress().toPtr<double (*)()>();
-    fprintf(stderr, "*** Evaluated to %f\n", fp());
+    double result;
+    {
+        ScopedPhase timer(Phase::Execute, "__main__");
+        result = fp();
+    }
+    Diagnostics::Printf(DiagCategory::Result, "*** Evaluated to %f\n", result);
+    StartupProfile::Record(StartupProfile::FirstResult);
 
     // Delete the anonymous expression module from the JIT.
     ExitOnErr(rt->remove());
+    EvictColdCode();
 }
\ No newline at end of file
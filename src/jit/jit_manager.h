@@ -2,21 +2,127 @@
 #define __JIT_MANAGER_H__
 
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
 
 #include "jit.h"
+#include "codegen/optimizer.h"
+#include "utils/error.h"
 #include "llvm/Support/Error.h"
+#include "llvm/IR/DataLayout.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/LLVMContext.h"
 
+using JITOptions = llvm::orc::KaleidoscopeJITOptions;
+
+// JITManager owns the JIT of a CodeGen and the optimizers of the code added
+// to it. The JIT is only created when code is first added or looked up, so
+// that e.g. parsing and checking never pay for it.
 class JITManager
 {
+    const JITOptions opts;
+
+    std::once_flag jitOnce;
+    std::unique_ptr<llvm::orc::KaleidoscopeJIT> jit;
+
+    std::once_flag targetOnce;
+    std::optional<llvm::orc::JITTargetMachineBuilder> jtmb;
+    std::optional<llvm::DataLayout> dataLayout;
+
+    // TargetMachineBuilder describes the target the JIT compiles for.
+    llvm::orc::JITTargetMachineBuilder &TargetMachineBuilder();
+
+    // Optimizers for functions optimized by the JIT, lazily compiled or hot
+    // ones, which may be compiled on several threads. Each is used by one thread at a time and kept for
+    // the next function.
+    std::mutex optimizersMutex;
+    std::vector<std::unique_ptr<Optimizer>> idleOptimizers;
+
+    void optimizeInJIT(llvm::Module &module);
 
 public:
-    JITManager();
+    JITManager(const JITOptions &opts = JITOptions(),
+               const OptimizerOptions &optOpts = OptimizerOptions());
     void JITExec(std::unique_ptr<llvm::Module> module, std::unique_ptr<llvm::LLVMContext> context);
     void JITAddModule(std::unique_ptr<llvm::Module> module, std::unique_ptr<llvm::LLVMContext> context);
+    void JITAddModule(llvm::orc::ThreadSafeModule tsm);
+
+    // JITLookup returns the address of a symbol in the JIT, compiling it if
+    // needed, or nullptr if it is not defined.
+    void *JITLookup(const std::string &name);
+
+    // JITMaterialize compiles the functions with the given names now
+    // rather than when they are first called. It fails if some of them
+    // cannot be compiled or linked, e.g. because they call a function that
+    // is not defined, and the others are still compiled.
+    std::optional<Error> JITMaterialize(const std::vector<std::string> &names);
+
+    // EvictColdCode keeps the code of the JIT within its budget, see
+    // KaleidoscopeJIT::evictColdCode. None of the code may be running.
+    void EvictColdCode();
+
+    // JIT returns the JIT, creating it on first use.
+    llvm::orc::KaleidoscopeJIT &JIT();
+
+    // DataLayout returns the data layout of the code the JIT will compile,
+    // without creating the JIT.
+    const llvm::DataLayout &DataLayout();
+
+    // In lazy mode, functions are optimized and compiled on their first call.
+    bool IsLazy() const { return opts.Lazy; }
+
+    // In tiered mode, functions are optimized once they are hot.
+    bool IsTiered() const { return opts.isTiered(); }
+
+    // In redefinable mode, a function defined again replaces the old one.
+    bool IsRedefinable() const { return opts.isRedefinable(); }
+
+    // Whether the JIT optimizes the functions of the modules it is given,
+    // in which case only __main__ should be optimized up front.
+    bool OptimizesInJIT() const { return IsLazy() || IsTiered(); }
+
+    // The number of functions the JIT has compiled and the number it
+    // was given, in lazy mode.
+    size_t NumMaterialized() const { return jit ? jit->getNumMaterializedFunctions() : 0; }
+    size_t NumLazy() const { return jit ? jit->getNumLazyFunctions() : 0; }
+
+    // The number of functions recompiled with the optimizer and the number
+    // added, in tiered mode.
+    size_t NumTieredUp() const { return jit ? jit->getNumTieredUpFunctions() : 0; }
+    size_t NumTiered() const { return jit ? jit->getNumTieredFunctions() : 0; }
+
+    // The number of functions defined again, in redefinable mode.
+    size_t NumRedefined() const { return jit ? jit->getNumRedefinitions() : 0; }
+
+    // With a code budget, the least recently called functions are evicted
+    // and compiled again on their next call.
+    bool HasCodeBudget() const { return opts.hasCodeBudget(); }
+    size_t CodeBudget() const { return opts.CodeBudget; }
+
+    // The bytes of code loaded, the number of modules evicted and the
+    // number compiled again, with a code budget.
+    size_t LoadedCodeBytes() const { return jit ? jit->getLoadedCodeBytes() : 0; }
+    size_t NumEvicted() const { return jit ? jit->getNumEvictions() : 0; }
+    size_t NumReloaded() const { return jit ? jit->getNumReloads() : 0; }
+
+    // The cache of compiled objects, with JITOptions::CacheDir.
+    const DiskObjectCache *Cache() const { return jit ? jit->getObjectCache() : nullptr; }
+
+    // The memory manager of the code, with JITOptions::JITLink.
+    const SlabMemoryManager *Slabs() const { return jit ? jit->getSlabMemoryManager() : nullptr; }
+
+    // How the code added to the JIT is optimized.
+    const OptimizerOptions OptOptions;
+
+    // The IR of the optimized modules, with OptOptions.CrossModule.
+    IRLibrary Library;
+
+    // NewOptimizer returns an optimizer for code added to this JIT, which
+    // uses the cost models of the JIT's target.
+    std::unique_ptr<Optimizer> NewOptimizer();
 
-    std::unique_ptr<llvm::orc::KaleidoscopeJIT> JIT;
     llvm::ExitOnError ExitOnErr;
 };
 
@@ -0,0 +1,165 @@
+#include "object_cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <system_error>
+#include <vector>
+
+#include <unistd.h>
+
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace fs = std::filesystem;
+
+DiskObjectCache::DiskObjectCache(std::string dir, uint64_t maxBytes, std::string salt)
+    : dir(std::move(dir)), maxBytes(maxBytes), salt(std::move(salt))
+{
+}
+
+ObjectCacheResult DiskObjectCache::Open(const std::string &dir, uint64_t maxBytes,
+                                        const std::string &salt)
+{
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    if (ec)
+        return ObjectCacheResult(Error("cannot create " + dir + ": " + ec.message()));
+
+    auto cache = std::unique_ptr<DiskObjectCache>(new DiskObjectCache(dir, maxBytes, salt));
+    cache->scan(maxBytes);
+    return ObjectCacheResult(std::move(cache));
+}
+
+std::string DiskObjectCache::keyOf(const llvm::Module &module) const
+{
+    std::string data = salt;
+    data.push_back('\0');
+    llvm::raw_string_ostream os(data);
+    llvm::WriteBitcodeToFile(module, os);
+    os.flush();
+    return llvm::toHex(llvm::SHA1::hash(llvm::arrayRefFromStringRef(data)),
+                       /*LowerCase*/ true);
+}
+
+std::string DiskObjectCache::pathOf(const std::string &key) const
+{
+    return (fs::path(dir) / (key + ".o")).string();
+}
+
+std::unique_ptr<llvm::MemoryBuffer> DiskObjectCache::getObject(const llvm::Module *module)
+{
+    if (module->getNamedMetadata(NoCacheMetadata))
+    {
+        misses++;
+        return nullptr;
+    }
+
+    std::string key = keyOf(*module);
+    std::string path = pathOf(key);
+    auto object = llvm::MemoryBuffer::getFile(path, /*IsText*/ false,
+                                              /*RequiresNullTerminator*/ false);
+    if (object)
+    {
+        hits++;
+        // The modification time orders the objects for eviction.
+        std::error_code ec;
+        fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+        return std::move(*object);
+    }
+
+    misses++;
+    std::lock_guard<std::mutex> lock(mutex);
+    pending[module] = std::move(key);
+    return nullptr;
+}
+
+void DiskObjectCache::notifyObjectCompiled(const llvm::Module *module,
+                                           llvm::MemoryBufferRef object)
+{
+    std::string key;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = pending.find(module);
+        if (it == pending.end())
+            return;
+        key = std::move(it->second);
+        pending.erase(it);
+    }
+
+    // Write to a file of our own first, so that other processes never
+    // see a partial object.
+    static std::atomic<unsigned> counter{0};
+    std::string path = pathOf(key);
+    std::string tmp = path + ".tmp." + std::to_string(getpid()) + "." +
+                      std::to_string(counter++);
+    {
+        std::ofstream out(tmp, std::ios::binary);
+        out.write(object.getBufferStart(), object.getBufferSize());
+        if (!out)
+        {
+            std::error_code ec;
+            fs::remove(tmp, ec);
+            return;
+        }
+    }
+    std::error_code ec;
+    fs::rename(tmp, path, ec);
+    if (ec)
+    {
+        fs::remove(tmp, ec);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    totalBytes += object.getBufferSize();
+    // Evict down to 3/4 of the limit, so that the directory is not
+    // scanned again for every new object.
+    if (totalBytes > maxBytes)
+        scan(maxBytes / 4 * 3);
+}
+
+void DiskObjectCache::scan(uint64_t limit)
+{
+    struct Entry
+    {
+        fs::file_time_type time;
+        fs::path path;
+        uint64_t size;
+    };
+
+    std::vector<Entry> entries;
+    totalBytes = 0;
+    std::error_code ec;
+    for (const fs::directory_entry &e : fs::directory_iterator(dir, ec))
+    {
+        if (e.path().extension() != ".o")
+            continue;
+        std::error_code fileEc;
+        uint64_t size = e.file_size(fileEc);
+        fs::file_time_type time = e.last_write_time(fileEc);
+        if (fileEc)
+            continue;
+        entries.push_back(Entry{time, e.path(), size});
+        totalBytes += size;
+    }
+    if (totalBytes <= limit)
+        return;
+
+    std::sort(entries.begin(), entries.end(),
+              [](const Entry &a, const Entry &b)
+              { return a.time < b.time; });
+    for (const Entry &e : entries)
+    {
+        if (totalBytes <= limit)
+            break;
+        if (fs::remove(e.path, ec))
+        {
+            totalBytes -= e.size;
+            evictions++;
+        }
+    }
+}
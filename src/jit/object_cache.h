@@ -0,0 +1,78 @@
+#ifndef __OBJECT_CACHE_H__
+#define __OBJECT_CACHE_H__
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include "utils/error.h"
+#include "utils/result.h"
+
+class DiskObjectCache;
+
+using ObjectCacheResult = Result<std::unique_ptr<DiskObjectCache>, Error>;
+
+// DiskObjectCache keeps the object files compiled by the JIT in a directory,
+// so that a later process given the same IR loads them instead of running
+// the code generator. An object is keyed by a hash of the module's bitcode
+// and of a salt, which must describe everything else that changes the
+// generated code, e.g. the target and the code generator's options.
+//
+// Once the directory holds more than maxBytes, the least recently used
+// objects are removed. Several processes may share a directory.
+class DiskObjectCache : public llvm::ObjectCache
+{
+    std::string dir;
+    uint64_t maxBytes;
+    std::string salt;
+
+    std::mutex mutex;
+    // The bytes in dir, as of the last scan plus what was added since.
+    uint64_t totalBytes = 0;
+    // The keys of modules being compiled, computed before the code
+    // generator modified them.
+    std::unordered_map<const llvm::Module *, std::string> pending;
+
+    std::atomic<size_t> hits{0};
+    std::atomic<size_t> misses{0};
+    std::atomic<size_t> evictions{0};
+
+    DiskObjectCache(std::string dir, uint64_t maxBytes, std::string salt);
+
+    std::string keyOf(const llvm::Module &module) const;
+    std::string pathOf(const std::string &key) const;
+
+    // scan sums up the sizes of the objects in dir and, if they are over
+    // limit, removes the least recently used ones.
+    void scan(uint64_t limit);
+
+public:
+    static constexpr uint64_t DefaultMaxBytes = 256 << 20;
+
+    // NoCacheMetadata names the metadata of modules that must not be
+    // cached, e.g. because they embed addresses of the running process.
+    static constexpr const char *NoCacheMetadata = "kaleido.no_cache";
+
+    // Open creates dir if needed.
+    static ObjectCacheResult Open(const std::string &dir, uint64_t maxBytes,
+                                  const std::string &salt);
+
+    void notifyObjectCompiled(const llvm::Module *module,
+                              llvm::MemoryBufferRef object) override;
+    std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module *module) override;
+
+    // The number of objects loaded from the cache, the number compiled
+    // instead, and the number removed to stay under maxBytes.
+    size_t NumHits() const { return hits; }
+    size_t NumMisses() const { return misses; }
+    size_t NumEvictions() const { return evictions; }
+};
+
+#endif
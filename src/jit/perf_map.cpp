@@ -0,0 +1,114 @@
+#include "perf_map.h"
+
+#include <unistd.h>
+
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Object/SymbolSize.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+
+std::string PerfMapListener::DefaultPath()
+{
+    return "/tmp/perf-" + std::to_string(getpid()) + ".map";
+}
+
+PerfMapResult PerfMapListener::Open(const std::string &path)
+{
+    int fd;
+    if (std::error_code ec = llvm::sys::fs::openFileForWrite(path, fd))
+        return PerfMapResult(Error("cannot open " + path + ": " + ec.message()));
+    return PerfMapResult(std::unique_ptr<PerfMapListener>(new PerfMapListener(fd)));
+}
+
+void PerfMapListener::notifyObjectLoaded(ObjectKey key, const llvm::object::ObjectFile &object,
+                                         const llvm::RuntimeDyld::LoadedObjectInfo &info)
+{
+    // The copy of the object for debuggers has its sections at the
+    // addresses they were loaded at.
+    llvm::object::OwningBinary<llvm::object::ObjectFile> debug = info.getObjectForDebug(object);
+    const llvm::object::ObjectFile *loaded = debug.getBinary();
+    if (!loaded)
+        return;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto &[sym, size] : llvm::object::computeSymbolSizes(*loaded))
+    {
+        auto type = sym.getType();
+        if (!type)
+        {
+            llvm::consumeError(type.takeError());
+            continue;
+        }
+        if (*type != llvm::object::SymbolRef::ST_Function || size == 0)
+            continue;
+        auto name = sym.getName();
+        auto addr = sym.getAddress();
+        if (!name || !addr)
+        {
+            llvm::consumeError(name.takeError());
+            llvm::consumeError(addr.takeError());
+            continue;
+        }
+        out << llvm::format("%llx %llx ", (unsigned long long)*addr, (unsigned long long)size)
+            << *name << '\n';
+    }
+    // perf may read the map while the process runs, or after it crashed.
+    out.flush();
+}
+
+namespace
+{
+    // PerfMapPlugin names the functions JITLink links once their addresses
+    // are fixed.
+    class PerfMapPlugin : public llvm::orc::ObjectLinkingLayer::Plugin
+    {
+        std::mutex &mutex;
+        llvm::raw_fd_ostream &out;
+
+    public:
+        PerfMapPlugin(std::mutex &mutex, llvm::raw_fd_ostream &out) : mutex(mutex), out(out) {}
+
+        void modifyPassConfig(llvm::orc::MaterializationResponsibility &mr, llvm::jitlink::LinkGraph &graph,
+                              llvm::jitlink::PassConfiguration &config) override
+        {
+            config.PostFixupPasses.push_back([this](llvm::jitlink::LinkGraph &graph)
+                                             {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (llvm::jitlink::Symbol *sym : graph.defined_symbols())
+                {
+                    if (!sym->isCallable() || !sym->hasName() || sym->getSize() == 0)
+                        continue;
+#if LLVM_VERSION_MAJOR >= 20
+                    llvm::StringRef name = *sym->getName();
+#else
+                    llvm::StringRef name = sym->getName();
+#endif
+                    out << llvm::format("%llx %llx ", (unsigned long long)sym->getAddress().getValue(),
+                                        (unsigned long long)sym->getSize())
+                        << name << '\n';
+                }
+                out.flush();
+                return llvm::Error::success(); });
+        }
+
+        llvm::Error notifyFailed(llvm::orc::MaterializationResponsibility &mr) override
+        {
+            return llvm::Error::success();
+        }
+
+        llvm::Error notifyRemovingResources(llvm::orc::JITDylib &jd, llvm::orc::ResourceKey key) override
+        {
+            return llvm::Error::success();
+        }
+
+        void notifyTransferringResources(llvm::orc::JITDylib &jd, llvm::orc::ResourceKey dstKey,
+                                         llvm::orc::ResourceKey srcKey) override
+        {
+        }
+    };
+}
+
+std::unique_ptr<llvm::orc::ObjectLinkingLayer::Plugin> PerfMapListener::Plugin()
+{
+    return std::make_unique<PerfMapPlugin>(mutex, out);
+}
@@ -0,0 +1,49 @@
+#ifndef __PERF_MAP_H__
+#define __PERF_MAP_H__
+
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "llvm/ExecutionEngine/JITEventListener.h"
+#include "llvm/ExecutionEngine/Orc/ObjectLinkingLayer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "utils/error.h"
+#include "utils/result.h"
+
+class PerfMapListener;
+
+using PerfMapResult = Result<std::unique_ptr<PerfMapListener>, Error>;
+
+// PerfMapListener writes the address, size and name of every function the
+// JIT loads to a perf map, the text file that `perf report` reads to name
+// samples in code that has no file on disk. Entries are only ever added:
+// the memory of code removed from the JIT, e.g. of a top-level expression
+// once it ran, may be covered by several entries.
+//
+// It listens to RuntimeDyld; objects linked by JITLink are named through
+// its Plugin.
+class PerfMapListener : public llvm::JITEventListener
+{
+    std::mutex mutex;
+    llvm::raw_fd_ostream out;
+
+    explicit PerfMapListener(int fd) : out(fd, /*shouldClose*/ true) {}
+
+public:
+    // DefaultPath is where perf looks for the map of this process,
+    // /tmp/perf-<pid>.map.
+    static std::string DefaultPath();
+
+    // Open truncates path.
+    static PerfMapResult Open(const std::string &path);
+
+    void notifyObjectLoaded(ObjectKey key, const llvm::object::ObjectFile &object,
+                            const llvm::RuntimeDyld::LoadedObjectInfo &info) override;
+
+    // Plugin returns a plugin of a JITLink object layer writing to this map.
+    std::unique_ptr<llvm::orc::ObjectLinkingLayer::Plugin> Plugin();
+};
+
+#endif
@@ -0,0 +1,307 @@
+#include "slab_memory_manager.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "llvm/ExecutionEngine/JITLink/JITLink.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/Memory.h"
+#include "llvm/Support/Process.h"
+
+using llvm::jitlink::BasicLayout;
+using llvm::orc::ExecutorAddr;
+
+// Segments are handed out in multiples of the granule, which keeps small
+// leftovers out of the free lists.
+static constexpr size_t granule = 16;
+static constexpr size_t hugePageSize = 2 << 20;
+
+// sysError describes the errno of a failed call.
+static Error sysError(const char *what)
+{
+    return Error(std::string(what) + ": " + strerror(errno), errno);
+}
+
+static llvm::Error toLLVMError(const Error &err)
+{
+    return llvm::createStringError(llvm::inconvertibleErrorCode(), err.message);
+}
+
+// reserveAligned reserves size bytes of address space at a multiple of align.
+static char *reserveAligned(size_t size, size_t align)
+{
+    void *p = mmap(nullptr, size + align, PROT_NONE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED)
+        return nullptr;
+    char *start = static_cast<char *>(p);
+    char *aligned = reinterpret_cast<char *>(llvm::alignTo(reinterpret_cast<uintptr_t>(start), align));
+    if (aligned > start)
+        munmap(start, aligned - start);
+    if (char *end = aligned + size; end < start + size + align)
+        munmap(end, start + size + align - end);
+    return aligned;
+}
+
+// SlabAlloc is an object's memory until JITLink finalizes or abandons it.
+class SlabMemoryManager::SlabAlloc : public llvm::jitlink::JITLinkMemoryManager::InFlightAlloc
+{
+    SlabMemoryManager &mm;
+    llvm::jitlink::LinkGraph &graph;
+    std::vector<Range> ranges;
+
+public:
+    SlabAlloc(SlabMemoryManager &mm, llvm::jitlink::LinkGraph &graph, std::vector<Range> ranges)
+        : mm(mm), graph(graph), ranges(std::move(ranges))
+    {
+    }
+
+    void finalize(OnFinalizedFunction onFinalized) override
+    {
+        // The code was written through the other view.
+        for (const Range &r : ranges)
+        {
+            if (r.kind == ReadExecute)
+                llvm::sys::Memory::InvalidateInstructionCache(r.addr, r.size);
+        }
+        auto deallocActions = llvm::orc::shared::runFinalizeActions(graph.allocActions());
+        if (!deallocActions)
+        {
+            mm.release(ranges);
+            onFinalized(deallocActions.takeError());
+            return;
+        }
+        auto record = new FinalizedRecord{std::move(ranges), std::move(*deallocActions)};
+        onFinalized(FinalizedAlloc(ExecutorAddr::fromPtr(record)));
+    }
+
+    void abandon(OnAbandonedFunction onAbandoned) override
+    {
+        mm.release(ranges);
+        onAbandoned(llvm::Error::success());
+    }
+};
+
+SlabMemoryManager::SlabMemoryManager(size_t slabSize, bool hugePages, size_t reserveSize)
+    : slabSize(slabSize), hugePages(hugePages), reserveSize(reserveSize)
+{
+}
+
+SlabMemoryManager::~SlabMemoryManager()
+{
+    if (reservation)
+        munmap(reservation, reservationSize);
+    if (workingReservation)
+        munmap(workingReservation, workingReservationSize);
+    for (Pool &pool : pools)
+    {
+        if (pool.fd >= 0)
+            close(pool.fd);
+    }
+}
+
+SlabMemoryManagerResult SlabMemoryManager::Create(size_t slabSize, bool hugePages, size_t reserveSize)
+{
+    size_t unit = hugePages ? hugePageSize : llvm::sys::Process::getPageSizeEstimate();
+    slabSize = llvm::alignTo(std::max<size_t>(slabSize, 1), unit);
+    reserveSize = llvm::alignTo(std::max(reserveSize, slabSize), unit);
+    auto mm = std::unique_ptr<SlabMemoryManager>(new SlabMemoryManager(slabSize, hugePages, reserveSize));
+    if (auto err = mm->reserve())
+        return SlabMemoryManagerResult(*err);
+    return SlabMemoryManagerResult(std::move(mm));
+}
+
+std::optional<Error> SlabMemoryManager::reserve()
+{
+    size_t align = hugePages ? hugePageSize : llvm::sys::Process::getPageSizeEstimate();
+    reservationSize = NumKinds * reserveSize;
+    reservation = reserveAligned(reservationSize, align);
+    if (!reservation)
+        return sysError("cannot reserve memory for the JIT");
+    workingReservationSize = 2 * reserveSize;
+    workingReservation = reserveAligned(workingReservationSize, align);
+    if (!workingReservation)
+        return sysError("cannot reserve memory for the JIT");
+
+    char *working = workingReservation;
+    for (int kind = 0; kind < NumKinds; kind++)
+    {
+        Pool &pool = pools[kind];
+        pool.base = reservation + kind * reserveSize;
+        if (kind == ReadWrite)
+            continue;
+        pool.workingOffset = working - pool.base;
+        working += reserveSize;
+        pool.fd = memfd_create("kaleidoscope-jit", MFD_CLOEXEC);
+        if (pool.fd < 0)
+            return sysError("memfd_create");
+    }
+    return std::nullopt;
+}
+
+std::optional<Error> SlabMemoryManager::grow(Kind kind, size_t size)
+{
+    Pool &pool = pools[kind];
+    size = llvm::alignTo(size, slabSize);
+    if (pool.mappedBytes + size > reserveSize)
+        return Error("the JIT is out of code memory");
+
+    char *addr = pool.base + pool.mappedBytes;
+    char *working = addr + pool.workingOffset;
+    if (kind == ReadWrite)
+    {
+        if (mmap(addr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+                 -1, 0) == MAP_FAILED)
+            return sysError("mmap");
+    }
+    else
+    {
+        int prot = kind == ReadExecute ? PROT_READ | PROT_EXEC : PROT_READ;
+        off_t offset = pool.mappedBytes;
+        if (ftruncate(pool.fd, offset + size) < 0)
+            return sysError("ftruncate");
+        if (mmap(addr, size, prot, MAP_SHARED | MAP_FIXED, pool.fd, offset) == MAP_FAILED ||
+            mmap(working, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, pool.fd, offset) == MAP_FAILED)
+            return sysError("mmap");
+    }
+    if (hugePages)
+    {
+        // Only advice: the kernel may not back the slab with huge pages.
+        madvise(addr, size, MADV_HUGEPAGE);
+        if (working != addr)
+            madvise(working, size, MADV_HUGEPAGE);
+    }
+    pool.mappedBytes += size;
+    numSlabs++;
+    slabBytes += size;
+
+    // The new slab continues the last free range if that ended the pool.
+    if (!pool.free.empty())
+    {
+        auto last = std::prev(pool.free.end());
+        if (last->first + last->second == addr)
+        {
+            last->second += size;
+            return std::nullopt;
+        }
+    }
+    pool.free[addr] = size;
+    return std::nullopt;
+}
+
+char *SlabMemoryManager::take(Kind kind, size_t size, size_t align)
+{
+    auto &free = pools[kind].free;
+    for (auto it = free.begin(); it != free.end(); ++it)
+    {
+        char *start = it->first;
+        char *end = start + it->second;
+        char *addr = reinterpret_cast<char *>(llvm::alignTo(reinterpret_cast<uintptr_t>(start), align));
+        if (addr + size > end)
+            continue;
+        free.erase(it);
+        if (addr > start)
+            free[start] = addr - start;
+        if (addr + size < end)
+            free[addr + size] = end - (addr + size);
+        return addr;
+    }
+    return nullptr;
+}
+
+void SlabMemoryManager::release(const std::vector<Range> &ranges)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const Range &r : ranges)
+    {
+        auto &free = pools[r.kind].free;
+        char *addr = r.addr;
+        size_t size = r.size;
+        auto next = free.lower_bound(addr);
+        if (next != free.end() && addr + size == next->first)
+        {
+            size += next->second;
+            next = free.erase(next);
+        }
+        if (next != free.begin())
+        {
+            auto prev = std::prev(next);
+            if (prev->first + prev->second == addr)
+            {
+                prev->second += size;
+                size = 0;
+            }
+        }
+        if (size > 0)
+            free.emplace_hint(next, addr, size);
+        usedBytes -= r.size;
+    }
+}
+
+void SlabMemoryManager::allocate(const llvm::jitlink::JITLinkDylib *jd, llvm::jitlink::LinkGraph &graph,
+                                 OnAllocatedFunction onAllocated)
+{
+    BasicLayout layout(graph);
+    std::vector<Range> ranges;
+    std::optional<Error> failure;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto &[group, segment] : layout.segments())
+        {
+            unsigned prot = llvm::orc::toSysMemoryProtectionFlags(group.getMemProt());
+            Kind kind = prot & llvm::sys::Memory::MF_WRITE  ? ReadWrite
+                        : prot & llvm::sys::Memory::MF_EXEC ? ReadExecute
+                                                            : ReadOnly;
+            size_t size = llvm::alignTo(segment.ContentSize + segment.ZeroFillSize, granule);
+            size_t align = std::max<size_t>(segment.Alignment.value(), granule);
+            char *addr = take(kind, size, align);
+            if (!addr)
+            {
+                failure = grow(kind, size + align);
+                if (failure)
+                    break;
+                addr = take(kind, size, align);
+            }
+            ranges.push_back(Range{kind, addr, size});
+            usedBytes += size;
+
+            segment.Addr = ExecutorAddr::fromPtr(addr);
+            segment.WorkingMem = addr + pools[kind].workingOffset;
+            // The memory may have held another object.
+            memset(segment.WorkingMem + segment.ContentSize, 0, segment.ZeroFillSize);
+        }
+    }
+
+    if (failure)
+    {
+        release(ranges);
+        onAllocated(toLLVMError(*failure));
+        return;
+    }
+    if (auto err = layout.apply())
+    {
+        release(ranges);
+        onAllocated(std::move(err));
+        return;
+    }
+    onAllocated(std::make_unique<SlabAlloc>(*this, graph, std::move(ranges)));
+}
+
+void SlabMemoryManager::deallocate(std::vector<FinalizedAlloc> allocs,
+                                   OnDeallocatedFunction onDeallocated)
+{
+    llvm::Error err = llvm::Error::success();
+    for (FinalizedAlloc &alloc : allocs)
+    {
+        auto record = alloc.release().toPtr<FinalizedRecord *>();
+        err = llvm::joinErrors(std::move(err),
+                               llvm::orc::shared::runDeallocActions(record->deallocActions));
+        release(record->ranges);
+        delete record;
+    }
+    onDeallocated(std::move(err));
+}
@@ -0,0 +1,134 @@
+#ifndef __SLAB_MEMORY_MANAGER_H__
+#define __SLAB_MEMORY_MANAGER_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "llvm/ExecutionEngine/JITLink/JITLinkMemoryManager.h"
+
+#include "utils/error.h"
+#include "utils/result.h"
+
+class SlabMemoryManager;
+
+using SlabMemoryManagerResult = Result<std::unique_ptr<SlabMemoryManager>, Error>;
+
+// SlabMemoryManager gives JITLink the memory of the objects it links. Rather
+// than mapping pages for every object, it packs the segments of many objects
+// into shared slabs, one kind of slab per protection, so that thousands of
+// small functions take a few mappings and their code shares pages.
+//
+// Code and read-only data are mapped twice from a memfd: JITLink writes them
+// through a writable view, and they run from a view with their final
+// protections, so a page never changes protection while code on it runs.
+//
+// The slabs of a kind grow within one reserved range of address space, and
+// the ranges of all kinds within one reservation, so that an object's code
+// always reaches its data with 32-bit offsets. Linux only.
+class SlabMemoryManager : public llvm::jitlink::JITLinkMemoryManager
+{
+public:
+    static constexpr size_t DefaultSlabSize = 2 << 20;
+
+    // The address space reserved for each kind of slab.
+    static constexpr size_t DefaultReserveSize = 256 << 20;
+
+    // Create rounds slabSize up to pages, or to huge pages with hugePages.
+    // Huge pages are only used if the kernel has transparent huge pages
+    // enabled, for shared memory too for the code.
+    static SlabMemoryManagerResult Create(size_t slabSize = DefaultSlabSize,
+                                          bool hugePages = false,
+                                          size_t reserveSize = DefaultReserveSize);
+    ~SlabMemoryManager() override;
+
+    void allocate(const llvm::jitlink::JITLinkDylib *jd, llvm::jitlink::LinkGraph &graph,
+                  OnAllocatedFunction onAllocated) override;
+    void deallocate(std::vector<FinalizedAlloc> allocs,
+                    OnDeallocatedFunction onDeallocated) override;
+    using JITLinkMemoryManager::allocate;
+    using JITLinkMemoryManager::deallocate;
+
+    // The number of slabs mapped, their bytes, and the bytes of them
+    // given to objects that were not deallocated yet.
+    size_t NumSlabs() const { return numSlabs; }
+    size_t SlabBytes() const { return slabBytes; }
+    size_t UsedBytes() const { return usedBytes; }
+
+private:
+    enum Kind
+    {
+        ReadWrite,
+        ReadExecute,
+        ReadOnly,
+        NumKinds,
+    };
+
+    // The memory of one segment of an object.
+    struct Range
+    {
+        Kind kind;
+        char *addr;
+        size_t size;
+    };
+
+    struct Pool
+    {
+        // The reserved range that the slabs are mapped at, and the offset of
+        // their writable view from it, 0 for read-write slabs.
+        char *base = nullptr;
+        ptrdiff_t workingOffset = 0;
+        // The memfd of dual mapped slabs, -1 for read-write ones.
+        int fd = -1;
+        size_t mappedBytes = 0;
+        // The free ranges, by address.
+        std::map<char *, size_t> free;
+    };
+
+    class SlabAlloc;
+
+    // A finalized allocation, which FinalizedAlloc points at.
+    struct FinalizedRecord
+    {
+        std::vector<Range> ranges;
+        std::vector<llvm::orc::shared::WrapperFunctionCall> deallocActions;
+    };
+
+    size_t slabSize;
+    bool hugePages;
+    size_t reserveSize;
+    char *reservation = nullptr;
+    size_t reservationSize = 0;
+    // The reservation of the writable views of the dual mapped slabs.
+    char *workingReservation = nullptr;
+    size_t workingReservationSize = 0;
+
+    std::mutex mutex;
+    Pool pools[NumKinds];
+
+    std::atomic<size_t> numSlabs{0};
+    std::atomic<size_t> slabBytes{0};
+    std::atomic<size_t> usedBytes{0};
+
+    SlabMemoryManager(size_t slabSize, bool hugePages, size_t reserveSize);
+
+    std::optional<Error> reserve();
+
+    // grow maps another slab, of at least size bytes, at the end of pool.
+    // The mutex must be held.
+    std::optional<Error> grow(Kind kind, size_t size);
+
+    // take returns the address of size bytes aligned to align in kind's
+    // slabs, or nullptr if they are full. The mutex must be held.
+    char *take(Kind kind, size_t size, size_t align);
+
+    // release returns ranges to the free lists.
+    void release(const std::vector<Range> &ranges);
+};
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef __CHAR_CLASS_H__
+#define __CHAR_CLASS_H__
+
+#include <array>
+#include <cstdint>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Character classes used by the lexer. A character may belong to several.
+enum CharClass : uint8_t
+{
+    CC_SPACE = 1 << 0, // ' ', '\t', '\n', '\v', '\f', '\r'
+    CC_ALPHA = 1 << 1, // [a-zA-Z]
+    CC_DIGIT = 1 << 2, // [0-9]
+    CC_ALNUM = CC_ALPHA | CC_DIGIT,
+};
+
+constexpr std::array<uint8_t, 256> makeCharClassTable()
+{
+    std::array<uint8_t, 256> table{};
+    for (char c : {' ', '\t', '\n', '\v', '\f', '\r'})
+        table[static_cast<unsigned char>(c)] |= CC_SPACE;
+    for (int c = 'a'; c <= 'z'; c++)
+        table[c] |= CC_ALPHA;
+    for (int c = 'A'; c <= 'Z'; c++)
+        table[c] |= CC_ALPHA;
+    for (int c = '0'; c <= '9'; c++)
+        table[c] |= CC_DIGIT;
+    return table;
+}
+
+// charClass maps every byte to its CharClass bits, so classifying a
+// character is a single load instead of a call into <cctype>.
+inline constexpr std::array<uint8_t, 256> charClass = makeCharClassTable();
+
+inline bool hasClass(char c, uint8_t cls)
+{
+    return charClass[static_cast<unsigned char>(c)] & cls;
+}
+
+namespace scan
+{
+    // The scanners below return the first character in [p, end) that does not
+    // belong to the run they skip, or end if the whole range does.
+    // They look at 16 bytes at a time when SIMD is available and finish
+    // the tail with the lookup table.
+
+#if defined(__SSE2__)
+    constexpr bool HasSIMD = true;
+
+    using Block = __m128i;
+
+    inline Block load(const char *p)
+    {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    }
+
+    inline Block eq(Block v, char c)
+    {
+        return _mm_cmpeq_epi8(v, _mm_set1_epi8(c));
+    }
+
+    // Bytes in [lo, hi], compared as unsigned.
+    inline Block inRange(Block v, char lo, char hi)
+    {
+        Block d = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+        return _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(hi - lo)), d);
+    }
+
+    inline Block any(Block a, Block b) { return _mm_or_si128(a, b); }
+
+    // Bit i is set if byte i of the block is set.
+    inline unsigned mask(Block v)
+    {
+        return static_cast<unsigned>(_mm_movemask_epi8(v));
+    }
+#elif defined(__ARM_NEON)
+    constexpr bool HasSIMD = true;
+
+    using Block = uint8x16_t;
+
+    inline Block load(const char *p)
+    {
+        return vld1q_u8(reinterpret_cast<const uint8_t *>(p));
+    }
+
+    inline Block eq(Block v, char c)
+    {
+        return vceqq_u8(v, vdupq_n_u8(static_cast<uint8_t>(c)));
+    }
+
+    inline Block inRange(Block v, char lo, char hi)
+    {
+        Block d = vsubq_u8(v, vdupq_n_u8(static_cast<uint8_t>(lo)));
+        return vcleq_u8(d, vdupq_n_u8(static_cast<uint8_t>(hi - lo)));
+    }
+
+    inline Block any(Block a, Block b) { return vorrq_u8(a, b); }
+
+    inline unsigned mask(Block v)
+    {
+        // NEON has no movemask. Weight every 0x00/0xff lane by its bit
+        // and add up each half instead.
+        static const uint8_t bits[16] = {1, 2, 4, 8, 16, 32, 64, 128,
+                                         1, 2, 4, 8, 16, 32, 64, 128};
+        uint8x16_t w = vandq_u8(v, vld1q_u8(bits));
+        return vaddv_u8(vget_low_u8(w)) | (vaddv_u8(vget_high_u8(w)) << 8);
+    }
+#else
+    constexpr bool HasSIMD = false;
+#endif
+
+    // Skip characters of the class cls using the lookup table.
+    inline const char *skipClass(const char *p, const char *end, uint8_t cls)
+    {
+        while (p != end && hasClass(*p, cls))
+            ++p;
+        return p;
+    }
+
+    inline const char *skipSpace(const char *p, const char *end)
+    {
+#if defined(__SSE2__) || defined(__ARM_NEON)
+        while (end - p >= 16)
+        {
+            Block v = load(p);
+            // '\t', '\n', '\v', '\f' and '\r' are contiguous.
+            unsigned m = mask(any(eq(v, ' '), inRange(v, '\t', '\r')));
+            if (m != 0xffff)
+                return p + __builtin_ctz(~m);
+            p += 16;
+        }
+#endif
+        return skipClass(p, end, CC_SPACE);
+    }
+
+    inline const char *skipAlnum(const char *p, const char *end)
+    {
+#if defined(__SSE2__) || defined(__ARM_NEON)
+        while (end - p >= 16)
+        {
+            Block v = load(p);
+            unsigned m = mask(any(any(inRange(v, 'a', 'z'), inRange(v, 'A', 'Z')),
+                                  inRange(v, '0', '9')));
+            if (m != 0xffff)
+                return p + __builtin_ctz(~m);
+            p += 16;
+        }
+#endif
+        return skipClass(p, end, CC_ALNUM);
+    }
+
+    // Skip the body of a line comment, stopping at '\n' or '\r'.
+    inline const char *skipLine(const char *p, const char *end)
+    {
+#if defined(__SSE2__) || defined(__ARM_NEON)
+        while (end - p >= 16)
+        {
+            Block v = load(p);
+            unsigned m = mask(any(eq(v, '\n'), eq(v, '\r')));
+            if (m)
+                return p + __builtin_ctz(m);
+            p += 16;
+        }
+#endif
+        while (p != end && *p != '\n' && *p != '\r')
+            ++p;
+        return p;
+    }
+
+    inline const char *skipDigits(const char *p, const char *end)
+    {
+        return skipClass(p, end, CC_DIGIT);
+    }
+}
+
+#endif
@@ -0,0 +1,56 @@
+#include "file_input.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFileInput::MappedFileInput(void *data, size_t size)
+    : MemoryInput(), data(data), size(size)
+{
+    buffer = std::string_view(static_cast<const char *>(data), size);
+}
+
+MappedFileInput::~MappedFileInput()
+{
+    if (data)
+        munmap(data, size);
+}
+
+FileInputResult MappedFileInput::Open(const std::string &path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return FileInputResult(Error("cannot open " + path + ": " + strerror(errno)));
+
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        int err = errno;
+        close(fd);
+        return FileInputResult(Error("cannot stat " + path + ": " + strerror(err)));
+    }
+
+    // mmap does not accept an empty mapping, an empty file is just EOF.
+    void *data = nullptr;
+    size_t size = static_cast<size_t>(st.st_size);
+    if (size > 0)
+    {
+        data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            int err = errno;
+            close(fd);
+            return FileInputResult(Error("cannot map " + path + ": " + strerror(err)));
+        }
+        // The lexer scans the file front to back exactly once.
+        madvise(data, size, MADV_SEQUENTIAL);
+    }
+    // The mapping stays valid after the descriptor is closed.
+    close(fd);
+
+    return FileInputResult(std::unique_ptr<MappedFileInput>(new MappedFileInput(data, size)));
+}
@@ -0,0 +1,33 @@
+#ifndef __FILE_INPUT_H__
+#define __FILE_INPUT_H__
+
+#include <memory>
+#include <string>
+
+#include "input.h"
+#include "utils/error.h"
+#include "utils/result.h"
+
+class MappedFileInput;
+
+using FileInputResult = Result<std::unique_ptr<MappedFileInput>, Error>;
+
+// MappedFileInput maps a whole source file into memory,
+// so the lexer can scan it without copying or reading it piece by piece.
+class MappedFileInput : public MemoryInput
+{
+    void *data = nullptr;
+    size_t size = 0;
+
+    MappedFileInput(void *data, size_t size);
+
+public:
+    ~MappedFileInput() override;
+
+    MappedFileInput(const MappedFileInput &) = delete;
+    MappedFileInput &operator=(const MappedFileInput &) = delete;
+
+    static FileInputResult Open(const std::string &path);
+};
+
+#endif
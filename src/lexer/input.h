@@ -1,12 +1,60 @@
 #ifndef __INPUT_H__
 #define __INPUT_H__
 
+#include <cstdio>
+#include <string_view>
+
 // IInput is an interface for the input of lexer (e.g. stdin, mock)
 class IInput
 {
 public:
     virtual ~IInput() = default;
     virtual int GetChar() = 0;
+
+    // NextChunk returns the next contiguous block of input, which stays valid
+    // until the following call. An empty chunk means EOF.
+    // The lexer scans over these chunks directly, so block-based inputs
+    // should override it. The default implementation falls back to GetChar
+    // and hands out one character at a time.
+    virtual std::string_view NextChunk()
+    {
+        int c = GetChar();
+        if (c == EOF)
+            return std::string_view();
+        lastChar = static_cast<char>(c);
+        return std::string_view(&lastChar, 1);
+    }
+
+private:
+    char lastChar;
+};
+
+// MemoryInput reads from a buffer that is already in memory.
+// The buffer is not owned and must outlive the input.
+class MemoryInput : public IInput
+{
+public:
+    MemoryInput(std::string_view buffer) : buffer(buffer) {}
+
+    int GetChar() override
+    {
+        if (pos >= buffer.size())
+            return EOF;
+        return static_cast<unsigned char>(buffer[pos++]);
+    }
+
+    std::string_view NextChunk() override
+    {
+        std::string_view chunk = buffer.substr(pos);
+        pos = buffer.size();
+        return chunk;
+    }
+
+protected:
+    MemoryInput() = default;
+
+    std::string_view buffer;
+    size_t pos = 0;
 };
 
-#endif
\ No newline at end of file
+#endif
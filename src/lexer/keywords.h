@@ -0,0 +1,69 @@
+#ifndef __KEYWORDS_H__
+#define __KEYWORDS_H__
+
+#include <array>
+#include <cstring>
+#include <string_view>
+
+#include "token.h"
+
+namespace keywords
+{
+    struct Keyword
+    {
+        std::string_view name;
+        int token;
+    };
+
+    // To add a keyword, add it here. The build fails if it collides with
+    // another keyword in the hash table below, in which case tweak hash().
+    inline constexpr Keyword List[] = {
+        {"def", tok_def},
+        {"extern", tok_extern},
+        {"if", tok_if},
+        {"then", tok_then},
+        {"else", tok_else},
+    };
+
+    constexpr size_t TableSize = 32;
+
+    // hash is a perfect hash over the keywords: it only looks at the length
+    // and the first and last characters, so it costs the same for any identifier.
+    constexpr size_t hash(const char *s, size_t len)
+    {
+        return (2 * len + static_cast<unsigned char>(s[0]) +
+                static_cast<unsigned char>(s[len - 1])) &
+               (TableSize - 1);
+    }
+
+    constexpr std::array<Keyword, TableSize> makeTable()
+    {
+        std::array<Keyword, TableSize> table{};
+        for (const Keyword &kw : List)
+            table[hash(kw.name.data(), kw.name.size())] = kw;
+        return table;
+    }
+
+    inline constexpr std::array<Keyword, TableSize> Table = makeTable();
+
+    constexpr bool isPerfect()
+    {
+        for (const Keyword &kw : List)
+            if (Table[hash(kw.name.data(), kw.name.size())].token != kw.token)
+                return false;
+        return true;
+    }
+
+    static_assert(isPerfect(), "keyword hash collision, adjust keywords::hash");
+
+    // find returns the keyword spelled by an identifier, or nullptr.
+    inline const Keyword *find(const char *s, size_t len)
+    {
+        const Keyword &kw = Table[hash(s, len)];
+        if (kw.name.size() == len && std::memcmp(kw.name.data(), s, len) == 0)
+            return &kw;
+        return nullptr;
+    }
+}
+
+#endif
@@ -1,89 +1,183 @@
 #include "lexer.h"
 #include "token.h"
 #include "input.h"
+#include "char_class.h"
+#include "keywords.h"
+#include "number.h"
+#include "utils/phase_timer.h"
 
 // The actual implementation of the lexer is a single function named gettok.
-// The gettok function is called to return the next token from standard input.
+// The gettok function is called to return the next token from the input.
+// It scans the current input chunk in place: characters are classified with
+// the charClass table and runs of whitespace, comment or identifier
+// characters are skipped with the scanners in char_class.h.
 int Lexer::gettok()
 {
-    // The first thing that it has to do is ignore whitespace between tokens.
-    while (isspace(lastChar))
+    while (true)
     {
-        lastChar = input->GetChar();
+        // The first thing that it has to do is ignore whitespace between tokens.
+        cur = scan::skipSpace(cur, end);
+        if (cur == end)
+        {
+            if (!refill())
+                return tok_eof;
+            continue;
+        }
+
+        // Line comment
+        if (*cur != '#')
+            break;
+        while ((cur = scan::skipLine(cur, end)) == end)
+        {
+            if (!refill())
+                return tok_eof;
+        }
     }
 
+    TokOffset = chunkOffset + static_cast<uint32_t>(cur - chunkStart);
+
     // The next thing gettok needs to do is recognize identifiers and specific keywords like "def".
     // Identifier: [a-zA-Z][a-zA-Z0-9]*
-    if (isalpha(lastChar))
-    {
-        IdentifierStr = lastChar;
+    if (hasClass(*cur, CC_ALPHA))
+        return lexIdentifier();
+
+    // Number: [0-9]*(.)?[0-9]*
+    if (hasClass(*cur, CC_DIGIT) || *cur == '.')
+        return lexNumber();
+
+    // Otherwise, just return the character as its ascii value
+    return static_cast<unsigned char>(*cur++);
+}
 
-        while (isalnum(lastChar = input->GetChar()))
+int Lexer::lexIdentifier()
+{
+    const char *start = cur;
+    cur = scan::skipAlnum(cur + 1, end);
+    std::string_view name(start, cur - start);
+
+    // The identifier may continue in the next chunk.
+    if (cur == end)
+    {
+        identBuf.assign(start, cur);
+        while (cur == end && refill())
         {
-            IdentifierStr += lastChar;
+            start = cur;
+            cur = scan::skipAlnum(cur, end);
+            identBuf.append(start, cur);
         }
-
-        if (IdentifierStr == "def")
-            return tok_def;
-        if (IdentifierStr == "extern")
-            return tok_extern;
-        if (IdentifierStr == "if")
-            return tok_if;
-        if (IdentifierStr == "then")
-            return tok_then;
-        if (IdentifierStr == "else")
-            return tok_else;
-        return tok_identifier;
+        name = identBuf;
     }
 
-    // Number: [0-9]*(.)?[0-9]*
-    if (isnumber(lastChar) || lastChar == '.')
+    if (const keywords::Keyword *kw = keywords::find(name.data(), name.size()))
     {
-        std::string NumStr;
+        IdentifierStr = kw->name;
+        return kw->token;
+    }
 
-        if (isnumber(lastChar))
-        {
-            do
-            {
-                NumStr += lastChar;
-                lastChar = input->GetChar();
-            } while (isnumber(lastChar));
-        }
-        if (lastChar == '.')
-        {
-            do
-            {
-                NumStr += lastChar;
-                lastChar = input->GetChar();
-            } while (isnumber(lastChar));
-        }
+    IdentifierSym = intern(name);
+    IdentifierStr = IdentifierSym.str();
+    return tok_identifier;
+}
 
-        NumVal = strtod(NumStr.c_str(), 0);
+Symbol Lexer::intern(std::string_view name)
+{
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for (char c : name)
+        h = (h ^ static_cast<unsigned char>(c)) * 16777619u;
+
+    Symbol &cached = symbolCache[h & (SymbolCacheSize - 1)];
+    if (cached.empty() || cached.str() != name)
+        cached = Symbol::Intern(name);
+    return cached;
+}
+
+int Lexer::lexNumber()
+{
+    const char *start = cur;
+    const char *p = scan::skipDigits(cur, end);
+    if (p != end && *p == '.')
+        p = scan::skipDigits(p + 1, end);
+
+    if (p != end)
+    {
+        // The whole literal is in this chunk, parse it in place.
+        NumVal = parseNumber(start, p);
+        cur = p;
         return tok_number;
     }
 
-    // Line comment
-    if (lastChar == '#')
+    // The literal reaches the end of the chunk and may continue in the next
+    // one, so collect it first.
+    std::string numStr(start, p);
+    bool frac = numStr.find('.') != std::string::npos;
+    cur = p;
+    while (cur == end && refill())
     {
-        do
-            lastChar = input->GetChar();
-        while (lastChar != EOF && lastChar != '\n' && lastChar != '\r');
-
-        if (lastChar != EOF)
-            return gettok();
+        start = cur;
+        cur = scan::skipDigits(cur, end);
+        if (!frac && cur != end && *cur == '.')
+        {
+            frac = true;
+            cur = scan::skipDigits(cur + 1, end);
+        }
+        numStr.append(start, cur);
     }
 
-    // EOF
-    if (lastChar == EOF)
-        return tok_eof;
+    NumVal = parseNumber(numStr.data(), numStr.data() + numStr.size());
+    return tok_number;
+}
 
-    // Otherwise, just return the character as its ascii value
-    int ThisChar = lastChar;
-    lastChar = input->GetChar();
-    return ThisChar;
+bool Lexer::refill()
+{
+    if (eof)
+        return false;
+    std::string_view chunk = input->NextChunk();
+    if (chunk.empty())
+    {
+        eof = true;
+        return false;
+    }
+    chunkOffset += static_cast<uint32_t>(end - chunkStart);
+    cur = chunkStart = chunk.data();
+    end = cur + chunk.size();
+    if (lines)
+        lines->Scan(chunk, chunkOffset);
+    return true;
 }
 
 int Lexer::GetNextToken()
 {
     return CurTok = gettok();
 }
+
+int Lexer::LexInto(TokenBuffer &tokens)
+{
+    int tok = GetNextToken();
+    switch (tok)
+    {
+    case tok_identifier:
+        tokens.pushIdentifier(IdentifierSym, TokOffset);
+        break;
+    case tok_number:
+        tokens.pushNumber(NumVal, TokOffset);
+        break;
+    case tok_eof:
+        // EOF has no characters, it is located right after the input.
+        tokens.push(tok, chunkOffset + static_cast<uint32_t>(cur - chunkStart));
+        break;
+    default:
+        tokens.push(tok, TokOffset);
+        break;
+    }
+    return tok;
+}
+
+TokenBuffer Lexer::Tokenize()
+{
+    ScopedPhase timer(Phase::Lex);
+    TokenBuffer tokens;
+    while (LexInto(tokens) != tok_eof)
+        ;
+    return tokens;
+}
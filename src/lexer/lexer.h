@@ -1,20 +1,32 @@
 #ifndef __LEXER_H__
 #define __LEXER_H__
 
+#include <cstddef>
+#include <memory>
 #include <string>
+#include <string_view>
+
 #include "input.h"
+#include "source_lines.h"
+#include "token_buffer.h"
+#include "utils/symbol.h"
 
 class Lexer
 {
 public:
     // If the current token is an identifier
-    // IdentifierStr will hold the name of the identifier
-    std::string IdentifierStr;
+    // IdentifierSym will hold its interned name and
+    // IdentifierStr will hold the name of the identifier.
+    Symbol IdentifierSym;
+    std::string_view IdentifierStr;
 
     // If the current token is a numeric literal
     // NumVal holds its value
     double NumVal;
 
+    // TokOffset is the offset of the current token from the start of the input.
+    uint32_t TokOffset = 0;
+
     /// CurTok/getNextToken - Provide a simple token buffer.
     /// CurTok is the current token the parser is looking at.
     /// getNextToken reads another token from the
@@ -22,16 +34,50 @@ public:
     int CurTok;
     int GetNextToken();
 
+    // Tokenize lexes the rest of the input into a token buffer,
+    // which ends with tok_eof.
+    TokenBuffer Tokenize();
+
+    // Lex the next token and append it to tokens.
+    int LexInto(TokenBuffer &tokens);
+
     Lexer(std::unique_ptr<IInput> input) : input(std::move(input)) {}
 
+    // TrackLines records in lines where the lines of the input start, so
+    // that token offsets can be mapped to lines. It must be called before
+    // lexing.
+    void TrackLines(SourceLines *lines) { this->lines = lines; }
+
 private:
     std::unique_ptr<IInput> input;
+    SourceLines *lines = nullptr;
+
+    // The chunk of input being scanned, cur points to the next unread character.
+    // The input is only consulted again once the chunk is used up.
+    const char *cur = nullptr;
+    const char *end = nullptr;
+    bool eof = false;
+
+    // The start of the chunk and its offset from the start of the input.
+    const char *chunkStart = nullptr;
+    uint32_t chunkOffset = 0;
+
+    // Holds an identifier that spans several chunks.
+    std::string identBuf;
+
+    // A small direct-mapped cache in front of the global symbol table.
+    // Most identifiers repeat, and a hit costs no lock or hash table probe.
+    static constexpr size_t SymbolCacheSize = 1024;
+    Symbol symbolCache[SymbolCacheSize];
+
+    Symbol intern(std::string_view name);
+
+    bool refill();
 
-    // gettok works by calling the C getchar() function to read characters
-    // one at a time from standard input. It eats them as it recognizes them
-    // and stores the last character read, but not processed, in LastChar.
-    int lastChar = ' ';
+    // gettok scans the input chunk in place and returns the next token.
     int gettok();
+    int lexIdentifier();
+    int lexNumber();
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,49 @@
+#ifndef __NUMBER_H__
+#define __NUMBER_H__
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+
+// parseNumber converts a numeric literal [0-9]*(.[0-9]*)? in [first, last)
+// straight from the input, like std::from_chars, without building a string.
+//
+// When the significant digits fit in a double's 53-bit mantissa and there are
+// at most 22 fractional digits, both the mantissa and the power of ten are
+// exact doubles, so a single division gives the correctly rounded result.
+// Longer literals fall back to strtod.
+inline double parseNumber(const char *first, const char *last)
+{
+    static constexpr double pow10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    constexpr uint64_t maxExact = uint64_t(1) << 53;
+
+    uint64_t mantissa = 0;
+    int fracDigits = 0;
+    bool frac = false;
+    bool exact = true;
+    for (const char *p = first; p != last; ++p)
+    {
+        if (*p == '.')
+        {
+            frac = true;
+            continue;
+        }
+        mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+        if (frac)
+            fracDigits++;
+        if (mantissa >= maxExact || fracDigits > 22)
+        {
+            exact = false;
+            break;
+        }
+    }
+    if (exact)
+        return static_cast<double>(mantissa) / pow10[fracDigits];
+
+    std::string str(first, last);
+    return strtod(str.c_str(), nullptr);
+}
+
+#endif
@@ -0,0 +1,19 @@
+#include "source_lines.h"
+
+#include <algorithm>
+#include <cstring>
+
+void SourceLines::Scan(std::string_view chunk, uint32_t offset)
+{
+    const char *p = chunk.data();
+    const char *end = p + chunk.size();
+    while ((p = static_cast<const char *>(std::memchr(p, '\n', end - p))))
+        starts.push_back(offset + static_cast<uint32_t>(++p - chunk.data()));
+}
+
+SourceLocation SourceLines::Locate(uint32_t offset) const
+{
+    auto next = std::upper_bound(starts.begin(), starts.end(), offset);
+    size_t line = next - starts.begin();
+    return SourceLocation{static_cast<unsigned>(line), offset - *(next - 1) + 1};
+}
@@ -0,0 +1,40 @@
+#ifndef __SOURCE_LINES_H__
+#define __SOURCE_LINES_H__
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// SourceLocation is a line and a column in the source, both from 1.
+struct SourceLocation
+{
+    unsigned Line;
+    unsigned Column;
+};
+
+// SourceLines maps offsets in the source, like those of tokens and AST
+// nodes, to lines and columns. Tokens only carry their offset; where lines
+// start is recorded by the lexer as it reads the input, and only if asked
+// to, see Lexer::TrackLines. Once lexing is done, any number of threads
+// may locate offsets.
+class SourceLines
+{
+    std::string path;
+    // The offsets at which lines start, in order.
+    std::vector<uint32_t> starts = {0};
+
+public:
+    explicit SourceLines(std::string path) : path(std::move(path)) {}
+
+    // Path is the file the source was read from.
+    const std::string &Path() const { return path; }
+
+    // Scan records the lines starting in chunk, which is at offset in the
+    // source. Chunks must be scanned in order.
+    void Scan(std::string_view chunk, uint32_t offset);
+
+    SourceLocation Locate(uint32_t offset) const;
+};
+
+#endif
@@ -0,0 +1,33 @@
+#include "stdin_input.h"
+
+#include <cerrno>
+#include <unistd.h>
+
+bool StdIn::fill()
+{
+    while (true)
+    {
+        ssize_t n = read(STDIN_FILENO, buffer, BufferSize);
+        if (n < 0 && errno == EINTR)
+            continue;
+        pos = 0;
+        len = n > 0 ? static_cast<size_t>(n) : 0;
+        return len > 0;
+    }
+}
+
+int StdIn::GetChar()
+{
+    if (pos == len && !fill())
+        return EOF;
+    return static_cast<unsigned char>(buffer[pos++]);
+}
+
+std::string_view StdIn::NextChunk()
+{
+    if (pos == len && !fill())
+        return std::string_view();
+    std::string_view chunk(buffer + pos, len - pos);
+    pos = len;
+    return chunk;
+}
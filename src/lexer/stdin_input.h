@@ -0,0 +1,26 @@
+#ifndef __STDIN_INPUT_H__
+#define __STDIN_INPUT_H__
+
+#include "input.h"
+
+// StdIn reads standard input in blocks with read(2) instead of going
+// through getchar() for every character. read returns as soon as some input
+// is available, so an interactive session still gets one line at a time.
+class StdIn : public IInput
+{
+    static constexpr size_t BufferSize = 64 * 1024;
+
+    char buffer[BufferSize];
+    size_t pos = 0;
+    size_t len = 0;
+
+    bool fill();
+
+public:
+    StdIn() = default;
+
+    int GetChar() override;
+    std::string_view NextChunk() override;
+};
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef __TOKEN_BUFFER_H__
+#define __TOKEN_BUFFER_H__
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "token.h"
+#include "utils/symbol.h"
+
+// TokenBuffer is a contiguous sequence of lexed tokens, stored as a struct
+// of arrays: the token kind, its offset in the source, and its payload,
+// which is the Symbol ID of an identifier or the value of a number.
+// Tokens are addressed by index, so a reader can look ahead or go back
+// to any earlier token.
+class TokenBuffer
+{
+    std::vector<int16_t> kinds;
+    std::vector<uint32_t> offsets;
+    std::vector<uint64_t> payloads;
+
+public:
+    size_t size() const { return kinds.size(); }
+    bool empty() const { return kinds.empty(); }
+
+    void reserve(size_t n)
+    {
+        kinds.reserve(n);
+        offsets.reserve(n);
+        payloads.reserve(n);
+    }
+
+    void push(int kind, uint32_t offset, uint64_t payload = 0)
+    {
+        kinds.push_back(static_cast<int16_t>(kind));
+        offsets.push_back(offset);
+        payloads.push_back(payload);
+    }
+
+    void pushIdentifier(Symbol sym, uint32_t offset)
+    {
+        push(tok_identifier, offset, sym.getId());
+    }
+
+    void pushNumber(double val, uint32_t offset)
+    {
+        uint64_t bits;
+        std::memcpy(&bits, &val, sizeof(bits));
+        push(tok_number, offset, bits);
+    }
+
+    // Remove the first n tokens, e.g. the ones a streaming parser is done with.
+    void dropFront(size_t n)
+    {
+        kinds.erase(kinds.begin(), kinds.begin() + n);
+        offsets.erase(offsets.begin(), offsets.begin() + n);
+        payloads.erase(payloads.begin(), payloads.begin() + n);
+    }
+
+    int kind(size_t i) const { return kinds[i]; }
+    uint32_t offset(size_t i) const { return offsets[i]; }
+
+    Symbol symbol(size_t i) const
+    {
+        return Symbol::FromId(static_cast<uint32_t>(payloads[i]));
+    }
+
+    double number(size_t i) const
+    {
+        double val;
+        std::memcpy(&val, &payloads[i], sizeof(val));
+        return val;
+    }
+};
+
+#endif
@@ -1,8 +1,9 @@
 #include "logger.h"
+#include "utils/diagnostics.h"
 
 std::unique_ptr<ExprAST> ParseError(const char *Str)
 {
-    fprintf(stderr, "ParseError: %s\n", Str);
+    Diagnostics::Printf(DiagCategory::Error, "ParseError: %s\n", Str);
     return nullptr;
 }
 
@@ -19,5 +20,5 @@ std::unique_ptr<FunctionAST> ParseErrorFunc(const char *Str)
 }
 
 void CodegenError(const char *Str) {
-    fprintf(stderr, "CodegenError: %s\n", Str);
+    Diagnostics::Printf(DiagCategory::Error, "CodegenError: %s\n", Str);
 }
@@ -1,46 +1,424 @@
 #include <memory>
 #include <iostream>
 #include <cstdlib>
+#include <cstring>
+#include <optional>
+
+#include <signal.h>
 
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/Support/ManagedStatic.h"
 
 #include "lexer/input.h"
+#include "lexer/file_input.h"
+#include "lexer/stdin_input.h"
 #include "lexer/lexer.h"
 #include "lexer/token.h"
 #include "parser/parser.h"
+#include "utils/diagnostics.h"
 #include "utils/printer.h"
+#include "aot/aot_compiler.h"
 #include "codegen/codegen.h"
+#include "codegen/parallel_codegen.h"
+#include "interp/interpreter.h"
+#include "passes/pass_manager.h"
+#include "jit/jit_manager.h"
+#include "utils/memory_usage.h"
+#include "utils/phase_timer.h"
+#include "utils/startup_profile.h"
+#include "utils/thread_pool.h"
 
 using namespace std;
 
-class StdIn : public IInput
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-j threads] [--batch] [--shards n] [--lazy] [-O0|-O1|-O2|-O3|-Os] [--debug-passes] [--ipo] [--tiered [--tier-up n]] [--redefine] [--code-budget kb] [--interp] [--cache dir [--cache-size mb]] [--perf-map] [--jitdump] [--gdb-jit] [--jitlink [--slab-size kb] [--huge-pages]] [--mem-stats] [--emit-obj|--emit-exe|--emit-lib out] [-g] [--parse-only|--check] [--startup-profile] [--time-phases|--time-functions] [--time-trace out] [-q|-v|-vv|--diag list] [file]\n", argv0);
+    fprintf(stderr, "  -j threads  parse and compile the file as a whole on this many threads\n");
+    fprintf(stderr, "  --batch     compile the file as a whole into a single module,\n");
+    fprintf(stderr, "              with -j only parsing it in parallel\n");
+    fprintf(stderr, "  --shards n  compile the file as a whole into n modules\n");
+    fprintf(stderr, "  --lazy      compile every function on its first call\n");
+    fprintf(stderr, "  -O<level>   optimization level, -O2 by default;\n");
+    fprintf(stderr, "              above -O0, the AST is simplified before codegen\n");
+    fprintf(stderr, "  --debug-passes\n");
+    fprintf(stderr, "              log the optimization passes run\n");
+    fprintf(stderr, "  --ipo       inline and optimize across function definitions\n");
+    fprintf(stderr, "  --tiered    compile functions without optimization first,\n");
+    fprintf(stderr, "              and optimize them after n calls (--tier-up, 1000)\n");
+    fprintf(stderr, "  --redefine  let functions be defined again, replacing them for all callers;\n");
+    fprintf(stderr, "              not with --ipo, or with a file compiled as a whole\n");
+    fprintf(stderr, "  --code-budget kb\n");
+    fprintf(stderr, "              keep the code of recently called functions within kb kilobytes,\n");
+    fprintf(stderr, "              compiling the others again on their next call\n");
+    fprintf(stderr, "  --interp    interpret top-level expressions instead of compiling them\n");
+    fprintf(stderr, "  --cache dir keep compiled code in dir for later runs,\n");
+    fprintf(stderr, "              up to mb megabytes (--cache-size, 256)\n");
+    fprintf(stderr, "  --perf-map  name compiled functions for perf in /tmp/perf-<pid>.map\n");
+    fprintf(stderr, "  --jitdump   name them in a jitdump file for perf inject\n");
+    fprintf(stderr, "  --gdb-jit   register them with GDB's JIT interface\n");
+    fprintf(stderr, "  --jitlink   link with JITLink, packing the code into slabs of\n");
+    fprintf(stderr, "              kb kilobytes (--slab-size, 2048), of huge pages with --huge-pages\n");
+    fprintf(stderr, "  --mem-stats report the resident memory and mappings at start and exit,\n");
+    fprintf(stderr, "              and the memory kept for each function\n");
+    fprintf(stderr, "  --emit-obj out\n");
+    fprintf(stderr, "              compile the functions to a native object file\n");
+    fprintf(stderr, "  --emit-lib out\n");
+    fprintf(stderr, "              compile the functions to a static library\n");
+    fprintf(stderr, "  --emit-exe out\n");
+    fprintf(stderr, "              compile to an executable printing the top-level expressions\n");
+    fprintf(stderr, "  -g          emit line tables for debuggers and profilers\n");
+    fprintf(stderr, "  --parse-only\n");
+    fprintf(stderr, "              only parse the input\n");
+    fprintf(stderr, "  --check     only parse and generate code, without running it\n");
+    fprintf(stderr, "  --startup-profile\n");
+    fprintf(stderr, "              report when the first prompt and the first result came\n");
+    fprintf(stderr, "  --time-phases\n");
+    fprintf(stderr, "              report the time spent in each phase on exit and on SIGUSR1\n");
+    fprintf(stderr, "  --time-functions\n");
+    fprintf(stderr, "              also report the functions that took longest\n");
+    fprintf(stderr, "  --time-trace out\n");
+    fprintf(stderr, "              write every phase to out as a Chrome trace\n");
+    fprintf(stderr, "  -q          only report errors and results\n");
+    fprintf(stderr, "  -v, -vv     also print the AST, and the IR with -vv\n");
+    fprintf(stderr, "  --diag list report exactly the comma separated categories in list:\n");
+    fprintf(stderr, "              error, prompt, result, stats, ast, ir, all or none\n");
+}
+
+// The memory used before anything was compiled, with --mem-stats.
+static std::optional<MemoryUsage> memoryAtStart;
+
+static void reportJIT(const JITManager &jm)
+{
+    if (jm.IsLazy())
+        Diagnostics::Printf(DiagCategory::Stats, "\n%zu of %zu functions compiled\n", jm.NumMaterialized(), jm.NumLazy());
+    if (jm.IsTiered())
+        Diagnostics::Printf(DiagCategory::Stats, "\n%zu of %zu functions optimized\n", jm.NumTieredUp(), jm.NumTiered());
+    if (jm.IsRedefinable())
+        Diagnostics::Printf(DiagCategory::Stats, "\n%zu functions redefined\n", jm.NumRedefined());
+    if (const DiskObjectCache *cache = jm.Cache())
+        Diagnostics::Printf(DiagCategory::Stats, "\n%zu objects loaded from the cache, %zu compiled, %zu evicted\n",
+                            cache->NumHits(), cache->NumMisses(), cache->NumEvictions());
+    if (jm.HasCodeBudget())
+        Diagnostics::Printf(DiagCategory::Stats, "\n%.1f of %zu KiB of code budget used, %zu modules evicted, %zu compiled again\n",
+                            jm.LoadedCodeBytes() / 1024.0, jm.CodeBudget() >> 10, jm.NumEvicted(), jm.NumReloaded());
+    if (const SlabMemoryManager *slabs = jm.Slabs())
+        Diagnostics::Printf(DiagCategory::Stats, "\n%.1f of %zu KiB of code memory used, in %zu slabs\n",
+                            slabs->UsedBytes() / 1024.0, slabs->SlabBytes() >> 10, slabs->NumSlabs());
+    if (memoryAtStart)
+    {
+        MemoryUsage now = MemoryUsage::Current();
+        Diagnostics::Printf(DiagCategory::Stats, "\n%zu -> %zu KiB resident, %zu -> %zu mappings\n",
+                            memoryAtStart->ResidentBytes >> 10, now.ResidentBytes >> 10,
+                            memoryAtStart->NumMappings, now.NumMappings);
+        MemoryAccounting::Report();
+    }
+}
+
+static void requestPhaseReport(int)
 {
-public:
-    StdIn() = default;
+    PhaseTimers::RequestReport();
+}
 
-    int GetChar() override { return getchar(); }
-};
+static void writePhaseTrace()
+{
+    if (auto err = PhaseTimers::WriteTrace())
+        Diagnostics::Printf(DiagCategory::Error, "error: %s\n", err->message.c_str());
+}
 
-int main()
+int main(int argc, char **argv)
 {
-    std::unique_ptr<IInput> stdInput = std::make_unique<StdIn>();
-    std::unique_ptr<Lexer> lexer = std::make_unique<Lexer>(std::move(stdInput));
-    fprintf(stderr, "ready> ");
-    lexer->GetNextToken();
-    std::unique_ptr<Parser> parser = std::make_unique<Parser>(std::move(lexer));
+    // Number of threads to parse a source file with.
+    size_t jobs = 1;
+    // Number of modules to compile a source file into, 0 for a few per job.
+    size_t shards = 0;
+    bool batch = false;
+    bool interp = false;
+    bool parseOnly = false;
+    bool check = false;
+    bool debugInfo = false;
+    bool timePhases = false;
+    bool timeFunctions = false;
+    JITOptions jitOpts;
+    OptimizerOptions optOpts;
+    std::optional<AOTOptions> aotOpts;
+    const char *path = nullptr;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            jobs = strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--batch") == 0)
+            batch = true;
+        else if (strcmp(argv[i], "--shards") == 0 && i + 1 < argc)
+        {
+            batch = true;
+            shards = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--lazy") == 0)
+            jitOpts.Lazy = true;
+        else if (strncmp(argv[i], "-O", 2) == 0 && ParseOptLevel(argv[i] + 2))
+            optOpts.Level = *ParseOptLevel(argv[i] + 2);
+        else if (strcmp(argv[i], "--debug-passes") == 0)
+            optOpts.DebugPasses = true;
+        else if (strcmp(argv[i], "--ipo") == 0)
+            optOpts.CrossModule = true;
+        else if (strcmp(argv[i], "--tiered") == 0)
+            jitOpts.Tiered = true;
+        else if (strcmp(argv[i], "--tier-up") == 0 && i + 1 < argc)
+        {
+            // A threshold of 0 would turn tiering off.
+            char *end;
+            jitOpts.TierUpThreshold = strtoull(argv[++i], &end, 10);
+            if (jitOpts.TierUpThreshold == 0 || *end != '\0')
+            {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strcmp(argv[i], "--redefine") == 0)
+            jitOpts.Redefinable = true;
+        else if (strcmp(argv[i], "--code-budget") == 0 && i + 1 < argc)
+            jitOpts.CodeBudget = strtoull(argv[++i], nullptr, 10) << 10;
+        else if (strcmp(argv[i], "--interp") == 0)
+            interp = true;
+        else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+            jitOpts.CacheDir = argv[++i];
+        else if (strcmp(argv[i], "--cache-size") == 0 && i + 1 < argc)
+            jitOpts.CacheMaxBytes = strtoull(argv[++i], nullptr, 10) << 20;
+        else if (strcmp(argv[i], "--perf-map") == 0)
+            jitOpts.PerfMapPath = PerfMapListener::DefaultPath();
+        else if (strcmp(argv[i], "--jitdump") == 0)
+            jitOpts.JITDump = true;
+        else if (strcmp(argv[i], "--gdb-jit") == 0)
+            jitOpts.GDBRegistration = true;
+        else if (strcmp(argv[i], "--jitlink") == 0)
+            jitOpts.JITLink = true;
+        else if (strcmp(argv[i], "--slab-size") == 0 && i + 1 < argc)
+            jitOpts.SlabSize = strtoull(argv[++i], nullptr, 10) << 10;
+        else if (strcmp(argv[i], "--huge-pages") == 0)
+            jitOpts.HugePages = true;
+        else if (strcmp(argv[i], "--mem-stats") == 0)
+        {
+            memoryAtStart = MemoryUsage::Current();
+            MemoryAccounting::Enable();
+        }
+        else if (strcmp(argv[i], "--parse-only") == 0)
+            parseOnly = true;
+        else if (strcmp(argv[i], "--check") == 0)
+            check = true;
+        else if (strcmp(argv[i], "-g") == 0)
+            debugInfo = true;
+        else if (strcmp(argv[i], "-q") == 0)
+            Diagnostics::SetEnabled(Diagnostics::Quiet);
+        else if (strcmp(argv[i], "-v") == 0)
+            Diagnostics::SetEnabled(Diagnostics::Verbose);
+        else if (strcmp(argv[i], "-vv") == 0)
+            Diagnostics::SetEnabled(Diagnostics::All);
+        else if (strcmp(argv[i], "--diag") == 0 && i + 1 < argc && Diagnostics::ParseCategories(argv[i + 1]))
+            Diagnostics::SetEnabled(*Diagnostics::ParseCategories(argv[++i]));
+        else if (strcmp(argv[i], "--startup-profile") == 0)
+            atexit(StartupProfile::Print);
+        else if (strcmp(argv[i], "--time-phases") == 0)
+            timePhases = true;
+        else if (strcmp(argv[i], "--time-functions") == 0)
+            timePhases = timeFunctions = true;
+        else if (strcmp(argv[i], "--time-trace") == 0 && i + 1 < argc)
+            PhaseTimers::EnableTrace(argv[++i]);
+        else if (strncmp(argv[i], "--emit-", 7) == 0 && i + 1 < argc)
+        {
+            aotOpts = AOTOptions();
+            if (strcmp(argv[i], "--emit-obj") == 0)
+                aotOpts->Kind = OutputKind::Object;
+            else if (strcmp(argv[i], "--emit-exe") == 0)
+                aotOpts->Kind = OutputKind::Executable;
+            else if (strcmp(argv[i], "--emit-lib") == 0)
+                aotOpts->Kind = OutputKind::StaticLibrary;
+            else
+            {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            aotOpts->OutputPath = argv[++i];
+        }
+        else if (argv[i][0] != '-' && !path)
+            path = argv[i];
+        else
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Code inlined across functions would keep running old definitions.
+    if (jitOpts.isRedefinable() && optOpts.CrossModule)
+    {
+        Diagnostics::Printf(DiagCategory::Error, "--redefine cannot be used with --ipo\n");
+        return EXIT_FAILURE;
+    }
+    // Only a source file can be compiled as a whole.
+    if ((batch || jobs != 1) && !path)
+    {
+        Diagnostics::Printf(DiagCategory::Error, "--batch, --shards and -j need a file\n");
+        return EXIT_FAILURE;
+    }
+    // A program compiled as a whole has one definition per function.
+    if (jitOpts.isRedefinable() && (batch || jobs != 1))
+    {
+        Diagnostics::Printf(DiagCategory::Error, "--redefine cannot be used with --batch, --shards or -j\n");
+        return EXIT_FAILURE;
+    }
+
+    if (timePhases)
+    {
+        PhaseTimers::Enable(timeFunctions);
+        atexit(PhaseTimers::Report);
+        signal(SIGUSR1, requestPhaseReport);
+    }
+    if (PhaseTimers::Enabled())
+        atexit(writePhaseTrace);
+
+    // With -g, the lexer records where lines start, to locate the code.
+    std::unique_ptr<SourceLines> lines;
+    if (debugInfo)
+        lines = std::make_unique<SourceLines>(path ? path : "<stdin>");
+
+    // A source file is lexed in one go before parsing,
+    // stdin is lexed as the parser asks for tokens.
+    std::unique_ptr<Parser> parser;
+    if (path)
+    {
+        auto r = MappedFileInput::Open(path);
+        if (r.isError())
+        {
+            Diagnostics::Printf(DiagCategory::Error, "%s\n", r.error().message.c_str());
+            return EXIT_FAILURE;
+        }
+        Lexer lexer(r.value());
+        lexer.TrackLines(lines.get());
+        parser = std::make_unique<Parser>(std::make_shared<TokenBuffer>(lexer.Tokenize()));
+    }
+    else
+    {
+        auto lexer = std::make_unique<Lexer>(std::make_unique<StdIn>());
+        lexer->TrackLines(lines.get());
+        parser = std::make_unique<Parser>(std::move(lexer));
+        Diagnostics::SetInteractive(true);
+    }
+    Diagnostics::Printf(DiagCategory::Prompt, "ready> ");
+    StartupProfile::Record(StartupProfile::FirstPrompt);
 
     std::unique_ptr<Printer> printer = std::make_unique<Printer>();
-    std::unique_ptr<CodeGen> codegen = std::make_unique<CodeGen>();
     std::vector<Visitor *> visitors;
-    visitors.push_back(printer.get());
+    if (Diagnostics::Enabled(DiagCategory::AST))
+        visitors.push_back(printer.get());
+
+    // The AST passes run on every item after it is printed and before it
+    // is compiled.
+    ASTPassManager passes(/*inlining*/ !jitOpts.isRedefinable());
+    if (optOpts.Level != OptLevel::O0 && !parseOnly)
+        visitors.push_back(&passes);
+
+    // Parsing and checking never need the JIT, so it is not created.
+    if (parseOnly || check)
+    {
+        std::unique_ptr<CodeGen> checker;
+        if (check)
+        {
+            checker = std::make_unique<CodeGen>(std::make_shared<JITManager>(jitOpts, optOpts));
+            checker->CheckOnly = true;
+            checker->DebugLines = lines.get();
+            visitors.push_back(checker.get());
+        }
+        ProgramResult r = parser->ParseProgram(visitors);
+        if (r.isError())
+        {
+            Diagnostics::Printf(DiagCategory::Error, "%s", r.error().message.c_str());
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    // Ahead of time, the program is parsed as a whole and written out
+    // instead of being run.
+    if (aotOpts)
+    {
+        ThreadPool pool(jobs);
+        ProgramResult r = parser->ParseProgramParallel(pool, visitors);
+        if (r.isError())
+        {
+            Diagnostics::Printf(DiagCategory::Error, "%s", r.error().message.c_str());
+            return EXIT_FAILURE;
+        }
+        auto program = r.value();
+
+        aotOpts->DebugLines = lines.get();
+        // The JIT optimizes lazy and tiered code only as it runs, ahead of
+        // time everything is optimized up front.
+        JITOptions aotJitOpts = jitOpts;
+        aotJitOpts.Lazy = aotJitOpts.Tiered = false;
+        AOTCompiler compiler(std::make_shared<JITManager>(aotJitOpts, optOpts));
+        if (auto err = compiler.Compile(program.get(), *aotOpts))
+        {
+            Diagnostics::Printf(DiagCategory::Error, "%s\n", err->message.c_str());
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    // In batch mode, or with several jobs, a source file is parsed and
+    // compiled as a whole on a thread pool. Otherwise every item is
+    // compiled as soon as it is parsed.
+    if (batch || jobs != 1)
+    {
+        // --batch compiles a single module even with several jobs, which
+        // then only parse in parallel.
+        if (batch && shards == 0)
+            shards = 1;
+
+        ThreadPool pool(jobs);
+        ProgramResult r = parser->ParseProgramParallel(pool, visitors);
+        if (r.isError())
+        {
+            Diagnostics::Printf(DiagCategory::Error, "%s", r.error().message.c_str());
+            return EXIT_FAILURE;
+        }
+        auto program = r.value();
+
+        if (pool.size() > 1)
+            jitOpts.NumCompileThreads = pool.size();
+        auto jm = std::make_shared<JITManager>(jitOpts, optOpts);
+        ParallelCodeGen codegen(pool, jm, shards);
+        codegen.DebugLines = lines.get();
+        auto err = codegen.Compile(program.get());
+        reportJIT(*jm);
+        if (err)
+        {
+            Diagnostics::Printf(DiagCategory::Error, "%s\n", err->message.c_str());
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    auto jm = std::make_shared<JITManager>(jitOpts, optOpts);
+    std::unique_ptr<CodeGen> codegen = std::make_unique<CodeGen>(jm);
+    codegen->DebugLines = lines.get();
     visitors.push_back(codegen.get());
 
-    ParseResult r = parser->ParseProgram(visitors);
+    // Functions called from top-level expressions are interpreted until
+    // they are hot, then compiled by the JIT.
+    Interpreter interpreter([&jm](Symbol name)
+                            { return jm->JITLookup(std::string(name.str())); });
+    if (interp)
+        codegen->Interp = &interpreter;
+
+    // Every item is compiled or run as it is parsed, so none of them is kept.
+    parser->KeepItems = false;
+    passes.KeepNodes = false;
+    ProgramResult r = parser->ParseProgram(visitors);
+    reportJIT(*jm);
     if (r.isError())
     {
-        fprintf(stderr, "%s", r.error().message.c_str());
+        Diagnostics::Printf(DiagCategory::Error, "%s", r.error().message.c_str());
         return EXIT_FAILURE;
     }
     return EXIT_SUCCESS;
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iostream>
 
 #include "lexer/token.h"
@@ -10,26 +11,29 @@
 
 #include "parser.h"
 #include "logger.h"
+#include "utils/diagnostics.h"
+#include "utils/memory_usage.h"
+#include "utils/phase_timer.h"
 
 // This routine expects to be called when the current token is a tok_number.
 // It takes the current number value and creates a NumberExprAST node.
 ParseResult Parser::parseNumberExpr()
 {
-    auto v = std::make_unique<NumberExprAST>(lexer->NumVal);
-    lexer->GetNextToken();
-    return ParseResult(std::move(v));
+    auto v = make<NumberExprAST>(curOffset(), curNumber());
+    nextToken();
+    return ParseResult(v);
 }
 
 // This routine parses expressions in "(" and ")" characters
 ParseResult Parser::parseParenExpr()
 {
-    lexer->GetNextToken(); // eat '('
+    nextToken(); // eat '('
     auto r = parseExpression();
     if (r.isError())
         return r;
-    if (lexer->CurTok != ')')
+    if (curTok() != ')')
         return ParseResult(Error("expected ')'"));
-    lexer->GetNextToken(); // eat ')'
+    nextToken(); // eat ')'
     return r;
 }
 
@@ -38,72 +42,74 @@ ParseResult Parser::parseParenExpr()
 ///     | identifier '(' expression* ')'
 ParseResult Parser::parseIdentifierExpr()
 {
-    std::string idName = lexer->IdentifierStr;
-    lexer->GetNextToken(); // eat identifier
+    Symbol idName = curSymbol();
+    uint32_t offset = curOffset();
+    nextToken(); // eat identifier
 
-    if (lexer->CurTok != '(')
+    if (curTok() != '(')
     {
-        return ParseResult(std::make_unique<VariableExprAST>(idName));
+        return ParseResult(make<VariableExprAST>(offset, idName));
     }
 
-    lexer->GetNextToken(); // eat '('
-    std::vector<std::unique_ptr<ExprAST>> args;
-    if (lexer->CurTok != ')')
+    nextToken(); // eat '('
+    // Arguments of nested calls are pushed above ours.
+    size_t argBase = argStack.size();
+    if (curTok() != ')')
     {
         while (true)
         {
             auto r = parseExpression();
             if (r.isError())
+            {
+                argStack.resize(argBase);
                 return r;
-            std::unique_ptr<AST> v = r.value();
-            std::unique_ptr<ExprAST> arg(static_cast<ExprAST *>(v.release()));
-            args.push_back(std::move(arg));
+            }
+            argStack.push_back(static_cast<ExprAST *>(r.value()));
 
-            if (lexer->CurTok == ')')
+            if (curTok() == ')')
                 break;
 
-            if (lexer->CurTok != ',')
+            if (curTok() != ',')
+            {
+                argStack.resize(argBase);
                 return ParseResult(Error("expected ')' or ',' after an argument of a call expression"));
-            lexer->GetNextToken(); // eat ','
+            }
+            nextToken(); // eat ','
         }
     }
 
-    lexer->GetNextToken(); // eat ')'
-    return ParseResult(std::make_unique<CallExprAST>(idName, std::move(args)));
+    nextToken(); // eat ')'
+    auto args = arena->copyArray(argStack.data() + argBase, argStack.size() - argBase);
+    argStack.resize(argBase);
+    return ParseResult(make<CallExprAST>(offset, idName, args));
 }
 
 ParseResult Parser::parseIfExpr()
 {
-    lexer->GetNextToken(); // eat 'if'
+    uint32_t offset = curOffset();
+    nextToken(); // eat 'if'
     auto r = parseExpression();
     if (r.isError())
         return r;
-    std::unique_ptr<AST> v = r.value();
-    std::unique_ptr<ExprAST> _cond(static_cast<ExprAST *>(v.release()));
+    auto _cond = static_cast<ExprAST *>(r.value());
 
-    if (lexer->CurTok != tok_then)
+    if (curTok() != tok_then)
         return ParseResult(Error("expected then"));
-    lexer->GetNextToken(); // eat 'then'
+    nextToken(); // eat 'then'
     r = parseExpression();
     if (r.isError())
         return r;
-    v = r.value();
-    std::unique_ptr<ExprAST> _then(static_cast<ExprAST *>(v.release()));
+    auto _then = static_cast<ExprAST *>(r.value());
 
-    if (lexer->CurTok != tok_else)
+    if (curTok() != tok_else)
         return ParseResult(Error("expected else"));
-    lexer->GetNextToken(); // eat 'else'
+    nextToken(); // eat 'else'
     r = parseExpression();
     if (r.isError())
         return r;
-    v = r.value();
-    std::unique_ptr<ExprAST> _else(static_cast<ExprAST *>(v.release()));
-
-    std::unique_ptr<IfExprAST> ifExpr = std::make_unique<IfExprAST>(
-        std::move(_cond),
-        std::move(_then),
-        std::move(_else));
-    return ParseResult(std::move(ifExpr));
+    auto _else = static_cast<ExprAST *>(r.value());
+
+    return ParseResult(make<IfExprAST>(offset, _cond, _then, _else));
 }
 
 /// PrimaryExpr
@@ -113,7 +119,7 @@ ParseResult Parser::parseIfExpr()
 ///     | IfExpr
 ParseResult Parser::parsePrimaryExpr()
 {
-    switch (lexer->CurTok)
+    switch (curTok())
     {
     case tok_identifier:
         return parseIdentifierExpr();
@@ -125,7 +131,7 @@ ParseResult Parser::parsePrimaryExpr()
         return parseParenExpr();
     default:
         std::ostringstream errorMsg;
-        errorMsg << "unknown token " << lexer->CurTok << " when expecting a primary expression";
+        errorMsg << "unknown token " << curTok() << " when expecting a primary expression";
         return ParseResult(Error(errorMsg.str()));
     }
 }
@@ -137,51 +143,48 @@ ParseResult Parser::parseExpression()
     auto r = parsePrimaryExpr();
     if (r.isError())
         return r;
-    std::unique_ptr<AST> v = r.value();
-    std::unique_ptr<ExprAST> LHS(static_cast<ExprAST *>(v.release()));
-    return parseBinOpRHS(0, std::move(LHS));
+    return parseBinOpRHS(0, static_cast<ExprAST *>(r.value()));
 }
 
 /// BinOpRHS
 ///   ::= '<' Expression
 ///     | '+-' Expression
 ///     | '*/' Expression
-ParseResult Parser::parseBinOpRHS(int exprPrec, std::unique_ptr<ExprAST> LHS)
+ParseResult Parser::parseBinOpRHS(int exprPrec, ExprAST *LHS)
 {
     while (true)
     {
-        int tokPrec = getTokPrecedence(lexer->CurTok);
+        int tokPrec = getTokPrecedence(curTok());
 
         // If this is a binop that binds at least as tightly as the current binop,
         // (tokPrec >= exprPrec) consume it, otherwise we are done.
         if (tokPrec < exprPrec)
-            return ParseResult(std::move(LHS));
+            return ParseResult(LHS);
 
-        int binOp = lexer->CurTok;
-        lexer->GetNextToken(); // eat binop
+        int binOp = curTok();
+        uint32_t offset = curOffset();
+        nextToken(); // eat binop
 
         // Parse the primary expression after the binary operator.
         auto r = parsePrimaryExpr();
         if (r.isError())
             return r;
 
-        std::unique_ptr<AST> v = r.value();
-        std::unique_ptr<ExprAST> RHS(static_cast<ExprAST *>(v.release()));
+        auto RHS = static_cast<ExprAST *>(r.value());
 
         // If binop binds less tightly with RHS than the operator after RHS
         // (tokPrec < nextPrec), let the pending operator take RHS as its LHS.
-        int nextPrec = getTokPrecedence(lexer->CurTok);
+        int nextPrec = getTokPrecedence(curTok());
         if (tokPrec < nextPrec)
         {
-            r = parseBinOpRHS(tokPrec + 1, std::move(RHS));
+            r = parseBinOpRHS(tokPrec + 1, RHS);
             if (r.isError())
                 return r;
 
-            v = r.value();
-            RHS = std::unique_ptr<ExprAST>(static_cast<ExprAST *>(v.release()));
+            RHS = static_cast<ExprAST *>(r.value());
         }
 
-        LHS = std::make_unique<BinaryExprAST>(binOp, std::move(LHS), std::move(RHS));
+        LHS = make<BinaryExprAST>(offset, binOp, LHS, RHS);
     }
 }
 
@@ -189,131 +192,269 @@ ParseResult Parser::parseBinOpRHS(int exprPrec, std::unique_ptr<ExprAST> LHS)
 ///   ::= id '(' id* ')'
 ParseResult Parser::parsePrototype()
 {
-    if (lexer->CurTok != tok_identifier)
+    if (curTok() != tok_identifier)
         return ParseResult(Error("expected function name in prototype"));
 
-    std::string fnName = lexer->IdentifierStr;
-    lexer->GetNextToken(); // eat id
+    Symbol fnName = curSymbol();
+    uint32_t offset = curOffset();
+    nextToken(); // eat id
 
-    if (lexer->CurTok != '(')
+    if (curTok() != '(')
         return ParseResult(Error("expected '(' in prototype"));
-    lexer->GetNextToken(); // eat '('
+    nextToken(); // eat '('
 
     // Read the list of argument names.
-    std::vector<std::string> argNames;
-    while (lexer->CurTok == tok_identifier)
+    paramStack.clear();
+    while (curTok() == tok_identifier)
     {
-        argNames.push_back(lexer->IdentifierStr);
-        lexer->GetNextToken();
+        paramStack.push_back(curSymbol());
+        nextToken();
 
-        if (lexer->CurTok == ')')
+        if (curTok() == ')')
             break;
-        if (lexer->CurTok == ',')
-            lexer->GetNextToken(); // eat ','
+        if (curTok() == ',')
+            nextToken(); // eat ','
         else
             return ParseResult(Error("expected ')' or ',' after a prototype's argument"));
     }
 
-    if (lexer->CurTok != ')')
+    if (curTok() != ')')
         return ParseResult(Error("expected ')' in prototype"));
-    lexer->GetNextToken(); // eat ')'
+    nextToken(); // eat ')'
 
-    return ParseResult(std::make_unique<PrototypeAST>(fnName, argNames));
+    auto argNames = arena->copyArray(paramStack.data(), paramStack.size());
+    return ParseResult(make<PrototypeAST>(offset, fnName, argNames));
 }
 
 /// definition ::= 'def' prototype expression
 ParseResult Parser::parseDefinition()
 {
-    lexer->GetNextToken(); // eat 'def'
+    uint32_t offset = curOffset();
+    nextToken(); // eat 'def'
     auto r = parsePrototype();
     if (r.isError())
         return r;
-    auto v = r.value();
-    std::unique_ptr<PrototypeAST> proto(static_cast<PrototypeAST *>(v.release()));
+    auto proto = static_cast<PrototypeAST *>(r.value());
 
     r = parseExpression();
     if (r.isError())
         return r;
-    v = r.value();
-    std::unique_ptr<ExprAST> body(static_cast<ExprAST *>(v.release()));
+    auto body = static_cast<ExprAST *>(r.value());
 
-    return ParseResult(std::make_unique<FunctionAST>(
-        std::move(proto),
-        std::move(body)));
+    return ParseResult(make<FunctionAST>(offset, proto, body));
 }
 
 /// external ::= 'extern' prototype
 ParseResult Parser::parseExtern()
 {
-    lexer->GetNextToken(); // eat 'extern'
+    nextToken(); // eat 'extern'
     return parsePrototype();
 }
 
 /// toplevelexpr ::= expression
 ParseResult Parser::parseTopLevelExpr()
 {
+    uint32_t offset = curOffset();
     auto r = parseExpression();
     if (r.isError())
         return r;
-    auto v = r.value();
-    std::unique_ptr<ExprAST> expr(static_cast<ExprAST *>(v.release()));
+    auto expr = static_cast<ExprAST *>(r.value());
 
-    auto proto = std::make_unique<PrototypeAST>("__main__", std::vector<std::string>());
-    return ParseResult(std::make_unique<FunctionAST>(std::move(proto), std::move(expr)));
+    auto proto = make<PrototypeAST>(offset, MainSymbol(), ArenaArray<Symbol>());
+    return ParseResult(make<FunctionAST>(offset, proto, expr));
 }
 
-/// program := (definition | external | toplevelexpr | ';')*
-ParseResult Parser::ParseProgram(
+/// item ::= definition | external | toplevelexpr | ';'
+ParseResult Parser::parseItem()
+{
+    ScopedPhase timer(Phase::Parse);
+    switch (curTok())
+    {
+    case ';':
+        return ParseResult(Error("dummy", -1)); // a dummy error
+    case tok_def:
+        return parseDefinition();
+    case tok_extern:
+        return parseExtern();
+    default:
+        return parseTopLevelExpr();
+    }
+}
+
+// reportItem prints the diagnostics of a parsed top-level item and runs the
+// visitors on it. It returns the node if it is to be kept in the program.
+static AST *reportItem(ParseResult r, const std::vector<Visitor *> &visitors)
+{
+    if (r.isError())
+    {
+        const Error &err = r.error();
+        if (err.code >= 0)
+        {
+            Diagnostics::Printf(DiagCategory::Error, "error: %s\n", err.message.c_str());
+            Diagnostics::Printf(DiagCategory::Prompt, "ready> ");
+        }
+        return nullptr;
+    }
+
+    AST *node = r.value();
+
+    bool ok = true;
+    for (const auto &visitor : visitors)
+    {
+        if (auto err = node->accept(visitor))
+        {
+            Diagnostics::Printf(DiagCategory::Error, "visitor failed: %s\n", err->message.c_str());
+            ok = false;
+        }
+    }
+    Diagnostics::Printf(DiagCategory::Prompt, "ready> ");
+    return ok ? node : nullptr;
+}
+
+// accountItem attributes the bytes of a kept top-level item to the function
+// it defines or declares.
+static void accountItem(AST *node, size_t bytes)
+{
+    if (!MemoryAccounting::Enabled())
+        return;
+    Symbol name;
+    if (auto fn = dynamic_cast<FunctionAST *>(node))
+        name = fn->Proto->Name;
+    else if (auto proto = dynamic_cast<PrototypeAST *>(node))
+        name = proto->Name;
+    else
+        return;
+    MemoryAccounting::Add(name.str(), MemoryKind::AST, bytes);
+}
+
+ProgramResult Parser::finishProgram(std::vector<AST *> nodes)
+{
+    auto program = std::make_unique<ProgramAST>(std::move(nodes), std::move(arena));
+    arena = std::make_unique<Arena>();
+    // Everything reported about the program is out once it is parsed.
+    Diagnostics::Flush();
+    return ProgramResult(std::move(program));
+}
+
+/// program ::= item*
+ProgramResult Parser::ParseProgram(
     const std::vector<Visitor *> &visitors)
 {
-    ParseResult r(Error("dummy", -1));
-    auto nodes = std::vector<std::unique_ptr<AST>>();
+    auto nodes = std::vector<AST *>();
     while (true)
     {
-        switch (lexer->CurTok)
+        // Everything allocated for a top-level item that is not kept
+        // is rolled back before parsing the next one.
+        Arena::Mark mark = arena->mark();
+
+        // A streaming parser never goes back past a top-level item,
+        // so the tokens before it can be dropped.
+        if (lexer && pos > 0)
         {
-        case tok_eof:
-            return ParseResult(std::make_unique<ProgramAST>(std::move(nodes)));
-        case ';':
-            r = ParseResult(Error("dummy", -1)); // a dummy error
-            break;
-        case tok_def:
-            r = parseDefinition();
-            break;
-        case tok_extern:
-            r = parseExtern();
-            break;
-        default:
-            r = parseTopLevelExpr();
-            break;
+            tokens->dropFront(std::min(pos, tokens->size()));
+            pos = 0;
         }
 
+        if (curTok() == tok_eof)
+            return finishProgram(std::move(nodes));
+
+        ParseResult r = parseItem();
+        // Move to the next token for error recovery
         if (r.isError())
+            nextToken();
+
+        AST *node = reportItem(std::move(r), visitors);
+        if (node && KeepItems)
         {
-            Error err = r.error();
-            if (err.code >= 0)
-            {
-                fprintf(stderr, "error: %s\n", err.message.c_str());
-                fprintf(stderr, "ready> ");
-            }
-            // Move to the next token for error recovery
-            lexer->GetNextToken();
-            continue;
+            accountItem(node, arena->bytesSince(mark));
+            nodes.push_back(node);
+        }
+        else
+        {
+            arena->rollback(mark);
+        }
+    }
+}
+
+Parser::Chunk Parser::parseChunk(size_t begin, size_t end) const
+{
+    Parser parser(tokens);
+    parser.pos = begin;
+
+    Chunk chunk;
+    chunk.begin = begin;
+    while (parser.pos < end && parser.curTok() != tok_eof)
+    {
+        Arena::Mark mark = parser.arena->mark();
+        ParseResult r = parser.parseItem();
+        if (r.isError())
+        {
+            parser.nextToken();
+            parser.arena->rollback(mark);
         }
+        chunk.items.push_back(std::move(r));
+        chunk.itemBytes.push_back(parser.arena->bytesSince(mark));
+    }
+    chunk.end = parser.pos;
+    chunk.arena = std::move(parser.arena);
+    return chunk;
+}
+
+std::vector<size_t> Parser::splitItems(size_t n) const
+{
+    // The last token of a pre-lexed buffer is tok_eof.
+    size_t last = tokens->size() - 1;
+    std::vector<size_t> bounds = {pos};
+    for (size_t i = 1; i < n && pos < last; i++)
+    {
+        size_t at = std::max(bounds.back() + 1, pos + (last - pos) * i / n);
+        while (at < last && tokens->kind(at) != tok_def && tokens->kind(at) != tok_extern)
+            at++;
+        if (at >= last)
+            break;
+        bounds.push_back(at);
+    }
+    bounds.push_back(std::max(pos, last));
+    return bounds;
+}
+
+ProgramResult Parser::ParseProgramParallel(
+    ThreadPool &pool, const std::vector<Visitor *> &visitors)
+{
+    // Only a pre-lexed token buffer can be split.
+    if (lexer)
+        return ParseProgram(visitors);
 
-        std::unique_ptr<AST> node = r.value();
+    std::vector<size_t> bounds = splitItems(pool.size() * ChunksPerThread);
+    std::vector<std::future<Chunk>> chunks;
+    for (size_t i = 0; i + 1 < bounds.size(); i++)
+    {
+        size_t begin = bounds[i];
+        size_t end = bounds[i + 1];
+        chunks.push_back(pool.submit([this, begin, end]()
+                                     { return parseChunk(begin, end); }));
+    }
 
-        bool ok = true;
-        for (const auto &visitor : visitors)
+    auto nodes = std::vector<AST *>();
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+        Chunk chunk = chunks[i].get();
+        // An item of the previous chunk ran past the boundary, e.g. an error
+        // was recovered from by skipping its 'def'. The serial parser would
+        // have started this chunk elsewhere, so parse it again from there.
+        if (chunk.begin != pos)
+            chunk = parseChunk(pos, bounds[i + 1]);
+
+        for (size_t j = 0; j < chunk.items.size(); j++)
         {
-            if (auto err = node->accept(visitor))
+            if (AST *node = reportItem(std::move(chunk.items[j]), visitors))
             {
-                fprintf(stderr, "visitor failed: %s\n", err->message.c_str());
-                ok = false;
+                accountItem(node, chunk.itemBytes[j]);
+                nodes.push_back(node);
             }
         }
-        if (ok)
-            nodes.push_back(std::move(node));
-        fprintf(stderr, "ready> ");
+        arena->adopt(std::move(*chunk.arena));
+        pos = chunk.end;
     }
+    return finishProgram(std::move(nodes));
 }
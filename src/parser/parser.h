@@ -3,6 +3,7 @@
 
 #include <memory>
 #include <map>
+#include <vector>
 
 #include "gtest/gtest.h"
 
@@ -14,17 +15,66 @@
 #include "visitor/visitor.h"
 
 #include "lexer/lexer.h"
+#include "lexer/token.h"
+#include "lexer/token_buffer.h"
 
 #include "error.h"
 #include "result.h"
+#include "arena.h"
+#include "thread_pool.h"
 
-using ParseResult = Result<std::unique_ptr<AST>, Error>;
+// Parsed nodes are owned by the parser's arena, see ParseProgram.
+using ParseResult = Result<AST *, Error>;
+using ProgramResult = Result<std::unique_ptr<ProgramAST>, Error>;
 
 class Parser
 {
+    // The parser reads tokens from the buffer by index. In streaming mode the
+    // lexer appends tokens to it as they are needed, otherwise the whole
+    // input has been lexed up front and lexer is null.
     std::unique_ptr<Lexer> lexer;
+    std::shared_ptr<TokenBuffer> tokens;
+    size_t pos = 0; // Index of the current token.
+
     std::map<char, int> binOpPrecedence;
 
+    // All nodes are allocated from this arena.
+    std::unique_ptr<Arena> arena;
+
+    // Scratch stacks for the arguments of calls and prototypes being parsed.
+    // They are copied into the arena once complete, so a list costs one
+    // arena allocation instead of a growing vector per node.
+    std::vector<ExprAST *> argStack;
+    std::vector<Symbol> paramStack;
+
+    // fill makes sure the token at index i is in the buffer and returns i,
+    // or the index of the final tok_eof if the input ends before it.
+    size_t fill(size_t i)
+    {
+        while (i >= tokens->size())
+        {
+            if (!lexer || (!tokens->empty() && tokens->kind(tokens->size() - 1) == tok_eof))
+                return tokens->size() - 1;
+            lexer->LexInto(*tokens);
+        }
+        return i;
+    }
+
+    int curTok() { return tokens->kind(fill(pos)); }
+    uint32_t curOffset() { return tokens->offset(fill(pos)); }
+    Symbol curSymbol() { return tokens->symbol(fill(pos)); }
+    double curNumber() { return tokens->number(fill(pos)); }
+    void nextToken() { pos++; }
+
+    // make allocates a node at offset in the source.
+    template <typename T, typename... Args>
+    T *make(uint32_t offset, Args &&...args)
+    {
+        T *node = arena->make<T>(std::forward<Args>(args)...);
+        node->Offset = offset;
+        return node;
+    }
+
     int getTokPrecedence(int tok)
     {
         if (!isascii(tok))
@@ -39,13 +89,38 @@ class Parser
     ParseResult parseIdentifierExpr();
     ParseResult parseIfExpr();
     ParseResult parsePrimaryExpr();
-    ParseResult parseBinOpRHS(int ExprPrec, std::unique_ptr<ExprAST> LHS);
+    ParseResult parseBinOpRHS(int ExprPrec, ExprAST *LHS);
     ParseResult parseExpression();
     ParseResult parsePrototype();
 
     ParseResult parseDefinition();
     ParseResult parseExtern();
     ParseResult parseTopLevelExpr();
+    ParseResult parseItem();
+
+    ProgramResult finishProgram(std::vector<AST *> nodes);
+
+    // A chunk of the token buffer parsed on its own, with its own arena.
+    // Parsing started at token begin and stopped at end, the first
+    // top-level item at or after the requested end.
+    struct Chunk
+    {
+        size_t begin = 0;
+        size_t end = 0;
+        std::vector<ParseResult> items;
+        // The bytes of the arena allocated for each item.
+        std::vector<size_t> itemBytes;
+        std::unique_ptr<Arena> arena;
+    };
+
+    // More chunks than threads even out the load when items vary in size.
+    static constexpr size_t ChunksPerThread = 4;
+
+    Chunk parseChunk(size_t begin, size_t end) const;
+
+    // splitItems returns up to n + 1 token indexes, starting at the current
+    // token and ending at tok_eof, which delimit chunks of whole items.
+    std::vector<size_t> splitItems(size_t n) const;
 
     FRIEND_TEST(ParserTest, NumberExpr);
     FRIEND_TEST(ParserTest, ParenExpr);
@@ -57,9 +132,13 @@ class Parser
     FRIEND_TEST(ParserTest, Extern);
     FRIEND_TEST(ParserTest, Definition);
 
-public:
-    Parser(std::unique_ptr<Lexer> lexer) : lexer(std::move(lexer))
+    Parser(std::unique_ptr<Lexer> lexer, std::shared_ptr<TokenBuffer> tokens)
+        : lexer(std::move(lexer)), tokens(std::move(tokens)), arena(std::make_unique<Arena>())
     {
+        // A pre-lexed buffer always ends with tok_eof.
+        if (!this->lexer && this->tokens->empty())
+            this->tokens->push(tok_eof, 0);
+
         // Install standard binary operators.
         // 1 is lowest precedence.
         binOpPrecedence['<'] = 10;
@@ -68,7 +147,33 @@ public:
         binOpPrecedence['*'] = 40; // highest
     }
 
-    ParseResult ParseProgram(
+public:
+    // Parse tokens as they are lexed, e.g. from an interactive session.
+    Parser(std::unique_ptr<Lexer> lexer)
+        : Parser(std::move(lexer), std::make_shared<TokenBuffer>()) {}
+
+    // Parse a pre-lexed token stream, see Lexer::Tokenize.
+    // The buffer is only read, so several parsers may share it.
+    Parser(std::shared_ptr<TokenBuffer> tokens)
+        : Parser(nullptr, std::move(tokens)) {}
+
+    // KeepItems makes ParseProgram keep the items it parsed in the program.
+    // A long-running session whose visitors handle every item as it comes
+    // can drop them instead, so that its AST never outgrows one item.
+    bool KeepItems = true;
+
+    // ParseProgram parses top-level items until EOF and runs the visitors on
+    // each of them. The returned ProgramAST takes over the parser's arena,
+    // the nodes of items that failed to parse are discarded from it.
+    ProgramResult ParseProgram(
+        const std::vector<Visitor *> &visitors = std::vector<Visitor *>());
+
+    // ParseProgramParallel is ParseProgram for a pre-lexed token buffer.
+    // The buffer is split before 'def' and 'extern' tokens and the chunks are
+    // parsed on the pool. The visitors then run on the items in source
+    // order, so the output and diagnostics match those of ParseProgram.
+    ProgramResult ParseProgramParallel(
+        ThreadPool &pool,
         const std::vector<Visitor *> &visitors = std::vector<Visitor *>());
 };
 
@@ -0,0 +1,56 @@
+#include "pass_manager.h"
+
+#include "ast/FunctionAST.h"
+#include "ast/ProgramAST.h"
+#include "ast/PrototypeAST.h"
+#include "utils/memory_usage.h"
+#include "utils/phase_timer.h"
+
+ASTPassManager::ASTPassManager(bool inlining)
+{
+    // Inlining goes first, as the arguments of a call are often constants.
+    if (inlining)
+        pipeline.push_back(&inliner);
+    pipeline.insert(pipeline.end(), {&folding, &deadBranches, &simplification, &strengthReduction});
+}
+
+std::optional<Error> ASTPassManager::visit(PrototypeAST *ast)
+{
+    inliner.Declare(ast);
+    return std::nullopt;
+}
+
+std::optional<Error> ASTPassManager::visit(FunctionAST *ast)
+{
+    ScopedPhase timer(Phase::Passes, ast->Proto->getName().str());
+    if (!KeepNodes)
+        arena.rollback(Arena::Mark{});
+    Arena::Mark mark = arena.mark();
+
+    for (size_t i = 0; i < MaxIterations; i++)
+    {
+        size_t changed = 0;
+        for (Rewriter *pass : pipeline)
+        {
+            size_t before = pass->NumRewrites;
+            ast->accept(pass);
+            changed += pass->NumRewrites - before;
+        }
+        if (changed == 0)
+            break;
+    }
+    if (KeepNodes && MemoryAccounting::Enabled())
+        MemoryAccounting::Add(ast->Proto->getName().str(), MemoryKind::AST, arena.bytesSince(mark));
+
+    // The function may only have become trivial now. It is recorded after
+    // its own passes, so recursive calls are never inlined.
+    inliner.Define(ast);
+    return std::nullopt;
+}
+
+std::optional<Error> ASTPassManager::visit(ProgramAST *ast)
+{
+    for (AST *node : ast->Nodes)
+        node->accept(this);
+    return std::nullopt;
+}
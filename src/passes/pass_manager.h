@@ -0,0 +1,60 @@
+#ifndef __PASS_MANAGER_H__
+#define __PASS_MANAGER_H__
+
+#include <cstddef>
+#include <vector>
+
+#include "passes.h"
+#include "rewriter.h"
+#include "utils/arena.h"
+#include "visitor/visitor.h"
+
+// ASTPassManager simplifies functions before they are lowered to IR, so that
+// constant top-level expressions need no code at all and LLVM gets smaller
+// functions. It is a Visitor over top-level items, to be run ahead of CodeGen
+// in source order; the functions it visits are rewritten in place.
+//
+// The nodes created by the passes live in the ASTPassManager, which must
+// outlive the functions it visits.
+class ASTPassManager : public Visitor
+{
+    Arena arena;
+
+    Inliner inliner{arena};
+    ConstantFolding folding{arena};
+    DeadBranchElimination deadBranches{arena};
+    AlgebraicSimplification simplification{arena};
+    StrengthReduction strengthReduction{arena};
+
+    std::vector<Rewriter *> pipeline;
+
+public:
+    // The pipeline runs again while it changes a function, as one pass
+    // can expose work for an earlier one, up to MaxIterations times.
+    static constexpr size_t MaxIterations = 4;
+
+    // Without inlining, the calls of a function reach whatever definition
+    // is current when they run, e.g. with JITOptions::Redefinable.
+    explicit ASTPassManager(bool inlining = true);
+
+    // KeepNodes keeps the nodes rewritten for every function. Where each
+    // item is dropped once the visitors after this one are done with it,
+    // see Parser::KeepItems, they are discarded when the next function
+    // comes; the inliner's copies of bodies are kept either way.
+    bool KeepNodes = true;
+
+    const std::vector<Rewriter *> &passes() const { return pipeline; }
+
+    // Expressions are only rewritten as part of their function.
+    std::optional<Error> visit(NumberExprAST *ast) override { return std::nullopt; }
+    std::optional<Error> visit(VariableExprAST *ast) override { return std::nullopt; }
+    std::optional<Error> visit(IfExprAST *ast) override { return std::nullopt; }
+    std::optional<Error> visit(CallExprAST *ast) override { return std::nullopt; }
+    std::optional<Error> visit(BinaryExprAST *ast) override { return std::nullopt; }
+
+    std::optional<Error> visit(PrototypeAST *ast) override;
+    std::optional<Error> visit(FunctionAST *ast) override;
+    std::optional<Error> visit(ProgramAST *ast) override;
+};
+
+#endif
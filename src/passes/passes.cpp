@@ -0,0 +1,351 @@
+#include <cmath>
+#include <vector>
+
+#include "passes.h"
+
+#include "ast/BinaryExprAST.h"
+#include "ast/CallExprAST.h"
+#include "ast/FunctionAST.h"
+#include "ast/IfExprAST.h"
+#include "ast/NumberExprAST.h"
+#include "ast/ProgramAST.h"
+#include "ast/PrototypeAST.h"
+#include "ast/VariableExprAST.h"
+#include "utils/memory_usage.h"
+
+namespace
+{
+    bool isKnownOp(char op)
+    {
+        return op == '+' || op == '-' || op == '*' || op == '<';
+    }
+
+    bool isLeaf(const ExprAST *expr)
+    {
+        return dynamic_cast<const NumberExprAST *>(expr) ||
+               dynamic_cast<const VariableExprAST *>(expr);
+    }
+
+    // Summary describes an expression for the inliner: its size, whether it
+    // calls functions, and how often it uses each of params.
+    class Summary : public Visitor
+    {
+        ArenaArray<Symbol> params;
+
+    public:
+        explicit Summary(ArenaArray<Symbol> params = ArenaArray<Symbol>())
+            : params(params), Uses(params.size()) {}
+
+        size_t Nodes = 0;
+        bool HasCalls = false;
+        // Set for variables other than params and operators CodeGen
+        // rejects, which must be left for it to report.
+        bool Invalid = false;
+        std::vector<size_t> Uses;
+
+        std::optional<Error> visit(NumberExprAST *ast) override
+        {
+            Nodes++;
+            return std::nullopt;
+        }
+
+        std::optional<Error> visit(VariableExprAST *ast) override
+        {
+            Nodes++;
+            for (size_t i = 0; i < params.size(); i++)
+            {
+                if (params[i] == ast->Name)
+                {
+                    Uses[i]++;
+                    return std::nullopt;
+                }
+            }
+            Invalid = true;
+            return std::nullopt;
+        }
+
+        std::optional<Error> visit(IfExprAST *ast) override
+        {
+            Nodes++;
+            ast->Cond->accept(this);
+            ast->Then->accept(this);
+            return ast->Else->accept(this);
+        }
+
+        std::optional<Error> visit(CallExprAST *ast) override
+        {
+            Nodes++;
+            HasCalls = true;
+            for (ExprAST *arg : ast->Args)
+                arg->accept(this);
+            return std::nullopt;
+        }
+
+        std::optional<Error> visit(BinaryExprAST *ast) override
+        {
+            Nodes++;
+            if (!isKnownOp(ast->Op))
+                Invalid = true;
+            ast->LHS->accept(this);
+            return ast->RHS->accept(this);
+        }
+
+        std::optional<Error> visit(PrototypeAST *ast) override { return std::nullopt; }
+        std::optional<Error> visit(FunctionAST *ast) override { return std::nullopt; }
+        std::optional<Error> visit(ProgramAST *ast) override { return std::nullopt; }
+    };
+
+    // Cloner copies an expression without calls into an arena. With args,
+    // the variables in params are replaced by the arguments and the other
+    // leaves are shared rather than copied, and the copies are placed at
+    // offset in the source, e.g. at the call being inlined.
+    class Cloner : public Visitor
+    {
+        Arena &arena;
+        ArenaArray<Symbol> params;
+        ExprAST *const *args;
+        uint32_t offset;
+
+        template <typename T, typename... Args>
+        T *make(const AST *orig, Args &&...nodeArgs)
+        {
+            T *node = arena.make<T>(std::forward<Args>(nodeArgs)...);
+            node->Offset = args ? offset : orig->Offset;
+            return node;
+        }
+
+    public:
+        Cloner(Arena &arena, ArenaArray<Symbol> params, ExprAST *const *args = nullptr,
+               uint32_t offset = 0)
+            : arena(arena), params(params), args(args), offset(offset) {}
+
+        ExprAST *result = nullptr;
+
+        ExprAST *clone(ExprAST *expr)
+        {
+            expr->accept(this);
+            return result;
+        }
+
+        std::optional<Error> visit(NumberExprAST *ast) override
+        {
+            result = args ? ast : make<NumberExprAST>(ast, ast->Val);
+            return std::nullopt;
+        }
+
+        std::optional<Error> visit(VariableExprAST *ast) override
+        {
+            result = args ? ast : make<VariableExprAST>(ast, ast->Name);
+            for (size_t i = 0; args && i < params.size(); i++)
+            {
+                if (params[i] == ast->Name)
+                    result = args[i];
+            }
+            return std::nullopt;
+        }
+
+        std::optional<Error> visit(IfExprAST *ast) override
+        {
+            ExprAST *cond = clone(ast->Cond);
+            ExprAST *then = clone(ast->Then);
+            ExprAST *els = clone(ast->Else);
+            result = make<IfExprAST>(ast, cond, then, els);
+            return std::nullopt;
+        }
+
+        std::optional<Error> visit(CallExprAST *ast) override
+        {
+            return Error("cannot clone a call");
+        }
+
+        std::optional<Error> visit(BinaryExprAST *ast) override
+        {
+            ExprAST *lhs = clone(ast->LHS);
+            ExprAST *rhs = clone(ast->RHS);
+            result = make<BinaryExprAST>(ast, ast->Op, lhs, rhs);
+            return std::nullopt;
+        }
+
+        std::optional<Error> visit(PrototypeAST *ast) override { return std::nullopt; }
+        std::optional<Error> visit(FunctionAST *ast) override { return std::nullopt; }
+        std::optional<Error> visit(ProgramAST *ast) override { return std::nullopt; }
+    };
+}
+
+std::optional<Error> ConstantFolding::visit(BinaryExprAST *ast)
+{
+    Rewriter::visit(ast);
+    auto bin = static_cast<BinaryExprAST *>(result);
+    auto lhs = constant(bin->LHS);
+    auto rhs = constant(bin->RHS);
+    if (!lhs || !rhs)
+        return std::nullopt;
+
+    double v;
+    switch (bin->Op)
+    {
+    case '+':
+        v = *lhs + *rhs;
+        break;
+    case '-':
+        v = *lhs - *rhs;
+        break;
+    case '*':
+        v = *lhs * *rhs;
+        break;
+    case '<':
+        // Unordered or less than, like CodeGen's fcmp ult.
+        v = !(*lhs >= *rhs) ? 1.0 : 0.0;
+        break;
+    default:
+        // Left for CodeGen to report.
+        return std::nullopt;
+    }
+    replace(make<NumberExprAST>(bin, v));
+    return std::nullopt;
+}
+
+// isExactly compares signed zeros too.
+static bool isExactly(std::optional<double> c, double v)
+{
+    return c && *c == v && std::signbit(*c) == std::signbit(v);
+}
+
+std::optional<Error> AlgebraicSimplification::visit(BinaryExprAST *ast)
+{
+    Rewriter::visit(ast);
+    auto bin = static_cast<BinaryExprAST *>(result);
+    auto lhs = constant(bin->LHS);
+    auto rhs = constant(bin->RHS);
+    switch (bin->Op)
+    {
+    case '+':
+        if (isExactly(rhs, -0.0))
+            replace(bin->LHS);
+        else if (isExactly(lhs, -0.0))
+            replace(bin->RHS);
+        break;
+    case '-':
+        if (isExactly(rhs, 0.0))
+            replace(bin->LHS);
+        break;
+    case '*':
+        if (isExactly(rhs, 1.0))
+            replace(bin->LHS);
+        else if (isExactly(lhs, 1.0))
+            replace(bin->RHS);
+        break;
+    }
+    return std::nullopt;
+}
+
+std::optional<Error> StrengthReduction::visit(BinaryExprAST *ast)
+{
+    Rewriter::visit(ast);
+    auto bin = static_cast<BinaryExprAST *>(result);
+    if (bin->Op != '*')
+        return std::nullopt;
+
+    ExprAST *var = nullptr;
+    if (isExactly(constant(bin->RHS), 2.0))
+        var = bin->LHS;
+    else if (isExactly(constant(bin->LHS), 2.0))
+        var = bin->RHS;
+    if (var && dynamic_cast<VariableExprAST *>(var))
+        replace(make<BinaryExprAST>(bin, '+', var, var));
+    return std::nullopt;
+}
+
+std::optional<Error> DeadBranchElimination::visit(IfExprAST *ast)
+{
+    Rewriter::visit(ast);
+    auto ifExpr = static_cast<IfExprAST *>(result);
+    if (auto cond = constant(ifExpr->Cond))
+    {
+        // Ordered and not equal is true, like CodeGen's fcmp one.
+        bool taken = *cond < 0.0 || *cond > 0.0;
+
+        // CodeGen reports the errors of the dropped branch too, and only
+        // it knows whether its calls are valid.
+        Summary dropped(params);
+        (taken ? ifExpr->Else : ifExpr->Then)->accept(&dropped);
+        if (dropped.Invalid || dropped.HasCalls)
+            return std::nullopt;
+        replace(taken ? ifExpr->Then : ifExpr->Else);
+    }
+    return std::nullopt;
+}
+
+std::optional<Error> Inliner::visit(CallExprAST *ast)
+{
+    Rewriter::visit(ast);
+    auto call = static_cast<CallExprAST *>(result);
+    const FunctionInfo &callee = functions.get(call->Callee);
+    if (!callee.Body || callee.Args.size() != call->Args.size())
+        return std::nullopt;
+
+    Summary body(callee.Args);
+    callee.Body->accept(&body);
+    for (size_t i = 0; i < call->Args.size(); i++)
+    {
+        // Arguments the body does not use are dropped, CodeGen must still
+        // see their errors.
+        ExprAST *arg = call->Args[i];
+        Summary s(params);
+        arg->accept(&s);
+        if (s.Invalid)
+            return std::nullopt;
+        if (isLeaf(arg))
+            continue;
+        if (s.HasCalls || body.Uses[i] > 1)
+            return std::nullopt;
+    }
+
+    Cloner cloner(arena, callee.Args, call->Args.data(), call->Offset);
+    replace(cloner.clone(callee.Body));
+    return std::nullopt;
+}
+
+void Inliner::Declare(const PrototypeAST *proto)
+{
+    FunctionInfo &info = functions[proto->Name];
+    // CodeGen rejects the declaration, and calls that follow either one.
+    if (info.Arity && info.Arity != proto->Args.size() + 1)
+        info.Body = nullptr;
+    else
+        info.Arity = proto->Args.size() + 1;
+}
+
+void Inliner::Define(const FunctionAST *fn)
+{
+    const PrototypeAST *proto = fn->Proto;
+    // CodeGen rejects redefinitions, the first definition stays. Where
+    // functions may be redefined, the inliner does not run.
+    if (proto->isMain() || functions[proto->Name].Defined)
+        return;
+    functions[proto->Name].Defined = true;
+    Declare(proto);
+    if (functions[proto->Name].Arity != proto->Args.size() + 1)
+        return;
+
+    for (size_t i = 0; i < proto->Args.size(); i++)
+    {
+        for (size_t j = 0; j < i; j++)
+        {
+            if (proto->Args[i] == proto->Args[j])
+                return;
+        }
+    }
+
+    Summary s(proto->Args);
+    fn->Body->accept(&s);
+    if (s.Nodes > MaxSize || s.HasCalls || s.Invalid)
+        return;
+
+    FunctionInfo &info = functions[proto->Name];
+    Arena::Mark mark = bodies.mark();
+    info.Args = bodies.copyArray(proto->Args.data(), proto->Args.size());
+    info.Body = Cloner(bodies, proto->Args).clone(fn->Body);
+    if (MemoryAccounting::Enabled())
+        MemoryAccounting::Add(proto->Name.str(), MemoryKind::AST, bodies.bytesSince(mark));
+}
@@ -0,0 +1,103 @@
+#ifndef __PASSES_H__
+#define __PASSES_H__
+
+#include <cstddef>
+#include <optional>
+
+#include "rewriter.h"
+#include "utils/arena.h"
+#include "utils/symbol.h"
+
+class FunctionAST;
+class PrototypeAST;
+
+// The passes only make rewrites that give the same result as the IR of the
+// original expression, which is not compiled with fast-math: doubles are
+// not reassociated, and e.g. x + 0 is not x when x is -0.
+
+// ConstantFolding evaluates operators on number literals.
+class ConstantFolding : public Rewriter
+{
+public:
+    using Rewriter::Rewriter;
+    using Rewriter::visit;
+    const char *name() const override { return "constant-folding"; }
+    std::optional<Error> visit(BinaryExprAST *ast) override;
+};
+
+// AlgebraicSimplification removes operations with an identity operand:
+// x * 1, 1 * x, x - 0, x + -0 and -0 + x.
+class AlgebraicSimplification : public Rewriter
+{
+public:
+    using Rewriter::Rewriter;
+    using Rewriter::visit;
+    const char *name() const override { return "algebraic-simplification"; }
+    std::optional<Error> visit(BinaryExprAST *ast) override;
+};
+
+// StrengthReduction replaces multiplications by 2 with additions, x * 2 is
+// x + x. It is only done for variables, as there is nothing to bind the
+// value of a larger operand to.
+class StrengthReduction : public Rewriter
+{
+public:
+    using Rewriter::Rewriter;
+    using Rewriter::visit;
+    const char *name() const override { return "strength-reduction"; }
+    std::optional<Error> visit(BinaryExprAST *ast) override;
+};
+
+// DeadBranchElimination replaces an if with a constant condition by the
+// branch it takes. The other branch must be free of calls and of errors
+// for CodeGen to report.
+class DeadBranchElimination : public Rewriter
+{
+public:
+    using Rewriter::Rewriter;
+    using Rewriter::visit;
+    const char *name() const override { return "dead-branch-elimination"; }
+    std::optional<Error> visit(IfExprAST *ast) override;
+};
+
+// Inliner replaces calls to trivial functions with their bodies. A function
+// is trivial if its body is small and only uses its arguments, without
+// calls. A call is only inlined if that does not change which arguments are
+// evaluated, or how often: an argument that is used more than once by the
+// body must be a variable or a number, and arguments with calls are never
+// moved.
+class Inliner : public Rewriter
+{
+public:
+    // The largest body inlined, in AST nodes.
+    static constexpr size_t MaxSize = 8;
+
+    using Rewriter::Rewriter;
+    using Rewriter::visit;
+    const char *name() const override { return "inliner"; }
+    std::optional<Error> visit(CallExprAST *ast) override;
+
+    // Declare and Define record the functions declared and defined so far,
+    // in source order. Calls are inlined into later functions.
+    void Declare(const PrototypeAST *proto);
+    void Define(const FunctionAST *fn);
+
+private:
+    struct FunctionInfo
+    {
+        // 1 + the number of arguments, 0 if not declared.
+        size_t Arity = 0;
+        bool Defined = false;
+        // A copy of the body if the function is trivial, the function
+        // itself may be discarded.
+        ArenaArray<Symbol> Args;
+        ExprAST *Body = nullptr;
+    };
+
+    SymbolMap<FunctionInfo> functions;
+    // The copies live in an arena of their own, as they are kept for the
+    // rest of the program while the rewritten nodes may not be.
+    Arena bodies;
+};
+
+#endif
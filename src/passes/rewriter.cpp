@@ -0,0 +1,88 @@
+#include "rewriter.h"
+
+#include "ast/BinaryExprAST.h"
+#include "ast/CallExprAST.h"
+#include "ast/FunctionAST.h"
+#include "ast/IfExprAST.h"
+#include "ast/NumberExprAST.h"
+#include "ast/ProgramAST.h"
+#include "ast/PrototypeAST.h"
+#include "ast/VariableExprAST.h"
+
+std::optional<double> Rewriter::constant(const ExprAST *expr)
+{
+    if (auto num = dynamic_cast<const NumberExprAST *>(expr))
+        return num->Val;
+    return std::nullopt;
+}
+
+std::optional<Error> Rewriter::visit(NumberExprAST *ast)
+{
+    result = ast;
+    return std::nullopt;
+}
+
+std::optional<Error> Rewriter::visit(VariableExprAST *ast)
+{
+    result = ast;
+    return std::nullopt;
+}
+
+std::optional<Error> Rewriter::visit(IfExprAST *ast)
+{
+    ExprAST *cond = rewrite(ast->Cond);
+    ExprAST *then = rewrite(ast->Then);
+    ExprAST *els = rewrite(ast->Else);
+    if (cond != ast->Cond || then != ast->Then || els != ast->Else)
+        ast = make<IfExprAST>(ast, cond, then, els);
+    result = ast;
+    return std::nullopt;
+}
+
+std::optional<Error> Rewriter::visit(CallExprAST *ast)
+{
+    // The argument array is only copied once an argument changes.
+    ArenaArray<ExprAST *> args = ast->Args;
+    for (size_t i = 0; i < args.size(); i++)
+    {
+        ExprAST *arg = rewrite(args[i]);
+        if (arg == args[i])
+            continue;
+        if (args.data() == ast->Args.data())
+            args = arena.copyArray(args.data(), args.size());
+        args[i] = arg;
+    }
+    if (args.data() != ast->Args.data())
+        ast = make<CallExprAST>(ast, ast->Callee, args);
+    result = ast;
+    return std::nullopt;
+}
+
+std::optional<Error> Rewriter::visit(BinaryExprAST *ast)
+{
+    ExprAST *lhs = rewrite(ast->LHS);
+    ExprAST *rhs = rewrite(ast->RHS);
+    if (lhs != ast->LHS || rhs != ast->RHS)
+        ast = make<BinaryExprAST>(ast, ast->Op, lhs, rhs);
+    result = ast;
+    return std::nullopt;
+}
+
+std::optional<Error> Rewriter::visit(PrototypeAST *ast)
+{
+    return std::nullopt;
+}
+
+std::optional<Error> Rewriter::visit(FunctionAST *ast)
+{
+    params = ast->Proto->Args;
+    ast->Body = rewrite(ast->Body);
+    return std::nullopt;
+}
+
+std::optional<Error> Rewriter::visit(ProgramAST *ast)
+{
+    for (AST *node : ast->Nodes)
+        node->accept(this);
+    return std::nullopt;
+}
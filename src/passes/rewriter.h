@@ -0,0 +1,75 @@
+#ifndef __REWRITER_H__
+#define __REWRITER_H__
+
+#include <cstddef>
+#include <optional>
+#include <utility>
+
+#include "ast/ExprAST.h"
+#include "utils/arena.h"
+#include "utils/symbol.h"
+#include "visitor/visitor.h"
+
+// Rewriter is a Visitor that transforms the expressions of a function
+// bottom-up: visiting an expression rewrites its operands first, then leaves
+// the expression that replaces it, possibly itself, in `result`.
+// The base class only walks the tree, passes override the visits of the
+// nodes they transform.
+//
+// Expressions are never modified: a node whose operands change is copied,
+// so subtrees may be shared between trees. New nodes come from arena, which
+// must outlive the rewritten functions.
+class Rewriter : public Visitor
+{
+protected:
+    Arena &arena;
+    ExprAST *result = nullptr;
+
+    // The parameters of the function being rewritten.
+    ArenaArray<Symbol> params;
+
+    ExprAST *rewrite(ExprAST *expr)
+    {
+        expr->accept(this);
+        return result;
+    }
+
+    // make allocates a node at the same place in the source as the node
+    // at, which it replaces.
+    template <typename T, typename... Args>
+    T *make(const AST *at, Args &&...args)
+    {
+        T *node = arena.make<T>(std::forward<Args>(args)...);
+        node->Offset = at->Offset;
+        return node;
+    }
+
+    // replace makes expr the result of the visit and counts the rewrite.
+    void replace(ExprAST *expr)
+    {
+        result = expr;
+        NumRewrites++;
+    }
+
+    // constant returns the value of a number literal.
+    static std::optional<double> constant(const ExprAST *expr);
+
+public:
+    explicit Rewriter(Arena &arena) : arena(arena) {}
+
+    virtual const char *name() const = 0;
+
+    // The number of expressions replaced so far.
+    size_t NumRewrites = 0;
+
+    std::optional<Error> visit(NumberExprAST *ast) override;
+    std::optional<Error> visit(VariableExprAST *ast) override;
+    std::optional<Error> visit(IfExprAST *ast) override;
+    std::optional<Error> visit(CallExprAST *ast) override;
+    std::optional<Error> visit(BinaryExprAST *ast) override;
+    std::optional<Error> visit(PrototypeAST *ast) override;
+    std::optional<Error> visit(FunctionAST *ast) override;
+    std::optional<Error> visit(ProgramAST *ast) override;
+};
+
+#endif
@@ -0,0 +1,193 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+// ArenaArray is a fixed-size array whose elements live in an Arena.
+// It does not own its elements, copying it copies the reference.
+template <typename T>
+class ArenaArray
+{
+    T *elems = nullptr;
+    size_t len = 0;
+
+public:
+    ArenaArray() = default;
+    ArenaArray(T *elems, size_t len) : elems(elems), len(len) {}
+
+    T *data() const { return elems; }
+    size_t size() const { return len; }
+    bool empty() const { return len == 0; }
+
+    T *begin() const { return elems; }
+    T *end() const { return elems + len; }
+
+    T &operator[](size_t i) const { return elems[i]; }
+};
+
+// Arena is a bump-pointer allocator. Objects allocated from it are released
+// all at once when the arena is destroyed, and their destructors are never
+// run, so they must not own memory outside of the arena.
+class Arena
+{
+    static constexpr size_t BlockSize = 64 * 1024;
+
+    struct Block
+    {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    std::vector<Block> blocks;
+    size_t cur = 0; // Index of the block being allocated from.
+    char *pos = nullptr;
+    char *end = nullptr;
+
+    static char *alignUp(char *p, size_t align)
+    {
+        uintptr_t v = reinterpret_cast<uintptr_t>(p);
+        return reinterpret_cast<char *>((v + align - 1) & ~(uintptr_t)(align - 1));
+    }
+
+    void *allocateSlow(size_t size, size_t align)
+    {
+        size_t needed = size + align;
+        // Reuse the next block if a rollback left one behind, otherwise
+        // insert a new one. Large objects get a block of their own.
+        if (blocks.empty() || cur + 1 >= blocks.size() || blocks[cur + 1].size < needed)
+        {
+            size_t blockSize = needed > BlockSize ? needed : BlockSize;
+            size_t at = blocks.empty() ? 0 : cur + 1;
+            blocks.insert(blocks.begin() + at,
+                          Block{std::unique_ptr<char[]>(new char[blockSize]), blockSize});
+            cur = at;
+        }
+        else
+        {
+            cur++;
+        }
+        pos = blocks[cur].data.get();
+        end = pos + blocks[cur].size;
+        return allocate(size, align);
+    }
+
+public:
+    Arena() = default;
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    void *allocate(size_t size, size_t align)
+    {
+        char *p = alignUp(pos, align);
+        if (!pos || p + size > end)
+            return allocateSlow(size, align);
+        pos = p + size;
+        return p;
+    }
+
+    template <typename T, typename... Args>
+    T *make(Args &&...args)
+    {
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    // Copy [first, first + n) into an array in the arena.
+    template <typename T>
+    ArenaArray<T> copyArray(const T *first, size_t n)
+    {
+        if (n == 0)
+            return ArenaArray<T>();
+        T *elems = static_cast<T *>(allocate(sizeof(T) * n, alignof(T)));
+        for (size_t i = 0; i < n; i++)
+            new (elems + i) T(first[i]);
+        return ArenaArray<T>(elems, n);
+    }
+
+    // Mark remembers the allocation state, so everything allocated after it
+    // can be discarded with rollback, e.g. the nodes of a failed parse.
+    struct Mark
+    {
+        size_t block;
+        char *pos;
+    };
+
+    Mark mark() const { return Mark{cur, pos}; }
+
+    void rollback(Mark m)
+    {
+        if (!m.pos)
+        {
+            // Nothing had been allocated, start over from the first block.
+            cur = 0;
+            pos = blocks.empty() ? nullptr : blocks[0].data.get();
+            end = blocks.empty() ? nullptr : pos + blocks[0].size;
+            return;
+        }
+        cur = m.block;
+        pos = m.pos;
+        end = blocks[cur].data.get() + blocks[cur].size;
+    }
+
+    // bytesSince returns the bytes allocated after m, counting the padding
+    // and the unused ends of the blocks that were filled up.
+    size_t bytesSince(Mark m) const
+    {
+        if (!pos)
+            return 0;
+        size_t b = m.pos ? m.block : 0;
+        const char *from = m.pos ? m.pos : blocks[0].data.get();
+        size_t total = 0;
+        for (; b < cur; b++)
+        {
+            total += blocks[b].data.get() + blocks[b].size - from;
+            from = blocks[b + 1].data.get();
+        }
+        return total + (pos - from);
+    }
+
+    // adopt takes over the blocks of other, so objects allocated from it live
+    // as long as this arena. Marks taken before are no longer valid.
+    void adopt(Arena &&other)
+    {
+        if (other.blocks.empty())
+            return;
+        // The adopted blocks go before the current one, so they are
+        // neither allocated from nor reused after a rollback.
+        size_t n = other.blocks.size();
+        if (blocks.empty())
+        {
+            blocks = std::move(other.blocks);
+            cur = n - 1;
+            pos = end = blocks[cur].data.get() + blocks[cur].size;
+        }
+        else
+        {
+            blocks.insert(blocks.begin() + cur,
+                          std::make_move_iterator(other.blocks.begin()),
+                          std::make_move_iterator(other.blocks.end()));
+            cur += n;
+        }
+        other.blocks.clear();
+        other.cur = 0;
+        other.pos = other.end = nullptr;
+    }
+
+    // Bytes reserved from the system by this arena.
+    size_t bytesReserved() const
+    {
+        size_t total = 0;
+        for (const Block &b : blocks)
+            total += b.size;
+        return total;
+    }
+
+    size_t numBlocks() const { return blocks.size(); }
+};
+
+#endif
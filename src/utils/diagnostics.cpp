@@ -0,0 +1,140 @@
+#include "diagnostics.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringSwitch.h"
+
+std::atomic<unsigned> Diagnostics::enabled{Diagnostics::Default};
+
+namespace
+{
+    // The buffer is flushed once it holds this many bytes.
+    constexpr size_t FlushThreshold = 64 * 1024;
+
+    struct Sink
+    {
+        std::mutex mutex;
+        std::string buffer;
+        bool interactive = false;
+
+        Sink()
+        {
+            buffer.reserve(FlushThreshold);
+            atexit(Diagnostics::Flush);
+        }
+
+        // flush must be called with mutex held.
+        void flush()
+        {
+            if (buffer.empty())
+                return;
+            fwrite(buffer.data(), 1, buffer.size(), stderr);
+            fflush(stderr);
+            buffer.clear();
+        }
+
+        // done flushes after a diagnostic was written, if needed.
+        void done(DiagCategory c)
+        {
+            if (buffer.size() >= FlushThreshold || c == DiagCategory::Error ||
+                (c == DiagCategory::Prompt && interactive))
+                flush();
+        }
+    };
+
+    // The sink is never destroyed, so that diagnostics can be written from
+    // the destructors of other globals and flushed at exit.
+    Sink &sink()
+    {
+        static Sink *s = new Sink();
+        return *s;
+    }
+
+    // Creating the sink before main registers its flush at exit before any
+    // handler registered by main, which may still write diagnostics.
+    Sink &initialSink = sink();
+}
+
+void Diagnostics::vprintf(DiagCategory c, const char *format, va_list args)
+{
+    char small[256];
+    va_list copy;
+    va_copy(copy, args);
+    int n = vsnprintf(small, sizeof(small), format, copy);
+    va_end(copy);
+    if (n < 0)
+        return;
+
+    Sink &s = sink();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (size_t(n) < sizeof(small))
+    {
+        s.buffer.append(small, n);
+    }
+    else
+    {
+        size_t size = s.buffer.size();
+        s.buffer.resize(size + n + 1);
+        vsnprintf(&s.buffer[size], n + 1, format, args);
+        s.buffer.resize(size + n);
+    }
+    s.done(c);
+}
+
+void Diagnostics::print(DiagCategory c, llvm::function_ref<void(llvm::raw_ostream &)> fn)
+{
+    // fn may take a while, e.g. to print a module, so it does not run
+    // with the lock held.
+    std::string text;
+    llvm::raw_string_ostream os(text);
+    fn(os);
+    os.flush();
+
+    Sink &s = sink();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.buffer += text;
+    s.done(c);
+}
+
+std::optional<unsigned> Diagnostics::ParseCategories(llvm::StringRef list)
+{
+    llvm::SmallVector<llvm::StringRef, 8> names;
+    list.split(names, ',', /*MaxSplit*/ -1, /*KeepEmpty*/ false);
+
+    unsigned mask = 0;
+    for (llvm::StringRef name : names)
+    {
+        std::optional<unsigned> bits = llvm::StringSwitch<std::optional<unsigned>>(name)
+                                           .Case("error", DiagBit(DiagCategory::Error))
+                                           .Case("prompt", DiagBit(DiagCategory::Prompt))
+                                           .Case("result", DiagBit(DiagCategory::Result))
+                                           .Case("stats", DiagBit(DiagCategory::Stats))
+                                           .Case("ast", DiagBit(DiagCategory::AST))
+                                           .Case("ir", DiagBit(DiagCategory::IR))
+                                           .Case("all", All)
+                                           .Case("none", 0)
+                                           .Default(std::nullopt);
+        if (!bits)
+            return std::nullopt;
+        mask |= *bits;
+    }
+    return mask;
+}
+
+void Diagnostics::SetInteractive(bool interactive)
+{
+    Sink &s = sink();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.interactive = interactive;
+}
+
+void Diagnostics::Flush()
+{
+    Sink &s = sink();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.flush();
+}
@@ -0,0 +1,92 @@
+#ifndef __DIAGNOSTICS_H__
+#define __DIAGNOSTICS_H__
+
+#include <atomic>
+#include <cstdarg>
+#include <optional>
+
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+
+// DiagCategory is what a diagnostic is about. Every category is enabled or
+// disabled on its own.
+enum class DiagCategory : unsigned
+{
+    // Errors in the input and failures to compile it.
+    Error,
+    // The "ready>" prompt.
+    Prompt,
+    // The values of top-level expressions.
+    Result,
+    // Statistics and timings.
+    Stats,
+    // The AST of every item parsed.
+    AST,
+    // The IR of every function, before and after optimization.
+    IR,
+    NumCategories,
+};
+
+// DiagBit is the bit of a category in a mask of categories.
+constexpr unsigned DiagBit(DiagCategory c) { return 1u << static_cast<unsigned>(c); }
+
+// Diagnostics is where the compiler writes everything it reports, on
+// stderr. A disabled category costs one branch: check Enabled, or use the
+// functions below, which check it before formatting anything. Enabled
+// categories are written to a buffer, flushed when it fills up, after
+// errors, at exit, and after prompts when the input is interactive.
+// All functions are safe to call from any thread.
+class Diagnostics
+{
+    static std::atomic<unsigned> enabled;
+
+    static void vprintf(DiagCategory c, const char *format, va_list args);
+    static void print(DiagCategory c, llvm::function_ref<void(llvm::raw_ostream &)> fn);
+
+public:
+    // The verbosity levels of the driver, as sets of categories.
+    static constexpr unsigned Quiet = DiagBit(DiagCategory::Error) | DiagBit(DiagCategory::Result);
+    static constexpr unsigned Default = Quiet | DiagBit(DiagCategory::Prompt) | DiagBit(DiagCategory::Stats);
+    static constexpr unsigned Verbose = Default | DiagBit(DiagCategory::AST);
+    static constexpr unsigned All = Verbose | DiagBit(DiagCategory::IR);
+
+    static bool Enabled(DiagCategory c)
+    {
+        return enabled.load(std::memory_order_relaxed) & DiagBit(c);
+    }
+
+    // SetEnabled enables exactly the categories in mask.
+    static void SetEnabled(unsigned mask) { enabled.store(mask, std::memory_order_relaxed); }
+    static unsigned EnabledMask() { return enabled.load(std::memory_order_relaxed); }
+
+    // ParseCategories parses a comma separated list of category names,
+    // e.g. "error,ast,ir", into a mask. "all" and "none" are accepted too.
+    static std::optional<unsigned> ParseCategories(llvm::StringRef list);
+
+    // SetInteractive makes prompts, and so everything before them, appear
+    // right away.
+    static void SetInteractive(bool interactive);
+
+    __attribute__((format(printf, 2, 3))) static void Printf(DiagCategory c, const char *format, ...)
+    {
+        if (!Enabled(c))
+            return;
+        va_list args;
+        va_start(args, format);
+        vprintf(c, format, args);
+        va_end(args);
+    }
+
+    // Print calls fn with a stream to write a diagnostic to, e.g. IR.
+    static void Print(DiagCategory c, llvm::function_ref<void(llvm::raw_ostream &)> fn)
+    {
+        if (Enabled(c))
+            print(c, fn);
+    }
+
+    // Flush writes out everything buffered.
+    static void Flush();
+};
+
+#endif
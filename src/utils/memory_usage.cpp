@@ -0,0 +1,138 @@
+#include "memory_usage.h"
+
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "diagnostics.h"
+
+std::atomic<bool> MemoryAccounting::enabled{false};
+
+namespace
+{
+    constexpr size_t NumKinds = static_cast<size_t>(MemoryKind::NumKinds);
+
+    const char *const kindNames[NumKinds] = {
+        "AST",
+        "IR",
+        "code",
+    };
+
+    struct Bytes
+    {
+        ptrdiff_t Of[NumKinds] = {};
+
+        ptrdiff_t total() const
+        {
+            ptrdiff_t bytes = 0;
+            for (ptrdiff_t b : Of)
+                bytes += b;
+            return bytes;
+        }
+    };
+
+    struct State
+    {
+        std::mutex mutex;
+        Bytes session;
+        std::unordered_map<std::string, Bytes> functions;
+    };
+
+    // The state is never destroyed, so that memory can be freed during exit.
+    State &state()
+    {
+        static State *s = new State();
+        return *s;
+    }
+
+    double kib(ptrdiff_t bytes) { return bytes / 1024.0; }
+}
+
+MemoryUsage MemoryUsage::Current()
+{
+    MemoryUsage usage;
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+    {
+        // In kB, e.g. "VmRSS:	   12345 kB".
+        if (line.compare(0, 6, "VmRSS:") == 0)
+        {
+            usage.ResidentBytes = std::stoull(line.substr(6)) * 1024;
+            break;
+        }
+    }
+    std::ifstream maps("/proc/self/maps");
+    while (std::getline(maps, line))
+        usage.NumMappings++;
+    return usage;
+}
+
+void MemoryAccounting::Enable()
+{
+    enabled = true;
+}
+
+void MemoryAccounting::Add(std::string_view function, MemoryKind kind, ptrdiff_t bytes)
+{
+    if (!Enabled())
+        return;
+    size_t k = static_cast<size_t>(kind);
+    State &s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.session.Of[k] += bytes;
+    Bytes &fn = s.functions[std::string(function)];
+    fn.Of[k] += bytes;
+    if (fn.total() == 0)
+        s.functions.erase(std::string(function));
+}
+
+size_t MemoryAccounting::Total(MemoryKind kind)
+{
+    State &s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    return s.session.Of[static_cast<size_t>(kind)];
+}
+
+void MemoryAccounting::Report()
+{
+    State &s = state();
+    Bytes session;
+    std::vector<std::pair<std::string, Bytes>> functions;
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        session = s.session;
+        functions.assign(s.functions.begin(), s.functions.end());
+    }
+
+    Diagnostics::Printf(DiagCategory::Stats, "\n%-10s %12s\n", "memory", "kept (KiB)");
+    for (size_t k = 0; k < NumKinds; k++)
+        Diagnostics::Printf(DiagCategory::Stats, "%-10s %12.1f\n", kindNames[k], kib(session.Of[k]));
+    Diagnostics::Printf(DiagCategory::Stats, "%-10s %12.1f\n", "total", kib(session.total()));
+
+    if (functions.empty())
+        return;
+
+    // The functions keeping the most memory, with what they keep it for.
+    constexpr size_t MaxFunctions = 10;
+    size_t n = std::min(MaxFunctions, functions.size());
+    std::partial_sort(functions.begin(), functions.begin() + n, functions.end(),
+                      [](const auto &a, const auto &b)
+                      { return a.second.total() > b.second.total(); });
+    Diagnostics::Printf(DiagCategory::Stats, "\nlargest of %zu functions:\n", functions.size());
+    for (size_t i = 0; i < n; i++)
+    {
+        const auto &[name, fn] = functions[i];
+        Diagnostics::Printf(DiagCategory::Stats, "%-24s %10.1f KiB", name.c_str(), kib(fn.total()));
+        for (size_t k = 0; k < NumKinds; k++)
+        {
+            if (fn.Of[k] != 0)
+                Diagnostics::Printf(DiagCategory::Stats, " %s %.1f", kindNames[k], kib(fn.Of[k]));
+        }
+        Diagnostics::Printf(DiagCategory::Stats, "\n");
+    }
+}
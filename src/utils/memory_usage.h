@@ -0,0 +1,55 @@
+#ifndef __MEMORY_USAGE_H__
+#define __MEMORY_USAGE_H__
+
+#include <atomic>
+#include <cstddef>
+#include <string_view>
+
+// MemoryUsage is how much memory the process uses, as Linux reports it in
+// /proc/self. Both are 0 where it is not available.
+struct MemoryUsage
+{
+    // The bytes of memory resident in RAM.
+    size_t ResidentBytes = 0;
+    // The number of memory mappings, which the code the JIT loads adds to.
+    size_t NumMappings = 0;
+
+    static MemoryUsage Current();
+};
+
+// MemoryKind is what a function keeps memory for.
+enum class MemoryKind
+{
+    // The nodes of its definition kept by the parser.
+    AST,
+    // Its IR kept to be linked into, or compiled again.
+    IR,
+    // The object its code was compiled to, while it is loaded.
+    Code,
+    NumKinds,
+};
+
+// MemoryAccounting sums up the memory kept for each function over the
+// session, by kind. A module defining several functions is attributed to
+// the first of them, like its compile time.
+class MemoryAccounting
+{
+    static std::atomic<bool> enabled;
+
+public:
+    static bool Enabled() { return enabled.load(std::memory_order_relaxed); }
+    static void Enable();
+
+    // Add adds bytes to what function keeps for kind, or takes them off
+    // once freed if negative. It does nothing unless enabled.
+    static void Add(std::string_view function, MemoryKind kind, ptrdiff_t bytes);
+
+    // Total returns the bytes kept for kind by all functions.
+    static size_t Total(MemoryKind kind);
+
+    // Report writes the totals and the functions keeping the most memory to
+    // the Stats diagnostics.
+    static void Report();
+};
+
+#endif
@@ -0,0 +1,252 @@
+#include "phase_timer.h"
+
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "diagnostics.h"
+
+std::atomic<bool> PhaseTimers::enabled{false};
+
+namespace
+{
+    constexpr size_t NumPhases = static_cast<size_t>(Phase::NumPhases);
+
+    const char *const phaseNames[NumPhases] = {
+        "lex",
+        "parse",
+        "passes",
+        "codegen",
+        "optimize",
+        "compile",
+        "lookup",
+        "execute",
+        "interpret",
+    };
+
+    struct Totals
+    {
+        int64_t Ns[NumPhases] = {};
+        uint64_t Count[NumPhases] = {};
+
+        int64_t total() const
+        {
+            int64_t ns = 0;
+            for (int64_t n : Ns)
+                ns += n;
+            return ns;
+        }
+    };
+
+    struct TraceEvent
+    {
+        Phase phase;
+        std::string function;
+        int64_t startNs;
+        int64_t durationNs;
+        uint32_t thread;
+    };
+
+    struct State
+    {
+        std::mutex mutex;
+        bool perFunction = false;
+        std::string tracePath;
+        std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+
+        Totals session;
+        std::unordered_map<std::string, Totals> functions;
+        std::vector<TraceEvent> events;
+    };
+
+    // The state is never destroyed, so that phases can end during exit.
+    State &state()
+    {
+        static State *s = new State();
+        return *s;
+    }
+
+    std::atomic<bool> reportRequested{false};
+
+    // The innermost phase running on this thread.
+    thread_local ScopedPhase *current = nullptr;
+
+    // threadId numbers the threads in the order they first end a phase.
+    uint32_t threadId()
+    {
+        static std::atomic<uint32_t> next{1};
+        thread_local uint32_t id = next++;
+        return id;
+    }
+
+    double ms(int64_t ns) { return ns / 1e6; }
+
+    void writeJSONString(std::ostream &os, const std::string &s)
+    {
+        os << '"';
+        for (char c : s)
+        {
+            if (c == '"' || c == '\\')
+                os << '\\';
+            os << c;
+        }
+        os << '"';
+    }
+}
+
+void ScopedPhase::begin()
+{
+    parent = current;
+    current = this;
+    start = Clock::now();
+}
+
+void ScopedPhase::end()
+{
+    Clock::time_point stop = Clock::now();
+    int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count();
+    current = parent;
+    if (parent)
+        parent->nestedNs += ns;
+
+    size_t p = static_cast<size_t>(phase);
+    State &s = state();
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.session.Ns[p] += ns - nestedNs;
+        s.session.Count[p]++;
+        if (s.perFunction && !function.empty())
+        {
+            Totals &fn = s.functions[std::string(function)];
+            fn.Ns[p] += ns - nestedNs;
+            fn.Count[p]++;
+        }
+        if (!s.tracePath.empty())
+        {
+            int64_t startNs = std::chrono::duration_cast<std::chrono::nanoseconds>(start - s.origin).count();
+            s.events.push_back(TraceEvent{phase, std::string(function), startNs, ns, threadId()});
+        }
+    }
+
+    if (!parent && reportRequested.load(std::memory_order_relaxed) && reportRequested.exchange(false))
+        PhaseTimers::Report();
+}
+
+void PhaseTimers::Enable(bool perFunction)
+{
+    State &s = state();
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.perFunction = s.perFunction || perFunction;
+    }
+    enabled = true;
+}
+
+void PhaseTimers::EnableTrace(const std::string &path)
+{
+    State &s = state();
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.tracePath = path;
+    }
+    enabled = true;
+}
+
+void PhaseTimers::RequestReport()
+{
+    reportRequested = true;
+}
+
+uint64_t PhaseTimers::Count(Phase phase)
+{
+    State &s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    return s.session.Count[static_cast<size_t>(phase)];
+}
+
+int64_t PhaseTimers::TotalNs(Phase phase)
+{
+    State &s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    return s.session.Ns[static_cast<size_t>(phase)];
+}
+
+void PhaseTimers::Report()
+{
+    State &s = state();
+    Totals session;
+    std::vector<std::pair<std::string, Totals>> functions;
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        session = s.session;
+        functions.assign(s.functions.begin(), s.functions.end());
+    }
+
+    int64_t total = session.total();
+    Diagnostics::Printf(DiagCategory::Stats, "\n%-10s %10s %12s %7s\n", "phase", "count", "time (ms)", "%");
+    for (size_t p = 0; p < NumPhases; p++)
+    {
+        if (session.Count[p] == 0)
+            continue;
+        Diagnostics::Printf(DiagCategory::Stats, "%-10s %10llu %12.3f %6.1f%%\n", phaseNames[p],
+                            (unsigned long long)session.Count[p], ms(session.Ns[p]),
+                            total ? 100.0 * session.Ns[p] / total : 0.0);
+    }
+    Diagnostics::Printf(DiagCategory::Stats, "%-10s %10s %12.3f\n", "total", "", ms(total));
+
+    if (functions.empty())
+        return;
+
+    // The functions that took longest, with the phases they took it in.
+    constexpr size_t MaxFunctions = 10;
+    size_t n = std::min(MaxFunctions, functions.size());
+    std::partial_sort(functions.begin(), functions.begin() + n, functions.end(),
+                      [](const auto &a, const auto &b)
+                      { return a.second.total() > b.second.total(); });
+    Diagnostics::Printf(DiagCategory::Stats, "\nslowest of %zu functions:\n", functions.size());
+    for (size_t i = 0; i < n; i++)
+    {
+        const auto &[name, fn] = functions[i];
+        Diagnostics::Printf(DiagCategory::Stats, "%-24s %10.3f ms ", name.c_str(), ms(fn.total()));
+        for (size_t p = 0; p < NumPhases; p++)
+        {
+            if (fn.Count[p] > 0)
+                Diagnostics::Printf(DiagCategory::Stats, " %s %.3f", phaseNames[p], ms(fn.Ns[p]));
+        }
+        Diagnostics::Printf(DiagCategory::Stats, "\n");
+    }
+}
+
+std::optional<Error> PhaseTimers::WriteTrace()
+{
+    State &s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (s.tracePath.empty())
+        return std::nullopt;
+
+    std::ofstream out(s.tracePath);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    for (size_t i = 0; i < s.events.size(); i++)
+    {
+        const TraceEvent &e = s.events[i];
+        out << (i ? ",\n" : "\n")
+            << "{\"name\":\"" << phaseNames[static_cast<size_t>(e.phase)]
+            << "\",\"cat\":\"kaleidoscope\",\"ph\":\"X\",\"pid\":1,\"tid\":" << e.thread
+            << ",\"ts\":" << e.startNs / 1e3 << ",\"dur\":" << e.durationNs / 1e3;
+        if (!e.function.empty())
+        {
+            out << ",\"args\":{\"function\":";
+            writeJSONString(out, e.function);
+            out << "}";
+        }
+        out << "}";
+    }
+    out << "\n]}\n";
+    out.close();
+    if (!out)
+        return Error("cannot write " + s.tracePath);
+    return std::nullopt;
+}
@@ -0,0 +1,108 @@
+#ifndef __PHASE_TIMER_H__
+#define __PHASE_TIMER_H__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "error.h"
+
+// Phase is a stage of handling the input that time is attributed to.
+enum class Phase
+{
+    // Lexing a whole input ahead of parsing.
+    Lex,
+    // Parsing top-level items, which includes lexing them when the lexer
+    // is streamed.
+    Parse,
+    // The AST passes.
+    Passes,
+    // Generating IR from the AST.
+    CodeGen,
+    // The IR optimizer.
+    Optimize,
+    // The JIT's code generator, from IR to objects.
+    Compile,
+    // Looking up symbols in the JIT, which includes linking the objects
+    // they are defined in.
+    Lookup,
+    // Running compiled top-level expressions.
+    Execute,
+    // Interpreting top-level expressions.
+    Interpret,
+    NumPhases,
+};
+
+// PhaseTimers sums up the time spent in each phase over the session, and
+// optionally per function and as a Chrome trace, the JSON format read by
+// chrome://tracing and Perfetto. Phases nest: the time of a phase started
+// while another runs on the same thread is only counted for the inner one,
+// so that the phases add up to the time spent in all of them.
+class PhaseTimers
+{
+    static std::atomic<bool> enabled;
+
+public:
+    static bool Enabled() { return enabled.load(std::memory_order_relaxed); }
+
+    // Enable starts timing phases, also per function if perFunction.
+    static void Enable(bool perFunction);
+
+    // EnableTrace also records every phase as a trace event, to be written
+    // to path by WriteTrace.
+    static void EnableTrace(const std::string &path);
+
+    // Count and TotalNs return how often phase ran and the time attributed
+    // to it so far.
+    static uint64_t Count(Phase phase);
+    static int64_t TotalNs(Phase phase);
+
+    // Report writes the totals to the Stats diagnostics.
+    static void Report();
+
+    // RequestReport makes the next phase to end on any thread report the
+    // totals. It is safe to call from a signal handler.
+    static void RequestReport();
+
+    static std::optional<Error> WriteTrace();
+};
+
+// ScopedPhase attributes the time until it is destroyed to a phase and,
+// if given, a function. It does nothing if timers are disabled.
+class ScopedPhase
+{
+    using Clock = std::chrono::steady_clock;
+
+    Phase phase;
+    bool active;
+    std::string_view function;
+    Clock::time_point start;
+    // The time spent in nested phases.
+    int64_t nestedNs = 0;
+    ScopedPhase *parent = nullptr;
+
+    void begin();
+    void end();
+
+public:
+    explicit ScopedPhase(Phase phase, std::string_view function = {})
+        : phase(phase), active(PhaseTimers::Enabled()), function(function)
+    {
+        if (active)
+            begin();
+    }
+
+    ~ScopedPhase()
+    {
+        if (active)
+            end();
+    }
+
+    ScopedPhase(const ScopedPhase &) = delete;
+    ScopedPhase &operator=(const ScopedPhase &) = delete;
+};
+
+#endif
@@ -1,5 +1,3 @@
-#include <iostream>
-
 #include "printer.h"
 #include "ast/NumberExprAST.h"
 #include "ast/VariableExprAST.h"
@@ -9,59 +7,69 @@
 #include "ast/PrototypeAST.h"
 #include "ast/FunctionAST.h"
 #include "ast/ProgramAST.h"
+#include "utils/diagnostics.h"
+
+void Printer::emit()
+{
+    // Every item is written out as a whole.
+    if (indent != 0)
+        return;
+    Diagnostics::Printf(DiagCategory::AST, "%s", out.str().c_str());
+    out.str(std::string());
+}
 
 std::optional<Error> Printer::visit(NumberExprAST *ast)
 {
-    std::cout << std::string(indent, ' ') << "Num(" << ast->Val << ")" << std::endl;
+    out << std::string(indent, ' ') << "Num(" << ast->Val << ")" << '\n';
     return std::nullopt;
 }
 
 std::optional<Error> Printer::visit(VariableExprAST *ast)
 {
-    std::cout << std::string(indent, ' ') << "Var(" << ast->Name << ")" << std::endl;
+    out << std::string(indent, ' ') << "Var(" << ast->Name << ")" << '\n';
     return std::nullopt;
 }
 
 std::optional<Error> Printer::visit(CallExprAST *ast)
 {
-    std::cout << std::string(indent, ' ') << "Call(" << std::endl;
+    out << std::string(indent, ' ') << "Call(" << '\n';
     indent += 2;
-    std::cout << std::string(indent, ' ') << ast->Callee << std::endl;
+    out << std::string(indent, ' ') << ast->Callee << '\n';
     for (const auto &arg : ast->Args)
     {
         arg->accept(this);
     }
     indent -= 2;
-    std::cout << std::string(indent, ' ') << ")" << std::endl;
+    out << std::string(indent, ' ') << ")" << '\n';
     return std::nullopt;
 }
 
 std::optional<Error> Printer::visit(IfExprAST *ast)
 {
-    std::cout << std::string(indent, ' ') << "If(" << std::endl;
+    out << std::string(indent, ' ') << "If(" << '\n';
     indent += 2;
     ast->Cond->accept(this);
     indent -= 2;
-    std::cout << std::string(indent, ' ') << ")" << std::endl;
+    out << std::string(indent, ' ') << ")" << '\n';
 
-    std::cout << std::string(indent, ' ') << "Then(" << std::endl;
+    out << std::string(indent, ' ') << "Then(" << '\n';
     indent += 2;
     ast->Then->accept(this);
     indent -= 2;
-    std::cout << std::string(indent, ' ') << ")" << std::endl;
+    out << std::string(indent, ' ') << ")" << '\n';
 
-    std::cout << std::string(indent, ' ') << "Else(" << std::endl;
+    out << std::string(indent, ' ') << "Else(" << '\n';
     indent += 2;
     ast->Else->accept(this);
     indent -= 2;
-    std::cout << std::string(indent, ' ') << ")" << std::endl;
+    out << std::string(indent, ' ') << ")" << '\n';
     return std::nullopt;
 }
 
 std::optional<Error> Printer::visit(BinaryExprAST *ast)
 {
     indent += 2;
-    std::cout << std::string(indent, ' ') << ast->Op << std::endl;
+    out << std::string(indent, ' ') << ast->Op << '\n';
     ast->LHS->accept(this);
     ast->RHS->accept(this);
     indent -= 2;
@@ -70,26 +78,28 @@ std::optional<Error> Printer::visit(BinaryExprAST *ast)
 
 std::optional<Error> Printer::visit(PrototypeAST *ast)
 {
-    std::cout << std::string(indent, ' ') << "Proto(" << std::endl;
+    out << std::string(indent, ' ') << "Proto(" << '\n';
     indent += 2;
-    std::cout << std::string(indent, ' ') << ast->Name << std::endl;
+    out << std::string(indent, ' ') << ast->Name << '\n';
     for (const auto &arg : ast->Args)
     {
-        std::cout << std::string(indent, ' ') << arg << std::endl;
+        out << std::string(indent, ' ') << arg << '\n';
     }
     indent -= 2;
-    std::cout << std::string(indent, ' ') << ")" << std::endl;
+    out << std::string(indent, ' ') << ")" << '\n';
+    emit();
     return std::nullopt;
 }
 
 std::optional<Error> Printer::visit(FunctionAST *ast)
 {
-    std::cout << std::string(indent, ' ') << "Func(" << std::endl;
+    out << std::string(indent, ' ') << "Func(" << '\n';
     indent += 2;
     ast->Proto->accept(this);
     ast->Body->accept(this);
     indent -= 2;
-    std::cout << std::string(indent, ' ') << ")" << std::endl;
+    out << std::string(indent, ' ') << ")" << '\n';
+    emit();
     return std::nullopt;
 }
 
@@ -1,11 +1,17 @@
 #ifndef __PRINTER_H__
 #define __PRINTER_H__
 
+#include <sstream>
+
 #include "visitor/visitor.h"
 
+// Printer writes the AST of every item visited to the AST diagnostics.
 class Printer : public Visitor
 {
     int indent = 0;
+    std::ostringstream out;
+
+    void emit();
 
 public:
     std::optional<Error> visit(NumberExprAST *ast) override;
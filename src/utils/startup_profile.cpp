@@ -0,0 +1,42 @@
+#include "startup_profile.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "diagnostics.h"
+
+using Clock = std::chrono::steady_clock;
+
+// The start of the process, as far as we can tell: the static
+// initialization of this file.
+static const Clock::time_point start = Clock::now();
+
+// The nanoseconds from start to every milestone, 0 if not reached yet.
+static std::atomic<int64_t> reached[StartupProfile::NumMilestones];
+
+static const char *const names[StartupProfile::NumMilestones] = {
+    "first prompt",
+    "target initialized",
+    "JIT created",
+    "first result",
+};
+
+void StartupProfile::Record(Milestone m)
+{
+    int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    int64_t expected = 0;
+    reached[m].compare_exchange_strong(expected, ns > 0 ? ns : 1);
+}
+
+void StartupProfile::Print()
+{
+    Diagnostics::Printf(DiagCategory::Stats, "\nstartup profile:\n");
+    for (size_t i = 0; i < NumMilestones; i++)
+    {
+        if (int64_t ns = reached[i].load())
+            Diagnostics::Printf(DiagCategory::Stats, "  %-20s %8.3f ms\n", names[i], ns / 1e6);
+        else
+            Diagnostics::Printf(DiagCategory::Stats, "  %-20s %8s\n", names[i], "-");
+    }
+}
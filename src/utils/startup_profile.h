@@ -0,0 +1,32 @@
+#ifndef __STARTUP_PROFILE_H__
+#define __STARTUP_PROFILE_H__
+
+#include <cstddef>
+
+// StartupProfile records when the process first reached a few milestones,
+// relative to its start, to measure how long it takes to become useful.
+// Only the first time a milestone is reached counts, from any thread.
+class StartupProfile
+{
+public:
+    enum Milestone
+    {
+        // The first prompt, after the input was opened.
+        FirstPrompt,
+        // The native target was initialized, for the JIT or the data layout.
+        TargetInitialized,
+        // The JIT was created.
+        JITCreated,
+        // The first top-level expression was evaluated.
+        FirstResult,
+        NumMilestones,
+    };
+
+    static void Record(Milestone m);
+
+    // Print writes the milestones reached to the Stats diagnostics, in
+    // milliseconds.
+    static void Print();
+};
+
+#endif
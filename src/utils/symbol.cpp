@@ -0,0 +1,144 @@
+#include "symbol.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace
+{
+    // SymbolTable owns the interned names.
+    // Names are stored in fixed-size blocks that never move, so str() can
+    // read them without taking the lock while other threads intern.
+    class SymbolTable
+    {
+        static constexpr uint32_t BlockBits = 12;
+        static constexpr uint32_t BlockSize = 1 << BlockBits;
+        static constexpr uint32_t MaxBlocks = 4096;
+        static constexpr size_t CharBlockSize = 64 * 1024;
+
+        // An open-addressing hash table from names to IDs. Every slot keeps
+        // the full hash, so a probe only touches the name on a likely match.
+        struct Slot
+        {
+            uint32_t hash;
+            uint32_t id;
+        };
+
+        std::mutex lock;
+        std::vector<Slot> slots = std::vector<Slot>(1024);
+        std::unique_ptr<std::string_view[]> names[MaxBlocks];
+        std::atomic<uint32_t> numSymbols{1};
+
+        std::vector<std::unique_ptr<char[]>> chars;
+        char *charPos = nullptr;
+        size_t charLeft = 0;
+
+        // Copy a name into the character storage.
+        std::string_view store(std::string_view name)
+        {
+            if (name.size() > charLeft)
+            {
+                size_t size = std::max(CharBlockSize, name.size());
+                chars.push_back(std::make_unique<char[]>(size));
+                charPos = chars.back().get();
+                charLeft = size;
+            }
+            std::memcpy(charPos, name.data(), name.size());
+            std::string_view stored(charPos, name.size());
+            charPos += name.size();
+            charLeft -= name.size();
+            return stored;
+        }
+
+        static uint32_t hashName(std::string_view name)
+        {
+            // FNV-1a
+            uint32_t h = 2166136261u;
+            for (char c : name)
+                h = (h ^ static_cast<unsigned char>(c)) * 16777619u;
+            return h;
+        }
+
+        void grow()
+        {
+            std::vector<Slot> old = std::move(slots);
+            slots.assign(old.size() * 2, Slot{0, 0});
+            size_t mask = slots.size() - 1;
+            for (const Slot &slot : old)
+            {
+                if (slot.id == 0)
+                    continue;
+                size_t i = slot.hash & mask;
+                while (slots[i].id != 0)
+                    i = (i + 1) & mask;
+                slots[i] = slot;
+            }
+        }
+
+    public:
+        uint32_t intern(std::string_view name)
+        {
+            uint32_t h = hashName(name);
+            std::lock_guard<std::mutex> guard(lock);
+
+            size_t mask = slots.size() - 1;
+            size_t i = h & mask;
+            for (; slots[i].id != 0; i = (i + 1) & mask)
+            {
+                if (slots[i].hash == h && this->name(slots[i].id) == name)
+                    return slots[i].id;
+            }
+
+            uint32_t id = numSymbols.load(std::memory_order_relaxed);
+            auto &block = names[id >> BlockBits];
+            if (!block)
+                block = std::make_unique<std::string_view[]>(BlockSize);
+            std::string_view stored = store(name);
+            block[id & (BlockSize - 1)] = stored;
+            slots[i] = Slot{h, id};
+            numSymbols.store(id + 1, std::memory_order_release);
+
+            // Keep the load factor at most 1/2.
+            if (id * 2 >= slots.size())
+                grow();
+            return id;
+        }
+
+        std::string_view name(uint32_t id) const
+        {
+            if (id == 0)
+                return std::string_view();
+            return names[id >> BlockBits][id & (BlockSize - 1)];
+        }
+
+        uint32_t size() const
+        {
+            return numSymbols.load(std::memory_order_acquire);
+        }
+    };
+
+    SymbolTable &table()
+    {
+        static SymbolTable instance;
+        return instance;
+    }
+}
+
+Symbol Symbol::Intern(std::string_view name)
+{
+    return Symbol(table().intern(name));
+}
+
+uint32_t Symbol::NumSymbols()
+{
+    return table().size();
+}
+
+std::string_view Symbol::str() const
+{
+    return table().name(id);
+}
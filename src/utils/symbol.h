@@ -0,0 +1,72 @@
+#ifndef __SYMBOL_H__
+#define __SYMBOL_H__
+
+#include <cstdint>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+// Symbol is an interned name, e.g. of a variable or a function.
+// Interning the same string always gives the same Symbol, so symbols are
+// compared by ID and can index flat tables instead of string-keyed maps.
+// Symbol IDs are dense and start from 1, the default Symbol is empty.
+class Symbol
+{
+    uint32_t id = 0;
+
+    explicit Symbol(uint32_t id) : id(id) {}
+
+public:
+    Symbol() = default;
+
+    // Intern returns the symbol of a name, adding it to the global
+    // symbol table in its first encounter. It is safe to call from any thread.
+    static Symbol Intern(std::string_view name);
+
+    // FromId returns the symbol of an ID handed out by Intern,
+    // e.g. one stored in a token buffer.
+    static Symbol FromId(uint32_t id) { return Symbol(id); }
+
+    // NumSymbols returns an upper bound of all IDs handed out so far.
+    static uint32_t NumSymbols();
+
+    uint32_t getId() const { return id; }
+    bool empty() const { return id == 0; }
+
+    // str returns the interned name, which lives as long as the program.
+    std::string_view str() const;
+
+    bool operator==(Symbol other) const { return id == other.id; }
+    bool operator!=(Symbol other) const { return id != other.id; }
+};
+
+// SymbolMap maps symbols to values with a flat table indexed by symbol ID.
+// Entries of symbols that have not been set hold a value-initialized T.
+template <typename T>
+class SymbolMap
+{
+    std::vector<T> slots;
+
+public:
+    T &operator[](Symbol sym)
+    {
+        if (sym.getId() >= slots.size())
+            slots.resize(sym.getId() + 1);
+        return slots[sym.getId()];
+    }
+
+    const T &get(Symbol sym) const
+    {
+        static const T none{};
+        return sym.getId() < slots.size() ? slots[sym.getId()] : none;
+    }
+
+    void clear() { slots.clear(); }
+};
+
+inline std::ostream &operator<<(std::ostream &os, Symbol sym)
+{
+    return os << sym.str();
+}
+
+#endif
@@ -0,0 +1,51 @@
+#include <algorithm>
+
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(size_t numThreads)
+{
+    if (numThreads == 0)
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    workers.reserve(numThreads);
+    for (size_t i = 0; i < numThreads; i++)
+        workers.emplace_back([this]()
+                             { work(); });
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    ready.notify_all();
+    for (std::thread &worker : workers)
+        worker.join();
+}
+
+void ThreadPool::enqueue(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(std::move(task));
+    }
+    ready.notify_one();
+}
+
+void ThreadPool::work()
+{
+    while (true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            ready.wait(lock, [this]()
+                       { return stopping || !queue.empty(); });
+            if (queue.empty())
+                return;
+            task = std::move(queue.front());
+            queue.pop_front();
+        }
+        task();
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// ThreadPool runs tasks on a fixed set of worker threads, in the order
+// they were submitted. The destructor waits for all queued tasks.
+class ThreadPool
+{
+public:
+    // A pool of numThreads workers, or one per hardware thread if 0.
+    explicit ThreadPool(size_t numThreads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    size_t size() const { return workers.size(); }
+
+    // submit queues f and returns a future for its result.
+    template <typename F>
+    auto submit(F f) -> std::future<decltype(f())>
+    {
+        using R = decltype(f());
+        auto task = std::make_shared<std::packaged_task<R()>>(std::move(f));
+        std::future<R> result = task->get_future();
+        enqueue([task]()
+                { (*task)(); });
+        return result;
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> queue;
+    std::mutex mutex;
+    std::condition_variable ready;
+    bool stopping = false;
+
+    void enqueue(std::function<void()> task);
+    void work();
+};
+
+#endif
@@ -0,0 +1,112 @@
+#include "gtest/gtest.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "utils/arena.h"
+
+TEST(ArenaTest, Make)
+{
+  Arena arena;
+  struct Pair
+  {
+    char c;
+    double d;
+  };
+
+  char *c = arena.make<char>('x');
+  Pair *p = arena.make<Pair>(Pair{'y', 1.5});
+  EXPECT_EQ('x', *c);
+  EXPECT_EQ('y', p->c);
+  EXPECT_EQ(1.5, p->d);
+  EXPECT_EQ(0, reinterpret_cast<uintptr_t>(p) % alignof(Pair));
+  EXPECT_EQ(1, arena.numBlocks());
+
+  // Objects larger than a block get one of their own.
+  arena.allocate(1 << 20, 8);
+  EXPECT_EQ(2, arena.numBlocks());
+}
+
+TEST(ArenaTest, CopyArray)
+{
+  Arena arena;
+  std::vector<int> v = {1, 2, 3};
+  ArenaArray<int> a = arena.copyArray(v.data(), v.size());
+  ASSERT_EQ(3, a.size());
+  EXPECT_NE(v.data(), a.data());
+  EXPECT_EQ(std::vector<int>(a.begin(), a.end()), v);
+  EXPECT_TRUE(arena.copyArray<int>(nullptr, 0).empty());
+}
+
+TEST(ArenaTest, Rollback)
+{
+  Arena arena;
+  Arena::Mark empty = arena.mark();
+  int *first = arena.make<int>(1);
+
+  Arena::Mark mark = arena.mark();
+  int *second = arena.make<int>(2);
+  for (int i = 0; i < 100000; i++)
+    arena.make<int>(i);
+  size_t blocks = arena.numBlocks();
+  EXPECT_GT(blocks, 1);
+
+  // Memory after the mark is reused, including the blocks it spilled into.
+  arena.rollback(mark);
+  EXPECT_EQ(second, arena.make<int>(3));
+  for (int i = 0; i < 100000; i++)
+    arena.make<int>(i);
+  EXPECT_EQ(blocks, arena.numBlocks());
+  EXPECT_EQ(1, *first);
+
+  arena.rollback(empty);
+  EXPECT_EQ(first, arena.make<int>(4));
+}
+
+TEST(ArenaTest, Adopt)
+{
+  Arena arena;
+  int *own = arena.make<int>(1);
+
+  Arena other;
+  int *adopted = other.make<int>(2);
+  arena.adopt(std::move(other));
+  EXPECT_EQ(2, arena.numBlocks());
+  EXPECT_EQ(0, other.numBlocks());
+
+  // Allocation goes on in the current block and leaves the adopted one alone.
+  Arena::Mark mark = arena.mark();
+  int *next = arena.make<int>(3);
+  EXPECT_EQ(own + 1, next);
+  arena.rollback(mark);
+  for (int i = 0; i < 100000; i++)
+    arena.make<int>(i);
+  EXPECT_EQ(1, *own);
+  EXPECT_EQ(2, *adopted);
+
+  // An empty arena takes over the blocks as they are.
+  Arena empty;
+  Arena third;
+  int *x = third.make<int>(5);
+  empty.adopt(std::move(third));
+  empty.make<int>(6);
+  EXPECT_EQ(2, empty.numBlocks());
+  EXPECT_EQ(5, *x);
+}
+
+TEST(ArenaTest, BytesSince)
+{
+  Arena arena;
+  Arena::Mark empty = arena.mark();
+  EXPECT_EQ(0, arena.bytesSince(empty));
+  arena.make<int64_t>(1);
+  EXPECT_EQ(8, arena.bytesSince(empty));
+
+  // Padding counts, and so does the rest of a block that was filled up.
+  Arena::Mark mark = arena.mark();
+  arena.make<char>('x');
+  arena.make<int64_t>(2);
+  EXPECT_EQ(16, arena.bytesSince(mark));
+  arena.allocate(1 << 20, 8);
+  EXPECT_EQ(64 * 1024 - 8 + (1 << 20), arena.bytesSince(mark));
+}
@@ -0,0 +1,49 @@
+#include "gtest/gtest.h"
+
+#include <string>
+
+#include "utils/diagnostics.h"
+
+TEST(DiagnosticsTest, ParseCategories)
+{
+  EXPECT_EQ(DiagBit(DiagCategory::AST) | DiagBit(DiagCategory::IR),
+            Diagnostics::ParseCategories("ast,ir"));
+  EXPECT_EQ(Diagnostics::All, Diagnostics::ParseCategories("error,all"));
+  EXPECT_EQ(0u, Diagnostics::ParseCategories("none"));
+  EXPECT_EQ(std::nullopt, Diagnostics::ParseCategories("ast,bogus"));
+}
+
+TEST(DiagnosticsTest, OnlyEnabledCategoriesAreWritten)
+{
+  unsigned saved = Diagnostics::EnabledMask();
+  Diagnostics::SetEnabled(DiagBit(DiagCategory::Result));
+
+  testing::internal::CaptureStderr();
+  Diagnostics::Printf(DiagCategory::Result, "result %d\n", 1);
+  Diagnostics::Printf(DiagCategory::Prompt, "ready> ");
+  bool called = false;
+  Diagnostics::Print(DiagCategory::IR, [&](llvm::raw_ostream &os)
+                     { called = true; });
+  Diagnostics::Print(DiagCategory::Result, [](llvm::raw_ostream &os)
+                     { os << std::string(300, 'x') << '\n'; });
+  Diagnostics::Flush();
+  std::string out = testing::internal::GetCapturedStderr();
+  Diagnostics::SetEnabled(saved);
+
+  EXPECT_FALSE(called);
+  EXPECT_EQ("result 1\n" + std::string(300, 'x') + "\n", out);
+}
+
+TEST(DiagnosticsTest, ErrorsAreFlushed)
+{
+  unsigned saved = Diagnostics::EnabledMask();
+  Diagnostics::SetEnabled(Diagnostics::Quiet);
+
+  testing::internal::CaptureStderr();
+  Diagnostics::Printf(DiagCategory::Result, "%s\n", std::string(500, 'r').c_str());
+  Diagnostics::Printf(DiagCategory::Error, "error: oops\n");
+  std::string out = testing::internal::GetCapturedStderr();
+  Diagnostics::SetEnabled(saved);
+
+  EXPECT_EQ(std::string(500, 'r') + "\nerror: oops\n", out);
+}
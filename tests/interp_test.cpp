@@ -0,0 +1,171 @@
+#include "gtest/gtest.h"
+
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "lexer/input.h"
+#include "lexer/lexer.h"
+#include "parser/parser.h"
+#include "interp/interpreter.h"
+
+#include "ast/FunctionAST.h"
+#include "ast/ProgramAST.h"
+#include "ast/PrototypeAST.h"
+
+static int nativeSquareCalls = 0;
+
+static double nativeSquare(double x)
+{
+  nativeSquareCalls++;
+  return x * x;
+}
+
+static double nativeSin(double x) { return std::sin(x); }
+
+class InterpreterTest : public testing::Test
+{
+protected:
+  void SetUp() override
+  {
+    nativeSquareCalls = 0;
+    interp = std::make_unique<Interpreter>([](Symbol name) -> void *
+                                           {
+      if (name.str() == "square")
+        return reinterpret_cast<void *>(&nativeSquare);
+      if (name.str() == "sin")
+        return reinterpret_cast<void *>(&nativeSin);
+      return nullptr; });
+  }
+
+  // Define the functions of source and run its top-level expressions.
+  std::vector<double> run(const std::string &source)
+  {
+    Lexer lexer(std::make_unique<MemoryInput>(source));
+    Parser parser(std::make_shared<TokenBuffer>(lexer.Tokenize()));
+    program = parser.ParseProgram().value();
+
+    std::vector<double> results;
+    for (AST *node : program->Nodes)
+    {
+      auto fn = dynamic_cast<FunctionAST *>(node);
+      if (!fn)
+        continue;
+      if (!fn->Proto->isMain())
+      {
+        auto err = interp->Define(fn);
+        EXPECT_FALSE(err.has_value()) << err->message;
+        continue;
+      }
+      auto r = interp->Run(fn);
+      EXPECT_TRUE(r.has_value());
+      if (r && r->isOk())
+        results.push_back(r->value());
+    }
+    return results;
+  }
+
+  std::unique_ptr<Interpreter> interp;
+  std::unique_ptr<ProgramAST> program;
+};
+
+TEST_F(InterpreterTest, Expressions)
+{
+  auto results = run("1 + 2 * 3; 4 - 5; 2 < 3; 3 < 2; if 0 then 1 else 2; if 1 then 1 else 2;");
+  EXPECT_EQ((std::vector<double>{7, -1, 1, 0, 2, 1}), results);
+}
+
+TEST_F(InterpreterTest, Functions)
+{
+  auto results = run(
+      "def sq(x) x * x;"
+      "def sum(n) if n < 1 then 0 else sq(n) + sum(n - 1);"
+      "def pick(a, b, c) if a then b else c;"
+      "sum(10); pick(0, 1, sq(3)); pick(1, sum(2), 7);");
+  EXPECT_EQ((std::vector<double>{385, 9, 5}), results);
+  EXPECT_EQ(0u, interp->NumNativeCalls);
+}
+
+TEST_F(InterpreterTest, NativeCalls)
+{
+  auto results = run("extern sin(x); sin(0) + 1;");
+  EXPECT_EQ((std::vector<double>{1}), results);
+  EXPECT_EQ(1u, interp->NumNativeCalls);
+}
+
+TEST_F(InterpreterTest, HotFunctionsRunNatively)
+{
+  interp->HotThreshold = 2;
+  auto results = run(
+      "def square(x) x * x;"
+      "square(1) + square(2) + square(3) + square(4);");
+  EXPECT_EQ((std::vector<double>{30}), results);
+  EXPECT_EQ(2u, interp->NumInterpretedCalls);
+  EXPECT_EQ(2, nativeSquareCalls);
+}
+
+TEST_F(InterpreterTest, FailedRedefinitionRunsNatively)
+{
+  Lexer lexer(std::make_unique<MemoryInput>("def square(x) x + 1; def square(x) y; square(3);"));
+  Parser parser(std::make_shared<TokenBuffer>(lexer.Tokenize()));
+  program = parser.ParseProgram().value();
+  ASSERT_EQ(3u, program->Nodes.size());
+
+  EXPECT_FALSE(interp->Define(dynamic_cast<FunctionAST *>(program->Nodes[0])));
+  EXPECT_TRUE(interp->Define(dynamic_cast<FunctionAST *>(program->Nodes[1])).has_value());
+
+  // The old body is gone, the native code has the new one.
+  auto r = interp->Run(dynamic_cast<FunctionAST *>(program->Nodes[2]));
+  ASSERT_TRUE(r.has_value());
+  ASSERT_TRUE(r->isOk());
+  EXPECT_EQ(9, r->value());
+  EXPECT_EQ(1, nativeSquareCalls);
+}
+
+TEST_F(InterpreterTest, CallsWithManyArgumentsAreLeftToTheJIT)
+{
+  interp->HotThreshold = 2;
+  Lexer lexer(std::make_unique<MemoryInput>(
+      "extern many(a, b, c, d, e, f, g, h, i);"
+      "many(1, 2, 3, 4, 5, 6, 7, 8, 9);"
+      "def sum9(a, b, c, d, e, f, g, h, i) a + b + c + d + e + f + g + h + i;"
+      "def sum(x) sum9(x, x, x, x, x, x, x, x, x);"
+      "sum9(1, 1, 1, 1, 1, 1, 1, 1, 1) + sum9(2, 2, 2, 2, 2, 2, 2, 2, 2) + sum9(3, 3, 3, 3, 3, 3, 3, 3, 3);"));
+  Parser parser(std::make_shared<TokenBuffer>(lexer.Tokenize()));
+  program = parser.ParseProgram().value();
+  ASSERT_EQ(5u, program->Nodes.size());
+
+  EXPECT_FALSE(interp->Run(dynamic_cast<FunctionAST *>(program->Nodes[1])).has_value());
+
+  // sum9 has bytecode, but is called natively once it is hot, so neither
+  // its callers nor the expression get any.
+  EXPECT_FALSE(interp->Define(dynamic_cast<FunctionAST *>(program->Nodes[2])));
+  auto err = interp->Define(dynamic_cast<FunctionAST *>(program->Nodes[3]));
+  ASSERT_TRUE(err.has_value());
+  EXPECT_EQ("too many arguments for a native call", err->message);
+  EXPECT_FALSE(interp->Run(dynamic_cast<FunctionAST *>(program->Nodes[4])).has_value());
+  EXPECT_EQ(0u, interp->NumInterpretedCalls);
+  EXPECT_EQ(0u, interp->NumNativeCalls);
+}
+
+TEST_F(InterpreterTest, Errors)
+{
+  Lexer lexer(std::make_unique<MemoryInput>("def f(x) y; def g(x) x; g(1, 2); missing(1);"));
+  Parser parser(std::make_shared<TokenBuffer>(lexer.Tokenize()));
+  program = parser.ParseProgram().value();
+  ASSERT_EQ(4u, program->Nodes.size());
+
+  auto err = interp->Define(dynamic_cast<FunctionAST *>(program->Nodes[0]));
+  ASSERT_TRUE(err.has_value());
+  EXPECT_EQ("unknown variable name", err->message);
+  EXPECT_FALSE(interp->Define(dynamic_cast<FunctionAST *>(program->Nodes[1])));
+
+  // Left to the JIT, which reports the error.
+  EXPECT_FALSE(interp->Run(dynamic_cast<FunctionAST *>(program->Nodes[2])).has_value());
+
+  auto r = interp->Run(dynamic_cast<FunctionAST *>(program->Nodes[3]));
+  ASSERT_TRUE(r.has_value());
+  ASSERT_TRUE(r->isError());
+  EXPECT_EQ("unknown function referenced", r->error().message);
+}
@@ -0,0 +1,239 @@
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "codegen/codegen.h"
+#include "jit/jit_manager.h"
+#include "lexer/input.h"
+#include "lexer/lexer.h"
+#include "parser/parser.h"
+
+#include "ast/ProgramAST.h"
+
+using namespace std::chrono_literals;
+
+class JITTest : public testing::Test
+{
+protected:
+  // start creates a JIT with opts, to which add adds code.
+  void start(const JITOptions &opts)
+  {
+    jm = std::make_shared<JITManager>(opts);
+    codegen = std::make_unique<CodeGen>(jm);
+    codegen->Batch = true;
+  }
+
+  // add compiles the functions defined by source into a module of their
+  // own and adds it to the JIT, which compiles it on the first call.
+  llvm::Error add(const std::string &source)
+  {
+    Lexer lexer(std::make_unique<MemoryInput>(source));
+    Parser parser(std::make_shared<TokenBuffer>(lexer.Tokenize()));
+    EXPECT_FALSE(parser.ParseProgram({codegen.get()}).isError()) << source;
+    return jm->JIT().addModule(codegen->TakeModule());
+  }
+
+  // call calls the function name, which takes one argument.
+  double call(const std::string &name, double x)
+  {
+    auto fn = reinterpret_cast<double (*)(double)>(jm->JITLookup(name));
+    EXPECT_NE(nullptr, fn) << name;
+    return fn ? fn(x) : 0;
+  }
+
+  // stubTarget returns the code that the stub of name points at.
+  void *stubTarget(const std::string &name)
+  {
+    return jm->JIT().getStubTarget(name).toPtr<void *>();
+  }
+
+  std::shared_ptr<JITManager> jm;
+  std::unique_ptr<CodeGen> codegen;
+};
+
+TEST_F(JITTest, TierUp)
+{
+  JITOptions opts;
+  opts.Tiered = true;
+  opts.TierUpThreshold = 10;
+  start(opts);
+  ASSERT_FALSE(add("def f(x) x * 3;"));
+  EXPECT_EQ(1u, jm->NumTiered());
+
+  // The first call compiles the baseline code and points the stub at it.
+  EXPECT_EQ(6, call("f", 2));
+  EXPECT_EQ(jm->JITLookup("f$tier0"), stubTarget("f"));
+
+  for (int i = 1; i < 10; i++)
+    EXPECT_EQ(3 * i, call("f", i));
+  // The optimized code is compiled in the background.
+  for (int i = 0; i < 1000 && jm->NumTieredUp() == 0; i++)
+    std::this_thread::sleep_for(10ms);
+  ASSERT_EQ(1u, jm->NumTieredUp());
+  EXPECT_EQ(jm->JITLookup("f$tier1"), stubTarget("f"));
+  EXPECT_EQ(6, call("f", 2));
+}
+
+TEST_F(JITTest, TieredDuplicateDefinition)
+{
+  JITOptions opts;
+  opts.Tiered = true;
+  start(opts);
+  ASSERT_FALSE(add("def f(x) x * 3;"));
+  EXPECT_EQ(6, call("f", 2));
+
+  // The first definition and its code stay.
+  llvm::Error err = add("def f(x) x * 5;");
+  EXPECT_TRUE(err.isA<llvm::orc::DuplicateDefinition>());
+  llvm::consumeError(std::move(err));
+  EXPECT_EQ(1u, jm->NumTiered());
+  EXPECT_EQ(6, call("f", 2));
+}
+
+TEST_F(JITTest, Redefinition)
+{
+  JITOptions opts;
+  opts.Redefinable = true;
+  start(opts);
+  ASSERT_FALSE(add("def sq(x) x * x;"));
+  ASSERT_FALSE(add("def quad(x) sq(x) * sq(x);"));
+  ASSERT_FALSE(add("def count(n) if n < 1 then 0 else 1 + count(n - 1);"));
+  EXPECT_EQ(16, call("quad", 2));
+  EXPECT_EQ(3, call("count", 3));
+
+  // quad, compiled before, and the recursive calls reach the new bodies.
+  ASSERT_FALSE(add("def sq(x) x + 1;"));
+  ASSERT_FALSE(add("def count(n) if n < 1 then 0 else 2 + count(n - 1);"));
+  EXPECT_EQ(9, call("quad", 2));
+  EXPECT_EQ(6, call("count", 3));
+  EXPECT_EQ(2u, jm->NumRedefined());
+  EXPECT_EQ(jm->JITLookup("sq$v2"), stubTarget("sq"));
+
+  // The modules of the old bodies are gone.
+  EXPECT_EQ(nullptr, jm->JITLookup("sq$v1"));
+  EXPECT_EQ(nullptr, jm->JITLookup("count$v1"));
+}
+
+TEST_F(JITTest, DuplicateDefinitionWithoutRedefinition)
+{
+  // With a code budget every function is behind a stub too.
+  JITOptions opts;
+  opts.CodeBudget = 1 << 20;
+  start(opts);
+  ASSERT_FALSE(add("def sq(x) x * x;"));
+  llvm::Error err = add("def sq(x) x + 1;");
+  EXPECT_TRUE(err.isA<llvm::orc::DuplicateDefinition>());
+  llvm::consumeError(std::move(err));
+  EXPECT_EQ(4, call("sq", 2));
+  EXPECT_EQ(0u, jm->NumRedefined());
+}
+
+TEST_F(JITTest, EvictionAndReload)
+{
+  // Nothing fits in the budget, code is evicted after every call.
+  JITOptions opts;
+  opts.CodeBudget = 1;
+  start(opts);
+  ASSERT_FALSE(add("def f(x) x * 3;"));
+  ASSERT_FALSE(add("def g(x) x * 5;"));
+  EXPECT_EQ(6, call("f", 2));
+  jm->EvictColdCode();
+  EXPECT_EQ(1u, jm->NumEvicted());
+  EXPECT_EQ(0u, jm->LoadedCodeBytes());
+  void *trampoline = stubTarget("f");
+
+  EXPECT_EQ(10, call("g", 2));
+  jm->EvictColdCode();
+  EXPECT_EQ(2u, jm->NumEvicted());
+
+  // f is compiled again, and its stub points at the new code once it is
+  // ready, so the next call does not go through the trampoline.
+  EXPECT_EQ(6, call("f", 2));
+  EXPECT_EQ(1u, jm->NumReloaded());
+  void *body = jm->JITLookup("f$v1");
+  EXPECT_NE(trampoline, body);
+  EXPECT_EQ(body, stubTarget("f"));
+  EXPECT_EQ(9, call("f", 3));
+  EXPECT_EQ(1u, jm->NumReloaded());
+
+  // Evicting it again reuses the trampoline.
+  jm->EvictColdCode();
+  EXPECT_EQ(3u, jm->NumEvicted());
+  EXPECT_EQ(trampoline, stubTarget("f"));
+  EXPECT_EQ(6, call("f", 2));
+  EXPECT_EQ(2u, jm->NumReloaded());
+}
+
+TEST_F(JITTest, EvictionGivesASecondChance)
+{
+  // The budget fits the code of one of f, g and h, which have the same size.
+  size_t size;
+  {
+    JITOptions opts;
+    opts.CodeBudget = 1 << 20;
+    start(opts);
+    ASSERT_FALSE(add("def f(x) x * 3;"));
+    call("f", 1);
+    size = jm->LoadedCodeBytes();
+    ASSERT_GT(size, 0u);
+  }
+  JITOptions opts;
+  opts.CodeBudget = size;
+  start(opts);
+  ASSERT_FALSE(add("def f(x) x * 3;"));
+  ASSERT_FALSE(add("def g(x) x * 5;"));
+  ASSERT_FALSE(add("def h(x) x * 7;"));
+
+  // Both ran, each is passed over once and f, loaded first, goes.
+  call("f", 1);
+  call("g", 1);
+  jm->EvictColdCode();
+  EXPECT_EQ(1u, jm->NumEvicted());
+  EXPECT_EQ(size, jm->LoadedCodeBytes());
+
+  // g has not run since, h has.
+  call("h", 1);
+  jm->EvictColdCode();
+  EXPECT_EQ(2u, jm->NumEvicted());
+  EXPECT_EQ(jm->JITLookup("h$v1"), stubTarget("h"));
+  EXPECT_EQ(0u, jm->NumReloaded());
+}
+
+TEST_F(JITTest, PerfMap)
+{
+  for (bool jitLink : {false, true})
+  {
+    JITOptions opts;
+    opts.JITLink = jitLink;
+    opts.PerfMapPath = testing::TempDir() + "/jit_test_perf.map";
+    start(opts);
+    ASSERT_FALSE(add("def f(x) x * 3;"));
+    void *f = jm->JITLookup("f");
+    ASSERT_NE(nullptr, f);
+
+    // Every function gets an "<address> <size> <name>" line, in hex.
+    std::ifstream in(opts.PerfMapPath);
+    std::string line;
+    bool found = false;
+    while (std::getline(in, line))
+    {
+      unsigned long long addr, size;
+      char name[16];
+      if (sscanf(line.c_str(), "%llx %llx %15s", &addr, &size, name) == 3 &&
+          std::string(name) == "f")
+      {
+        found = true;
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(f), addr) << line;
+        EXPECT_GT(size, 0u) << line;
+      }
+    }
+    EXPECT_TRUE(found) << (jitLink ? "JITLink" : "RuntimeDyld");
+    std::remove(opts.PerfMapPath.c_str());
+  }
+}
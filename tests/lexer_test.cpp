@@ -1,10 +1,15 @@
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
+#include <cstdio>
 #include <memory>
 #include <string>
+#include <vector>
 
+#include "lexer/file_input.h"
+#include "lexer/input.h"
 #include "lexer/lexer.h"
+#include "lexer/source_lines.h"
 #include "lexer/token.h"
 
 #include "mock/mock.h"
@@ -89,3 +94,139 @@ TEST_F(LexerTest, GetNum) {
 
   EXPECT_EQ(lexer->GetNextToken(), tok_eof);
 }
+
+TEST_F(LexerTest, Tokenize) {
+  // The mock input hands out one character per chunk.
+  SetUp("def f(x)\n  # c\n  x*2.5");
+
+  TokenBuffer tokens = lexer->Tokenize();
+  std::vector<int> kinds = {tok_def, tok_identifier, '(', tok_identifier, ')',
+                            tok_identifier, '*', tok_number, tok_eof};
+  std::vector<uint32_t> offsets = {0, 4, 5, 6, 7, 17, 18, 19, 22};
+  ASSERT_EQ(kinds.size(), tokens.size());
+  for (size_t i = 0; i < kinds.size(); i++) {
+    EXPECT_EQ(kinds[i], tokens.kind(i)) << i;
+    EXPECT_EQ(offsets[i], tokens.offset(i)) << i;
+  }
+  EXPECT_EQ("f", tokens.symbol(1).str());
+  EXPECT_EQ("x", tokens.symbol(5).str());
+  EXPECT_EQ(2.5, tokens.number(7));
+}
+
+TEST_F(LexerTest, TrackLines) {
+  SetUp("def f(x)\n  # c\n  x*2.5");
+  SourceLines lines("f.k");
+  lexer->TrackLines(&lines);
+  lexer->Tokenize();
+
+  auto expectAt = [&](uint32_t offset, unsigned line, unsigned column) {
+    SourceLocation loc = lines.Locate(offset);
+    EXPECT_EQ(line, loc.Line) << offset;
+    EXPECT_EQ(column, loc.Column) << offset;
+  };
+  expectAt(0, 1, 1);
+  expectAt(4, 1, 5);
+  expectAt(8, 1, 9);
+  expectAt(9, 2, 1);
+  expectAt(17, 3, 3);
+  expectAt(22, 3, 8);
+}
+
+TEST(LexerInputTest, MemoryInput) {
+  std::string source = "def fib(x) x < 3.5 # comment\nextern";
+  Lexer lexer(std::make_unique<MemoryInput>(source));
+
+  EXPECT_EQ(lexer.GetNextToken(), tok_def);
+  EXPECT_EQ(lexer.GetNextToken(), tok_identifier);
+  EXPECT_EQ(lexer.IdentifierStr, "fib");
+  EXPECT_EQ(lexer.GetNextToken(), '(');
+  EXPECT_EQ(lexer.GetNextToken(), tok_identifier);
+  EXPECT_EQ(lexer.IdentifierStr, "x");
+  EXPECT_EQ(lexer.GetNextToken(), ')');
+  EXPECT_EQ(lexer.GetNextToken(), tok_identifier);
+  EXPECT_EQ(lexer.GetNextToken(), '<');
+  EXPECT_EQ(lexer.GetNextToken(), tok_number);
+  EXPECT_EQ(lexer.NumVal, 3.5);
+  EXPECT_EQ(lexer.GetNextToken(), tok_extern);
+  EXPECT_EQ(lexer.GetNextToken(), tok_eof);
+  EXPECT_EQ(lexer.GetNextToken(), tok_eof);
+}
+
+TEST(LexerInputTest, MappedFileInput) {
+  std::string path = testing::TempDir() + "lexer_input_test.k";
+  FILE *f = fopen(path.c_str(), "w");
+  ASSERT_NE(nullptr, f);
+  fputs("extern sin(x)\n1.5", f);
+  fclose(f);
+
+  auto r = MappedFileInput::Open(path);
+  ASSERT_TRUE(r.isOk());
+  Lexer lexer(r.value());
+
+  EXPECT_EQ(lexer.GetNextToken(), tok_extern);
+  EXPECT_EQ(lexer.GetNextToken(), tok_identifier);
+  EXPECT_EQ(lexer.IdentifierStr, "sin");
+  EXPECT_EQ(lexer.GetNextToken(), '(');
+  EXPECT_EQ(lexer.GetNextToken(), tok_identifier);
+  EXPECT_EQ(lexer.GetNextToken(), ')');
+  EXPECT_EQ(lexer.GetNextToken(), tok_number);
+  EXPECT_EQ(lexer.NumVal, 1.5);
+  EXPECT_EQ(lexer.GetNextToken(), tok_eof);
+  remove(path.c_str());
+
+  EXPECT_TRUE(MappedFileInput::Open(path).isError());
+}
+
+TEST(LexerInputTest, LongRuns) {
+  // Runs longer than a SIMD block, ending at every offset within a block.
+  for (size_t n = 1; n < 40; n++) {
+    std::string name = "x" + std::string(n, 'a') + std::string(n, '7') + "Z";
+    std::string source = std::string(n, ' ') + "\t\r\n" + name + "(" +
+                         std::string(n, '\n') + "#" + std::string(n, '#') +
+                         "\r" + name + "\f\v1";
+    Lexer lexer(std::make_unique<MemoryInput>(source));
+
+    EXPECT_EQ(lexer.GetNextToken(), tok_identifier);
+    EXPECT_EQ(lexer.IdentifierStr, name);
+    EXPECT_EQ(lexer.GetNextToken(), '(');
+    EXPECT_EQ(lexer.GetNextToken(), tok_identifier);
+    EXPECT_EQ(lexer.IdentifierStr, name);
+    EXPECT_EQ(lexer.GetNextToken(), tok_number);
+    EXPECT_EQ(lexer.NumVal, 1);
+    EXPECT_EQ(lexer.GetNextToken(), tok_eof);
+  }
+}
+
+TEST(LexerInputTest, Keywords) {
+  Lexer lexer(std::make_unique<MemoryInput>(
+      "def extern if then else de defs iff then0 Else elsee e"));
+
+  EXPECT_EQ(lexer.GetNextToken(), tok_def);
+  EXPECT_EQ(lexer.GetNextToken(), tok_extern);
+  EXPECT_EQ(lexer.GetNextToken(), tok_if);
+  EXPECT_EQ(lexer.GetNextToken(), tok_then);
+  EXPECT_EQ(lexer.GetNextToken(), tok_else);
+  for (int i = 0; i < 7; i++)
+    EXPECT_EQ(lexer.GetNextToken(), tok_identifier);
+  EXPECT_EQ(lexer.GetNextToken(), tok_eof);
+}
+
+TEST(LexerInputTest, NumbersMatchStrtod) {
+  std::vector<std::string> literals = {
+      "0", "7", ".5", "5.", "0.1", "0.3", "3.14159265358979", "1e", "00012.50",
+      "9007199254740993", "123456789012345678901234567890",
+      "0.0000000000000000000000001", "2.2250738585072014", "."};
+  std::string source;
+  for (const auto &lit : literals)
+    source += lit + " ";
+  Lexer lexer(std::make_unique<MemoryInput>(source));
+
+  for (const auto &lit : literals) {
+    EXPECT_EQ(lexer.GetNextToken(), tok_number) << lit;
+    EXPECT_EQ(lexer.NumVal, strtod(lit.c_str(), nullptr)) << lit;
+    if (lit == "1e") {
+      EXPECT_EQ(lexer.GetNextToken(), tok_identifier);
+    }
+  }
+  EXPECT_EQ(lexer.GetNextToken(), tok_eof);
+}
@@ -0,0 +1,32 @@
+#include "gtest/gtest.h"
+
+#include "utils/memory_usage.h"
+
+// Accounting is global, so this runs before any test enables it.
+TEST(MemoryAccountingTest, DisabledAccountingRecordsNothing)
+{
+  ASSERT_FALSE(MemoryAccounting::Enabled());
+  MemoryAccounting::Add("fib", MemoryKind::Code, 100);
+  EXPECT_EQ(0u, MemoryAccounting::Total(MemoryKind::Code));
+}
+
+TEST(MemoryAccountingTest, FreedMemoryIsTakenOff)
+{
+  MemoryAccounting::Enable();
+  MemoryAccounting::Add("fib", MemoryKind::IR, 300);
+  MemoryAccounting::Add("fib", MemoryKind::Code, 100);
+  MemoryAccounting::Add("sq", MemoryKind::Code, 50);
+  EXPECT_EQ(300u, MemoryAccounting::Total(MemoryKind::IR));
+  EXPECT_EQ(150u, MemoryAccounting::Total(MemoryKind::Code));
+
+  MemoryAccounting::Add("fib", MemoryKind::Code, -100);
+  EXPECT_EQ(50u, MemoryAccounting::Total(MemoryKind::Code));
+  EXPECT_EQ(0u, MemoryAccounting::Total(MemoryKind::AST));
+}
+
+TEST(MemoryUsageTest, Current)
+{
+  MemoryUsage usage = MemoryUsage::Current();
+  EXPECT_GT(usage.ResidentBytes, 0u);
+  EXPECT_GT(usage.NumMappings, 0u);
+}
@@ -0,0 +1,140 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "jit/object_cache.h"
+
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+
+namespace fs = std::filesystem;
+using namespace std::chrono_literals;
+
+class ObjectCacheTest : public testing::Test
+{
+protected:
+  void SetUp() override
+  {
+    const char *test = testing::UnitTest::GetInstance()->current_test_info()->name();
+    dir = fs::path(testing::TempDir()) / (std::string("object_cache_test_") + test);
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+  }
+
+  void TearDown() override { fs::remove_all(dir); }
+
+  // put writes an object of size bytes, last used age ago.
+  fs::path put(const std::string &name, size_t size, fs::file_time_type::duration age)
+  {
+    fs::path path = dir / name;
+    std::ofstream(path, std::ios::binary) << std::string(size, 'x');
+    fs::last_write_time(path, fs::file_time_type::clock::now() - age);
+    return path;
+  }
+
+  // module returns a module of its own, declaring fn.
+  std::unique_ptr<llvm::Module> module(const std::string &fn)
+  {
+    auto m = std::make_unique<llvm::Module>(fn, context);
+    llvm::Function::Create(llvm::FunctionType::get(llvm::Type::getDoubleTy(context), false),
+                           llvm::Function::ExternalLinkage, fn, *m);
+    return m;
+  }
+
+  // compile stores an object of size bytes for m, as the JIT does when
+  // the cache misses.
+  void compile(DiskObjectCache &cache, const llvm::Module &m, size_t size)
+  {
+    ASSERT_EQ(nullptr, cache.getObject(&m));
+    std::string object(size, 'o');
+    cache.notifyObjectCompiled(&m, llvm::MemoryBufferRef(object, "object"));
+  }
+
+  // objects lists the objects in the cache, without the other files.
+  std::vector<std::string> objects() const
+  {
+    std::vector<std::string> names;
+    for (const fs::directory_entry &e : fs::directory_iterator(dir))
+    {
+      if (e.path().extension() == ".o")
+        names.push_back(e.path().filename().string());
+    }
+    std::sort(names.begin(), names.end());
+    return names;
+  }
+
+  fs::path dir;
+  llvm::LLVMContext context;
+};
+
+TEST_F(ObjectCacheTest, OpenEvictsLeastRecentlyUsed)
+{
+  put("a.o", 100, 3h);
+  put("b.o", 100, 2h);
+  put("c.o", 100, 1h);
+  put("notes.txt", 500, 4h);
+
+  auto cache = DiskObjectCache::Open(dir.string(), 250, "salt").value();
+  EXPECT_EQ(1u, cache->NumEvictions());
+  EXPECT_EQ((std::vector<std::string>{"b.o", "c.o"}), objects());
+  // Only objects are counted and removed.
+  EXPECT_TRUE(fs::exists(dir / "notes.txt"));
+}
+
+TEST_F(ObjectCacheTest, EvictsToThreeQuartersOfTheLimit)
+{
+  put("a.o", 100, 3h);
+  put("b.o", 100, 2h);
+  put("c.o", 100, 1h);
+  auto cache = DiskObjectCache::Open(dir.string(), 400, "salt").value();
+  EXPECT_EQ(0u, cache->NumEvictions());
+
+  // 450 bytes are over the limit, down to 300 a and b have to go.
+  auto m = module("f");
+  compile(*cache, *m, 150);
+  EXPECT_EQ(2u, cache->NumEvictions());
+  EXPECT_FALSE(fs::exists(dir / "a.o"));
+  EXPECT_FALSE(fs::exists(dir / "b.o"));
+  EXPECT_TRUE(fs::exists(dir / "c.o"));
+  EXPECT_EQ(2u, objects().size());
+
+  EXPECT_NE(nullptr, cache->getObject(m.get()));
+  EXPECT_EQ(1u, cache->NumHits());
+  EXPECT_EQ(1u, cache->NumMisses());
+}
+
+TEST_F(ObjectCacheTest, LoadedObjectsAreRecentlyUsed)
+{
+  put("b.o", 100, 2h);
+  put("c.o", 100, 1h);
+  auto cache = DiskObjectCache::Open(dir.string(), 300, "salt").value();
+
+  auto f = module("f");
+  compile(*cache, *f, 100);
+  fs::path fPath;
+  for (const std::string &name : objects())
+  {
+    if (name != "b.o" && name != "c.o")
+      fPath = dir / name;
+  }
+  ASSERT_FALSE(fPath.empty());
+  fs::last_write_time(fPath, fs::file_time_type::clock::now() - 3h);
+
+  // Loading f makes it the most recently used, so b and c go first.
+  EXPECT_NE(nullptr, cache->getObject(f.get()));
+  auto g = module("g");
+  compile(*cache, *g, 100);
+  EXPECT_EQ(2u, cache->NumEvictions());
+  EXPECT_FALSE(fs::exists(dir / "b.o"));
+  EXPECT_FALSE(fs::exists(dir / "c.o"));
+  EXPECT_TRUE(fs::exists(fPath));
+  EXPECT_EQ(2u, objects().size());
+}
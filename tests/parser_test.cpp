@@ -32,10 +32,17 @@ protected:
                                                { return mockGetChar(); });
 
     lexer = std::make_unique<Lexer>(std::move(inputPtr));
-    lexer->GetNextToken();
     parser = std::make_unique<Parser>(std::move(lexer));
   }
 
+  // Unwrap a successful parse result, or return nullptr on a parse error.
+  static AST *unwrap(ParseResult r)
+  {
+    if (r.isError())
+      return nullptr;
+    return r.value();
+  }
+
   MockStdIn *mockInput;
   std::unique_ptr<Lexer> lexer;
   std::unique_ptr<Parser> parser;
@@ -45,185 +52,303 @@ TEST_F(ParserTest, NumberExpr)
 {
   SetUp("123.456");
 
-  auto ast = parser->parseNumberExpr();
+  auto ast = unwrap(parser->parseNumberExpr());
 
-  NumberExprAST *ptr = dynamic_cast<NumberExprAST *>(ast.get());
-  EXPECT_NE(nullptr, ptr);
+  NumberExprAST *ptr = dynamic_cast<NumberExprAST *>(ast);
+  ASSERT_NE(nullptr, ptr);
   EXPECT_EQ(123.456, ptr->Val);
 }
 
 TEST_F(ParserTest, VariableExpr)
 {
   SetUp("foo 123");
-  auto ast = parser->parseIdentifierExpr();
-  VariableExprAST *ptr = dynamic_cast<VariableExprAST *>(ast.get());
-  EXPECT_NE(nullptr, ptr);
-  EXPECT_EQ("foo", ptr->Name);
+  auto ast = unwrap(parser->parseIdentifierExpr());
+  VariableExprAST *ptr = dynamic_cast<VariableExprAST *>(ast);
+  ASSERT_NE(nullptr, ptr);
+  EXPECT_EQ("foo", ptr->Name.str());
 }
 
 TEST_F(ParserTest, CallExpr)
 {
   SetUp("func0()");
-  auto ast = parser->parseIdentifierExpr();
-  CallExprAST *ptr = dynamic_cast<CallExprAST *>(ast.get());
-  EXPECT_NE(nullptr, ptr);
-  EXPECT_EQ("func0", ptr->Callee);
+  auto ast = unwrap(parser->parseIdentifierExpr());
+  CallExprAST *ptr = dynamic_cast<CallExprAST *>(ast);
+  ASSERT_NE(nullptr, ptr);
+  EXPECT_EQ("func0", ptr->Callee.str());
   EXPECT_EQ(0, ptr->Args.size());
 
   SetUp("func1(x)");
-  ast = parser->parseIdentifierExpr();
-  ptr = dynamic_cast<CallExprAST *>(ast.get());
-  EXPECT_NE(nullptr, ptr);
-  EXPECT_EQ("func1", ptr->Callee);
+  ast = unwrap(parser->parseIdentifierExpr());
+  ptr = dynamic_cast<CallExprAST *>(ast);
+  ASSERT_NE(nullptr, ptr);
+  EXPECT_EQ("func1", ptr->Callee.str());
   EXPECT_EQ(1, ptr->Args.size());
 
   SetUp("func2(3, x)");
-  ast = parser->parseIdentifierExpr();
-  ptr = dynamic_cast<CallExprAST *>(ast.get());
-  EXPECT_NE(nullptr, ptr);
-  EXPECT_EQ("func2", ptr->Callee);
+  ast = unwrap(parser->parseIdentifierExpr());
+  ptr = dynamic_cast<CallExprAST *>(ast);
+  ASSERT_NE(nullptr, ptr);
+  EXPECT_EQ("func2", ptr->Callee.str());
   EXPECT_EQ(2, ptr->Args.size());
 
   SetUp("func3(3, (x), y)");
-  ast = parser->parseIdentifierExpr();
-  ptr = dynamic_cast<CallExprAST *>(ast.get());
-  EXPECT_NE(nullptr, ptr);
-  EXPECT_EQ("func3", ptr->Callee);
+  ast = unwrap(parser->parseIdentifierExpr());
+  ptr = dynamic_cast<CallExprAST *>(ast);
+  ASSERT_NE(nullptr, ptr);
+  EXPECT_EQ("func3", ptr->Callee.str());
   EXPECT_EQ(3, ptr->Args.size());
 
   SetUp("func0(");
-  ast = parser->parseIdentifierExpr();
+  ast = unwrap(parser->parseIdentifierExpr());
   EXPECT_EQ(nullptr, ast);
 
   SetUp("func0)");
-  ast = parser->parseIdentifierExpr();
+  ast = unwrap(parser->parseIdentifierExpr());
   EXPECT_NE(nullptr, ast);
 
   SetUp("func0(())");
-  ast = parser->parseIdentifierExpr();
+  ast = unwrap(parser->parseIdentifierExpr());
   EXPECT_EQ(nullptr, ast);
 
   SetUp("func0(,)");
-  ast = parser->parseIdentifierExpr();
+  ast = unwrap(parser->parseIdentifierExpr());
   EXPECT_EQ(nullptr, ast);
 
   SetUp("func1(extern)");
-  ast = parser->parseIdentifierExpr();
+  ast = unwrap(parser->parseIdentifierExpr());
   EXPECT_EQ(nullptr, ast);
 
   SetUp("func2(x,");
-  ast = parser->parseIdentifierExpr();
+  ast = unwrap(parser->parseIdentifierExpr());
   EXPECT_EQ(nullptr, ast);
 
   SetUp("func2(x,)");
-  ast = parser->parseIdentifierExpr();
+  ast = unwrap(parser->parseIdentifierExpr());
   EXPECT_EQ(nullptr, ast);
 
   SetUp("func2(extern,)");
-  ast = parser->parseIdentifierExpr();
+  ast = unwrap(parser->parseIdentifierExpr());
   EXPECT_EQ(nullptr, ast);
 
   SetUp("func2((x),)");
-  ast = parser->parseIdentifierExpr();
+  ast = unwrap(parser->parseIdentifierExpr());
   EXPECT_EQ(nullptr, ast);
 }
 
 TEST_F(ParserTest, ParenExpr)
 {
   SetUp("(x)");
-  auto ast = parser->parseParenExpr();
-  VariableExprAST *ptr1 = dynamic_cast<VariableExprAST *>(ast.get());
-  EXPECT_NE(nullptr, ptr1);
-  EXPECT_EQ("x", ptr1->Name);
+  auto ast = unwrap(parser->parseParenExpr());
+  VariableExprAST *ptr1 = dynamic_cast<VariableExprAST *>(ast);
+  ASSERT_NE(nullptr, ptr1);
+  EXPECT_EQ("x", ptr1->Name.str());
 
   SetUp("(1.0)");
-  ast = parser->parseParenExpr();
-  NumberExprAST *ptr2 = dynamic_cast<NumberExprAST *>(ast.get());
-  EXPECT_NE(nullptr, ptr2);
+  ast = unwrap(parser->parseParenExpr());
+  NumberExprAST *ptr2 = dynamic_cast<NumberExprAST *>(ast);
+  ASSERT_NE(nullptr, ptr2);
   EXPECT_EQ(1.0, ptr2->Val);
 
   SetUp("(x");
-  ast = parser->parseParenExpr();
+  ast = unwrap(parser->parseParenExpr());
   EXPECT_EQ(nullptr, ast);
 }
 
 TEST_F(ParserTest, PrimaryExpr)
 {
   SetUp("123.456");
-  auto ast = parser->parsePrimaryExpr();
-  NumberExprAST *ptr1 = dynamic_cast<NumberExprAST *>(ast.get());
-  EXPECT_NE(nullptr, ptr1);
+  auto ast = unwrap(parser->parsePrimaryExpr());
+  NumberExprAST *ptr1 = dynamic_cast<NumberExprAST *>(ast);
+  ASSERT_NE(nullptr, ptr1);
   EXPECT_EQ(123.456, ptr1->Val);
 
   SetUp("func1(x)");
-  ast = parser->parsePrimaryExpr();
-  CallExprAST *ptr2 = dynamic_cast<CallExprAST *>(ast.get());
-  EXPECT_NE(nullptr, ptr2);
-  EXPECT_EQ("func1", ptr2->Callee);
+  ast = unwrap(parser->parsePrimaryExpr());
+  CallExprAST *ptr2 = dynamic_cast<CallExprAST *>(ast);
+  ASSERT_NE(nullptr, ptr2);
+  EXPECT_EQ("func1", ptr2->Callee.str());
   EXPECT_EQ(1, ptr2->Args.size());
 
   SetUp("(func1((x)))");
-  ast = parser->parsePrimaryExpr();
-  CallExprAST *ptr3 = dynamic_cast<CallExprAST *>(ast.get());
-  EXPECT_NE(nullptr, ptr3);
-  EXPECT_EQ("func1", ptr3->Callee);
+  ast = unwrap(parser->parsePrimaryExpr());
+  CallExprAST *ptr3 = dynamic_cast<CallExprAST *>(ast);
+  ASSERT_NE(nullptr, ptr3);
+  EXPECT_EQ("func1", ptr3->Callee.str());
   EXPECT_EQ(1, ptr3->Args.size());
 }
 
 TEST_F(ParserTest, Expression)
 {
   SetUp("x + y*2*z - z + 2*(x + y) < x * z");
-  std::unique_ptr<ExprAST> ast = parser->parseExpression();
-  BinaryExprAST *ptr = dynamic_cast<BinaryExprAST *>(ast.get());
-  EXPECT_NE(nullptr, ptr);
+  auto ast = unwrap(parser->parseExpression());
+  BinaryExprAST *ptr = dynamic_cast<BinaryExprAST *>(ast);
+  ASSERT_NE(nullptr, ptr);
   EXPECT_EQ('<', ptr->Op);
 }
 
 TEST_F(ParserTest, Prototype)
 {
   SetUp("fib(x)");
-  std::unique_ptr<PrototypeAST> ast = parser->parsePrototype();
-  EXPECT_NE(nullptr, ast);
-  EXPECT_EQ("fib", ast->Name);
-  EXPECT_EQ(1, ast->Args.size());
+  auto ast = unwrap(parser->parsePrototype());
+  PrototypeAST *ptr = dynamic_cast<PrototypeAST *>(ast);
+  ASSERT_NE(nullptr, ptr);
+  EXPECT_EQ("fib", ptr->Name.str());
+  EXPECT_EQ(1, ptr->Args.size());
 
   SetUp("func0()");
-  ast = parser->parsePrototype();
-  EXPECT_NE(nullptr, ast);
-  EXPECT_EQ("func0", ast->Name);
-  EXPECT_EQ(0, ast->Args.size());
-
-  SetUp("func2(x y)");
-  ast = parser->parsePrototype();
-  EXPECT_NE(nullptr, ast);
-  EXPECT_EQ("func2", ast->Name);
-  EXPECT_EQ(2, ast->Args.size());
+  ast = unwrap(parser->parsePrototype());
+  ptr = dynamic_cast<PrototypeAST *>(ast);
+  ASSERT_NE(nullptr, ptr);
+  EXPECT_EQ("func0", ptr->Name.str());
+  EXPECT_EQ(0, ptr->Args.size());
 
-  SetUp("func3(x y z)");
-  ast = parser->parsePrototype();
-  EXPECT_NE(nullptr, ast);
-  EXPECT_EQ("func3", ast->Name);
-  EXPECT_EQ(3, ast->Args.size());
+  SetUp("func2(x, y)");
+  ast = unwrap(parser->parsePrototype());
+  ptr = dynamic_cast<PrototypeAST *>(ast);
+  ASSERT_NE(nullptr, ptr);
+  EXPECT_EQ("func2", ptr->Name.str());
+  ASSERT_EQ(2, ptr->Args.size());
+  EXPECT_EQ("x", ptr->Args[0].str());
+  EXPECT_EQ("y", ptr->Args[1].str());
+
+  SetUp("func3(x, y, z)");
+  ast = unwrap(parser->parsePrototype());
+  ptr = dynamic_cast<PrototypeAST *>(ast);
+  ASSERT_NE(nullptr, ptr);
+  EXPECT_EQ("func3", ptr->Name.str());
+  EXPECT_EQ(3, ptr->Args.size());
 
   SetUp("func2(x y");
-  ast = parser->parsePrototype();
+  ast = unwrap(parser->parsePrototype());
   EXPECT_EQ(nullptr, ast);
 
   SetUp("func2(x def");
-  ast = parser->parsePrototype();
+  ast = unwrap(parser->parsePrototype());
   EXPECT_EQ(nullptr, ast);
 }
 
 TEST_F(ParserTest, Extern)
 {
   SetUp("extern fib(x)");
-  std::unique_ptr<PrototypeAST> ast = parser->parseExtern();
-  EXPECT_NE(nullptr, ast);
+  auto ast = unwrap(parser->parseExtern());
+  EXPECT_NE(nullptr, dynamic_cast<PrototypeAST *>(ast));
 }
 
 TEST_F(ParserTest, Definition)
 {
   SetUp("def inc(x) x + 1");
-  std::unique_ptr<FunctionAST> ast = parser->parseDefinition();
-  EXPECT_NE(nullptr, ast);
-}
\ No newline at end of file
+  auto ast = unwrap(parser->parseDefinition());
+  EXPECT_NE(nullptr, dynamic_cast<FunctionAST *>(ast));
+}
+
+TEST_F(ParserTest, Program)
+{
+  SetUp("def inc(x) x + 1; extern sin(x); def bad(x x; inc(2)");
+  auto r = parser->ParseProgram();
+  ASSERT_TRUE(r.isOk());
+  auto program = r.value();
+
+  // The nodes of the failed definition are rolled back, the rest are kept.
+  ASSERT_EQ(3, program->Nodes.size());
+  EXPECT_NE(nullptr, dynamic_cast<FunctionAST *>(program->Nodes[0]));
+  EXPECT_NE(nullptr, dynamic_cast<PrototypeAST *>(program->Nodes[1]));
+  auto main = dynamic_cast<FunctionAST *>(program->Nodes[2]);
+  ASSERT_NE(nullptr, main);
+  EXPECT_TRUE(main->Proto->isMain());
+  EXPECT_NE(nullptr, program->NodeArena);
+}
+
+TEST_F(ParserTest, ProgramWithoutItems)
+{
+  SetUp("def inc(x) x + 1; extern sin(x); inc(2)");
+  parser->KeepItems = false;
+  auto r = parser->ParseProgram();
+  ASSERT_TRUE(r.isOk());
+  auto program = r.value();
+
+  // Every item was rolled back once parsed.
+  EXPECT_EQ(0, program->Nodes.size());
+  EXPECT_EQ(1, program->NodeArena->numBlocks());
+}
+
+TEST(PreLexedParserTest, Program)
+{
+  Lexer lexer(std::make_unique<MemoryInput>("def inc(x) x + 1; extern sin(x); def bad(x x; inc(2)"));
+  Parser parser(std::make_shared<TokenBuffer>(lexer.Tokenize()));
+  auto r = parser.ParseProgram();
+  ASSERT_TRUE(r.isOk());
+  auto program = r.value();
+  ASSERT_EQ(3, program->Nodes.size());
+  auto call = dynamic_cast<FunctionAST *>(program->Nodes[2]);
+  ASSERT_NE(nullptr, call);
+  EXPECT_TRUE(call->Proto->isMain());
+}
+
+TEST(PreLexedParserTest, Offsets)
+{
+  Lexer lexer(std::make_unique<MemoryInput>("def f(x)\n  x * g(2)"));
+  Parser parser(std::make_shared<TokenBuffer>(lexer.Tokenize()));
+  auto r = parser.ParseProgram();
+  ASSERT_TRUE(r.isOk());
+  auto program = r.value();
+  ASSERT_EQ(1, program->Nodes.size());
+
+  auto fn = dynamic_cast<FunctionAST *>(program->Nodes[0]);
+  ASSERT_NE(nullptr, fn);
+  EXPECT_EQ(0u, fn->Offset);
+  EXPECT_EQ(4u, fn->Proto->Offset);
+  auto mul = dynamic_cast<BinaryExprAST *>(fn->Body);
+  ASSERT_NE(nullptr, mul);
+  EXPECT_EQ(13u, mul->Offset);
+  EXPECT_EQ(11u, mul->LHS->Offset);
+  auto call = dynamic_cast<CallExprAST *>(mul->RHS);
+  ASSERT_NE(nullptr, call);
+  EXPECT_EQ(15u, call->Offset);
+  EXPECT_EQ(17u, call->Args[0]->Offset);
+}
+
+TEST(PreLexedParserTest, Empty)
+{
+  Parser parser(std::make_shared<TokenBuffer>());
+  auto r = parser.ParseProgram();
+  ASSERT_TRUE(r.isOk());
+  EXPECT_EQ(0, r.value()->Nodes.size());
+}
+
+TEST(PreLexedParserTest, Parallel)
+{
+  // Recovering from "1 + def" skips the 'def', so that item runs past a
+  // chunk boundary and the next chunk has to be parsed again.
+  std::string source;
+  for (int i = 0; i < 500; i++)
+  {
+    source += "def f" + std::to_string(i) + "(x) x + " + std::to_string(i) + "\n";
+    if (i % 7 == 0)
+      source += "1 + def g(x) x\n";
+    if (i % 11 == 0)
+      source += "extern ; f0(1);\n";
+  }
+
+  auto tokens = std::make_shared<TokenBuffer>(
+      Lexer(std::make_unique<MemoryInput>(source)).Tokenize());
+
+  testing::internal::CaptureStderr();
+  auto serial = Parser(tokens).ParseProgram().value();
+  std::string serialOutput = testing::internal::GetCapturedStderr();
+
+  ThreadPool pool(4);
+  testing::internal::CaptureStderr();
+  auto parallel = Parser(tokens).ParseProgramParallel(pool).value();
+  std::string parallelOutput = testing::internal::GetCapturedStderr();
+
+  EXPECT_EQ(serialOutput, parallelOutput);
+  ASSERT_EQ(serial->Nodes.size(), parallel->Nodes.size());
+  for (size_t i = 0; i < serial->Nodes.size(); i++)
+  {
+    auto *a = serial->Nodes[i];
+    auto *b = parallel->Nodes[i];
+    ASSERT_EQ(typeid(*a), typeid(*b)) << i;
+    if (auto fn = dynamic_cast<FunctionAST *>(a))
+      EXPECT_EQ(fn->Proto->getName(), dynamic_cast<FunctionAST *>(b)->Proto->getName()) << i;
+  }
+}
@@ -0,0 +1,254 @@
+#include "gtest/gtest.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "codegen/codegen.h"
+#include "jit/jit_manager.h"
+#include "lexer/input.h"
+#include "lexer/lexer.h"
+#include "parser/parser.h"
+#include "passes/pass_manager.h"
+
+#include "ast/BinaryExprAST.h"
+#include "ast/CallExprAST.h"
+#include "ast/FunctionAST.h"
+#include "ast/IfExprAST.h"
+#include "ast/NumberExprAST.h"
+#include "ast/ProgramAST.h"
+#include "ast/PrototypeAST.h"
+#include "ast/VariableExprAST.h"
+
+// Show prints an expression as an s-expression, e.g. (+ x 1).
+class Show : public Visitor
+{
+public:
+  std::string out;
+
+  std::optional<Error> visit(NumberExprAST *ast) override
+  {
+    std::string s = std::to_string(ast->Val);
+    s.erase(s.find_last_not_of('0') + 1);
+    if (s.back() == '.')
+      s.pop_back();
+    out += s;
+    return std::nullopt;
+  }
+  std::optional<Error> visit(VariableExprAST *ast) override
+  {
+    out += ast->Name.str();
+    return std::nullopt;
+  }
+  std::optional<Error> visit(IfExprAST *ast) override
+  {
+    out += "(if ";
+    ast->Cond->accept(this);
+    out += " ";
+    ast->Then->accept(this);
+    out += " ";
+    ast->Else->accept(this);
+    out += ")";
+    return std::nullopt;
+  }
+  std::optional<Error> visit(CallExprAST *ast) override
+  {
+    out += "(" + std::string(ast->Callee.str());
+    for (ExprAST *arg : ast->Args)
+    {
+      out += " ";
+      arg->accept(this);
+    }
+    out += ")";
+    return std::nullopt;
+  }
+  std::optional<Error> visit(BinaryExprAST *ast) override
+  {
+    out += "(" + std::string(1, ast->Op) + " ";
+    ast->LHS->accept(this);
+    out += " ";
+    ast->RHS->accept(this);
+    out += ")";
+    return std::nullopt;
+  }
+  std::optional<Error> visit(PrototypeAST *ast) override { return std::nullopt; }
+  std::optional<Error> visit(FunctionAST *ast) override { return ast->Body->accept(this); }
+  std::optional<Error> visit(ProgramAST *ast) override { return std::nullopt; }
+};
+
+class PassesTest : public testing::Test
+{
+protected:
+  // Run the passes over source and show the body of every function.
+  std::vector<std::string> optimize(const std::string &source)
+  {
+    Lexer lexer(std::make_unique<MemoryInput>(source));
+    Parser parser(std::make_shared<TokenBuffer>(lexer.Tokenize()));
+    program = parser.ParseProgram({&passes}).value();
+
+    std::vector<std::string> bodies;
+    for (AST *node : program->Nodes)
+    {
+      if (auto fn = dynamic_cast<FunctionAST *>(node))
+      {
+        Show show;
+        fn->accept(&show);
+        bodies.push_back(show.out);
+      }
+    }
+    return bodies;
+  }
+
+  ASTPassManager passes;
+  std::unique_ptr<ProgramAST> program;
+};
+
+TEST_F(PassesTest, ConstantFolding)
+{
+  EXPECT_EQ((std::vector<std::string>{"7", "1", "0", "(+ x 3)", "(+ (+ x 1) 2)"}),
+            optimize("1 + 2 * 3; 2 < 3; 3 < 2 - 1;"
+                     "def f(x) x + (1 + 2);"
+                     "def g(x) x + 1 + 2;"));
+}
+
+TEST_F(PassesTest, DeadBranchElimination)
+{
+  EXPECT_EQ((std::vector<std::string>{"x", "(* x 3)", "(if x 1 2)", "4"}),
+            optimize("def f(x) if 1 then x else x * 3;"
+                     "def g(x) if 2 < 1 then x else x * 3;"
+                     "def h(x) if x then 1 else 2;"
+                     "if 0 - 1 then 4 else 5;"));
+}
+
+TEST_F(PassesTest, AlgebraicSimplification)
+{
+  // x + 0 and 0 * x differ from x for -0, infinities and NaNs.
+  EXPECT_EQ((std::vector<std::string>{"x", "x", "(+ x 0)", "(* 0 x)"}),
+            optimize("def f(x) 1 * x * 1 - 0;"
+                     "def g(x) x + (0 - 0) * 1 * (0 - 1);"
+                     "def h(x) x + 0;"
+                     "def k(x) 0 * x;"));
+}
+
+TEST_F(PassesTest, StrengthReduction)
+{
+  EXPECT_EQ((std::vector<std::string>{"(+ x x)", "(+ x x)", "(* (+ x y) 2)"}),
+            optimize("def f(x) x * 2;"
+                     "def g(x) 2 * x;"
+                     "def h(x, y) (x + y) * 2;"));
+}
+
+TEST_F(PassesTest, Inlining)
+{
+  auto bodies = optimize(
+      "extern h(x);"
+      "def sq(x) x * x;"
+      "def id(x) x;"
+      "sq(3);"
+      "def a(y) sq(y) + id(y + 1);"
+      "def b(y) sq(y + 1);"
+      "def c(y) id(h(y));"
+      "def d(y) sq(y, 1);"
+      "def fact(n) if n < 2 then 1 else n * fact(n - 1);"
+      "fact(3);");
+  EXPECT_EQ((std::vector<std::string>{
+                "(* x x)",
+                "x",
+                "9",
+                "(+ (* y y) (+ y 1))",
+                // Inlining would evaluate y + 1 twice, and h(y) could move.
+                "(sq (+ y 1))",
+                "(id (h y))",
+                "(sq y 1)",
+                "(if (< n 2) 1 (* n (fact (- n 1))))",
+                "(fact 3)",
+            }),
+            bodies);
+}
+
+TEST_F(PassesTest, RedefinitionsAreNotInlined)
+{
+  // CodeGen rejects the second definition and the conflicting extern.
+  EXPECT_EQ((std::vector<std::string>{"1", "2", "1", "(+ x 1)", "(g 1)"}),
+            optimize("def f() 1; def f() 2; f();"
+                     "def g(x) x + 1; extern g(x, y); g(1);"));
+}
+
+TEST_F(PassesTest, ErrorsAreNotDropped)
+{
+  // CodeGen reports the unknown variables and functions, y and g, also in
+  // a branch that is never taken or an argument that is never used.
+  EXPECT_EQ((std::vector<std::string>{"(if 0 y x)", "(if 1 x (g x))", "1", "(k y)", "(k (+ y 1))", "1"}),
+            optimize("def f(x) if 0 then y else x;"
+                     "def h(x) if 1 then x else g(x);"
+                     "def k(x) 1;"
+                     "k(y);"
+                     "k(y + 1);"
+                     "k(2);"));
+}
+
+TEST_F(PassesTest, DroppedItemsKeepInlinedBodies)
+{
+  // As in a session, every item is shown as it comes and then dropped,
+  // along with the nodes the passes rewrote for it.
+  Lexer lexer(std::make_unique<MemoryInput>("def sq(x) x * x;"
+                                            "def a(y) sq(y) + 1;"
+                                            "def b(z) sq(z) * 3;"
+                                            "sq(3);"));
+  Parser parser(std::make_shared<TokenBuffer>(lexer.Tokenize()));
+  parser.KeepItems = false;
+  passes.KeepNodes = false;
+  Show show;
+  ASSERT_FALSE(parser.ParseProgram({&passes, &show}).isError());
+  EXPECT_EQ("(* x x)"
+            "(+ (* y y) 1)"
+            "(* (* z z) 3)"
+            "9",
+            show.out);
+}
+
+// check runs CodeGen in check mode over the items of source, after the
+// passes if optimized, as above -O0, and returns the errors it reports.
+static std::vector<std::string> check(const std::string &source, bool optimized)
+{
+  Lexer lexer(std::make_unique<MemoryInput>(source));
+  Parser parser(std::make_shared<TokenBuffer>(lexer.Tokenize()));
+  auto program = parser.ParseProgram().value();
+
+  ASTPassManager passes;
+  CodeGen checker(std::make_shared<JITManager>());
+  checker.CheckOnly = true;
+  std::vector<std::string> errors;
+  for (AST *node : program->Nodes)
+  {
+    if (optimized)
+      node->accept(&passes);
+    if (auto err = node->accept(&checker))
+      errors.push_back(err->message);
+  }
+  return errors;
+}
+
+TEST(ASTPassManagerTest, SameErrorsAtO0AndO2)
+{
+  for (const char *source : {
+           "def f(x) if 0 then y else x;",
+           "def f(x) if 1 then x else g(x);",
+           "def k(x) 1; k(y);",
+           "def k(x) 1; k(y + 1);",
+           "def k(x) 1; def f(x) k(if 0 then y else x);",
+       })
+  {
+    std::vector<std::string> errors = check(source, false);
+    EXPECT_FALSE(errors.empty()) << source;
+    EXPECT_EQ(errors, check(source, true)) << source;
+  }
+}
+
+TEST(ASTPassManagerTest, WithoutInlining)
+{
+  ASTPassManager passes(/*inlining*/ false);
+  EXPECT_EQ(4u, passes.passes().size());
+  for (Rewriter *pass : passes.passes())
+    EXPECT_STRNE("inliner", pass->name());
+}
@@ -0,0 +1,66 @@
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "utils/phase_timer.h"
+
+using namespace std::chrono_literals;
+
+// Timers are global, so this runs before any test enables them.
+TEST(PhaseTimerTest, DisabledTimersRecordNothing)
+{
+  ASSERT_FALSE(PhaseTimers::Enabled());
+  {
+    ScopedPhase timer(Phase::Execute);
+  }
+  EXPECT_EQ(0u, PhaseTimers::Count(Phase::Execute));
+}
+
+TEST(PhaseTimerTest, NestedPhasesAreExclusive)
+{
+  PhaseTimers::Enable(/*perFunction*/ true);
+
+  auto start = std::chrono::steady_clock::now();
+  {
+    ScopedPhase outer(Phase::Parse);
+    std::this_thread::sleep_for(10ms);
+    {
+      ScopedPhase inner(Phase::Lex);
+      std::this_thread::sleep_for(10ms);
+    }
+  }
+  int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+
+  EXPECT_EQ(1u, PhaseTimers::Count(Phase::Parse));
+  EXPECT_EQ(1u, PhaseTimers::Count(Phase::Lex));
+  EXPECT_GE(PhaseTimers::TotalNs(Phase::Parse), 10'000'000);
+  EXPECT_GE(PhaseTimers::TotalNs(Phase::Lex), 10'000'000);
+  // The time of the inner phase is not counted for the outer one too.
+  EXPECT_LE(PhaseTimers::TotalNs(Phase::Parse) + PhaseTimers::TotalNs(Phase::Lex), elapsed);
+}
+
+TEST(PhaseTimerTest, WritesTrace)
+{
+  std::string path = testing::TempDir() + "phase_timer_test.json";
+  PhaseTimers::EnableTrace(path);
+  {
+    ScopedPhase timer(Phase::Compile, "fib");
+  }
+  ASSERT_FALSE(PhaseTimers::WriteTrace().has_value());
+
+  std::ifstream in(path);
+  std::stringstream trace;
+  trace << in.rdbuf();
+  std::remove(path.c_str());
+  EXPECT_EQ(0u, trace.str().find("{\"displayTimeUnit\":\"ms\",\"traceEvents\":["));
+  EXPECT_NE(std::string::npos,
+            trace.str().find("{\"name\":\"compile\",\"cat\":\"kaleidoscope\",\"ph\":\"X\""));
+  EXPECT_NE(std::string::npos, trace.str().find("\"args\":{\"function\":\"fib\"}"));
+}
@@ -0,0 +1,164 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+
+#include "jit/slab_memory_manager.h"
+
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/ExecutionEngine/Orc/Core.h"
+#include "llvm/ExecutionEngine/Orc/ExecutorProcessControl.h"
+#include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
+#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/ExecutionEngine/Orc/Mangling.h"
+#include "llvm/ExecutionEngine/Orc/ObjectLinkingLayer.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/TargetSelect.h"
+
+using namespace llvm::orc;
+
+static constexpr size_t slabSize = 4096;
+
+class SlabMemoryManagerTest : public testing::Test
+{
+protected:
+  // Linked is an object added under a tracker of its own, with the
+  // address of its zero-filled buffer.
+  struct Linked
+  {
+    ResourceTrackerSP tracker;
+    char *buf = nullptr;
+  };
+
+  void TearDown() override
+  {
+    if (es)
+      EXPECT_FALSE(es->endSession());
+  }
+
+  // start links objects into slabs of slabSize bytes, with reserveSize
+  // bytes of address space for each kind of slab.
+  void start(size_t reserveSize)
+  {
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+
+    es = std::make_unique<ExecutionSession>(exitOnErr(SelfExecutorProcessControl::Create()));
+    es->setErrorReporter([this](llvm::Error err)
+                         { reported += llvm::toString(std::move(err)); });
+    JITTargetMachineBuilder jtmb(es->getExecutorProcessControl().getTargetTriple());
+    dl = std::make_unique<llvm::DataLayout>(exitOnErr(jtmb.getDefaultDataLayoutForTarget()));
+    mangle = std::make_unique<MangleAndInterner>(*es, *dl);
+
+    mm = SlabMemoryManager::Create(slabSize, false, reserveSize).value();
+    linker = std::make_unique<ObjectLinkingLayer>(*es, *mm);
+    compiler = std::make_unique<IRCompileLayer>(*es, *linker, std::make_unique<ConcurrentIRCompiler>(jtmb));
+    jd = &es->createBareJITDylib("main");
+  }
+
+  // link links an object whose function name returns a buffer of size
+  // bytes, which the object does not store but has zero-filled.
+  llvm::Expected<Linked> link(const std::string &name, size_t size)
+  {
+    auto ctx = std::make_unique<llvm::LLVMContext>();
+    auto m = std::make_unique<llvm::Module>(name, *ctx);
+    m->setDataLayout(*dl);
+    auto type = llvm::ArrayType::get(llvm::Type::getInt8Ty(*ctx), size);
+    auto buf = new llvm::GlobalVariable(*m, type, false, llvm::GlobalValue::InternalLinkage,
+                                        llvm::ConstantAggregateZero::get(type), "buf");
+    buf->setAlignment(llvm::Align(16));
+    auto fn = llvm::Function::Create(llvm::FunctionType::get(buf->getType(), false),
+                                     llvm::Function::ExternalLinkage, name, *m);
+    llvm::IRBuilder<> builder(llvm::BasicBlock::Create(*ctx, "entry", fn));
+    builder.CreateRet(buf);
+
+    Linked linked;
+    linked.tracker = jd->createResourceTracker();
+    if (auto err = compiler->add(linked.tracker, ThreadSafeModule(std::move(m), std::move(ctx))))
+      return std::move(err);
+    auto sym = es->lookup({jd}, (*mangle)(name));
+    if (!sym)
+      return sym.takeError();
+    linked.buf = sym->getAddress().toPtr<char *(*)()>()();
+    return linked;
+  }
+
+  llvm::ExitOnError exitOnErr;
+  std::unique_ptr<ExecutionSession> es;
+  std::unique_ptr<llvm::DataLayout> dl;
+  std::unique_ptr<MangleAndInterner> mangle;
+  std::unique_ptr<SlabMemoryManager> mm;
+  std::unique_ptr<ObjectLinkingLayer> linker;
+  std::unique_ptr<IRCompileLayer> compiler;
+  JITDylib *jd = nullptr;
+  std::string reported;
+};
+
+TEST_F(SlabMemoryManagerTest, FreedMemoryIsReusedAndZeroed)
+{
+  start(SlabMemoryManager::DefaultReserveSize);
+  Linked a = exitOnErr(link("a", 1000));
+  EXPECT_GT(mm->UsedBytes(), 1000u);
+  std::fill_n(a.buf, 1000, '\xff');
+  exitOnErr(a.tracker->remove());
+  EXPECT_EQ(0u, mm->UsedBytes());
+
+  // The first free range is a's, and the buffer has to read as zeros.
+  Linked b = exitOnErr(link("b", 1000));
+  EXPECT_EQ(a.buf, b.buf);
+  EXPECT_EQ(b.buf + 1000, std::find_if(b.buf, b.buf + 1000, [](char c)
+                                       { return c != 0; }));
+}
+
+TEST_F(SlabMemoryManagerTest, FreedNeighboursAreMerged)
+{
+  start(SlabMemoryManager::DefaultReserveSize);
+  Linked a = exitOnErr(link("a", 1024));
+  Linked b = exitOnErr(link("b", 1024));
+  Linked c = exitOnErr(link("c", 1024));
+  // Each object's segment may hold a little more than its buffer.
+  ptrdiff_t stride = b.buf - a.buf;
+  ASSERT_GE(stride, 1024);
+  ASSERT_EQ(stride, c.buf - b.buf);
+
+  // b joins the ranges of a before it and of c after it, so that a buffer
+  // larger than two of them fits where a was.
+  exitOnErr(a.tracker->remove());
+  exitOnErr(c.tracker->remove());
+  exitOnErr(b.tracker->remove());
+  Linked d = exitOnErr(link("d", 2 * stride + 1024));
+  EXPECT_EQ(a.buf, d.buf);
+}
+
+TEST_F(SlabMemoryManagerTest, GrowsWithinTheReservation)
+{
+  start(SlabMemoryManager::DefaultReserveSize);
+  Linked a = exitOnErr(link("a", 3000));
+  size_t slabs = mm->NumSlabs();
+  EXPECT_EQ(slabs * slabSize, mm->SlabBytes());
+
+  // b does not fit in the rest of a's slab, which grows into the next.
+  Linked b = exitOnErr(link("b", 3000));
+  EXPECT_EQ(slabs + 1, mm->NumSlabs());
+  EXPECT_LT(a.buf, b.buf);
+  std::fill_n(b.buf, 3000, 'b');
+}
+
+TEST_F(SlabMemoryManagerTest, OutOfCodeMemory)
+{
+  start(4 * slabSize);
+  exitOnErr(link("a", 1000));
+  size_t used = mm->UsedBytes();
+
+  llvm::Expected<Linked> big = link("big", 8 * slabSize);
+  ASSERT_FALSE(big);
+  llvm::consumeError(big.takeError());
+  EXPECT_NE(std::string::npos, reported.find("the JIT is out of code memory")) << reported;
+  // What the object got before its data ran out is given back.
+  EXPECT_EQ(used, mm->UsedBytes());
+}
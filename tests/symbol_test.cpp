@@ -0,0 +1,38 @@
+#include "gtest/gtest.h"
+
+#include <string>
+
+#include "utils/symbol.h"
+
+TEST(SymbolTest, Intern)
+{
+  Symbol foo = Symbol::Intern("foo");
+  Symbol bar = Symbol::Intern("bar");
+
+  EXPECT_FALSE(foo.empty());
+  EXPECT_NE(foo, bar);
+  EXPECT_EQ(foo, Symbol::Intern(std::string("foo")));
+  EXPECT_EQ("foo", foo.str());
+  EXPECT_EQ("bar", bar.str());
+  EXPECT_LT(foo.getId(), Symbol::NumSymbols());
+
+  EXPECT_TRUE(Symbol().empty());
+  EXPECT_EQ("", Symbol().str());
+}
+
+TEST(SymbolTest, SymbolMap)
+{
+  Symbol x = Symbol::Intern("x");
+  Symbol y = Symbol::Intern("y");
+
+  SymbolMap<int> map;
+  EXPECT_EQ(0, map.get(x));
+  map[y] = 2;
+  EXPECT_EQ(0, map.get(x));
+  EXPECT_EQ(2, map.get(y));
+  map[x] = 1;
+  EXPECT_EQ(1, map.get(x));
+
+  map.clear();
+  EXPECT_EQ(0, map.get(y));
+}